@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "arena.h"
+
+/* The size of a huge page; mappings using huge pages must be a multiple */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Rounds value up to the nearest multiple of alignment, a power of two */
+#define ALIGN_UP(value, alignment) \
+    (((value) + (alignment) - 1) & ~((size_t)(alignment) - 1))
+
+size_t
+arena_stride(size_t width, size_t element_size)
+{
+    return ALIGN_UP(width * element_size, ARENA_ALIGNMENT);
+}
+
+/**
+ * Maps memory backed by huge pages.
+ *
+ * @param size
+ *     The size of the mapping. This is updated to the actual size mapped.
+ * @return the mapped memory, or NULL if huge pages are not available
+ */
+static void*
+arena_map_huge(size_t *size)
+{
+    size_t mapped_size = ALIGN_UP(*size, HUGE_PAGE_SIZE);
+    void *result;
+
+#ifdef MAP_HUGETLB
+    /* Try explicit huge pages first */
+    result = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (result != MAP_FAILED) {
+        *size = mapped_size;
+        return result;
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    /* Fall back on transparent huge pages */
+    result = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (result != MAP_FAILED) {
+        madvise(result, mapped_size, MADV_HUGEPAGE);
+        *size = mapped_size;
+        return result;
+    }
+#endif
+
+    return NULL;
+}
+
+Arena*
+arena_create(size_t size, int flags)
+{
+    Arena *result;
+    void *base = NULL;
+
+    result = malloc(sizeof(Arena));
+    if (!result) {
+        return NULL;
+    }
+
+    size = ALIGN_UP(size, ARENA_ALIGNMENT);
+    result->is_mapped = 0;
+
+    if (flags & ARENA_HUGE_PAGES) {
+        base = arena_map_huge(&size);
+        result->is_mapped = base != NULL;
+    }
+    if (!base && posix_memalign(&base, ARENA_ALIGNMENT, size)) {
+        free(result);
+        return NULL;
+    }
+
+    /* Touch all pages now rather than in the render loop */
+    memset(base, 0, size);
+
+    result->base = base;
+    result->size = size;
+    result->used = 0;
+
+    return result;
+}
+
+void
+arena_free(Arena *arena)
+{
+    if (!arena) {
+        return;
+    }
+
+    if (arena->is_mapped) {
+        munmap(arena->base, arena->size);
+    }
+    else {
+        free(arena->base);
+    }
+    free(arena);
+}
+
+void*
+arena_alloc(Arena *arena, size_t size)
+{
+    void *result;
+
+    size = ALIGN_UP(size, ARENA_ALIGNMENT);
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+
+    result = arena->base + arena->used;
+    arena->used += size;
+    memset(result, 0, size);
+
+    return result;
+}
+
+void
+arena_reset(Arena *arena)
+{
+    arena->used = 0;
+}
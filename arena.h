@@ -0,0 +1,108 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * The alignment of every allocation made from an arena.
+ *
+ * This is the size of a cache line, which is also a multiple of the widest
+ * vector register in use.
+ */
+#define ARENA_ALIGNMENT 64
+
+/**
+ * Flag for arena_create requesting that the arena be backed by huge pages.
+ *
+ * If huge pages are not available, normal pages are used.
+ */
+#define ARENA_HUGE_PAGES (1 << 0)
+
+/**
+ * A single block of memory from which buffers are allocated.
+ *
+ * Allocations are never freed individually; instead the whole arena is reset
+ * once its buffers are no longer used, after which the memory is handed out
+ * again.
+ */
+typedef struct {
+    /** The backing store */
+    unsigned char *base;
+
+    /** The size of the backing store */
+    size_t size;
+
+    /** The number of bytes handed out since the last reset */
+    size_t used;
+
+    /** Whether the backing store was mapped rather than allocated */
+    int is_mapped;
+} Arena;
+
+/**
+ * Rounds a row size up to the stride used for buffers in an arena.
+ *
+ * @param width
+ *     The number of elements in a row.
+ * @param element_size
+ *     The size of a single element.
+ * @return the number of bytes between the start of two consecutive rows
+ */
+size_t
+arena_stride(size_t width, size_t element_size);
+
+/**
+ * Creates an arena.
+ *
+ * If this function completes successfully, arena_free must be called.
+ *
+ * @param size
+ *     The number of bytes to reserve. This is the sum of the sizes of all
+ *     buffers rounded up to ARENA_ALIGNMENT.
+ * @param flags
+ *     Flags modifying the backing store. Currently only ARENA_HUGE_PAGES is
+ *     supported.
+ * @return a new arena, or NULL upon failure
+ * @see arena_free
+ */
+Arena*
+arena_create(size_t size, int flags);
+
+/**
+ * Releases a previously created arena.
+ *
+ * All buffers allocated from the arena become invalid.
+ *
+ * @param arena
+ *     The arena to free.
+ */
+void
+arena_free(Arena *arena);
+
+/**
+ * Allocates a buffer from an arena.
+ *
+ * The buffer is aligned to ARENA_ALIGNMENT and zeroed.
+ *
+ * @param arena
+ *     The arena.
+ * @param size
+ *     The size of the buffer.
+ * @return the buffer, or NULL if the arena is exhausted
+ */
+void*
+arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Resets an arena.
+ *
+ * All buffers previously allocated become invalid, and the memory is made
+ * available to arena_alloc again.
+ *
+ * @param arena
+ *     The arena.
+ */
+void
+arena_reset(Arena *arena);
+
+#endif
@@ -0,0 +1,256 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "autotune.h"
+#include "metrics.h"
+
+/* The version of the cache file format and of the candidate set; bumping it
+   invalidates all cache files */
+#define CACHE_VERSION 1
+
+/* The largest number of threads tried */
+#define THREADS_MAX 64
+
+/* The number of times every candidate is timed; the fastest run counts */
+#define ROUNDS 5
+
+/* The band heights tried; 0 splits the image evenly between the threads */
+static const unsigned int band_heights[] = {0, 8, 32, 128};
+
+/**
+ * Returns the number of processors available.
+ *
+ * @return the number of processors, at least 1
+ */
+static unsigned int
+autotune_processors(void)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return processors > 0 ? processors : 1;
+}
+
+void
+autotune_key(const Stereogram *stereogram, char *key, size_t size)
+{
+    snprintf(key, size, "v%d %ux%u pattern %ux%u format %d sources %d "
+        "processors %u",
+        CACHE_VERSION, stereogram->width, stereogram->height,
+        stereogram->pattern->width, stereogram->pattern->height,
+        stereogram->format, stereogram->sources != NULL,
+        autotune_processors());
+}
+
+int
+autotune_path(char *path, size_t size)
+{
+    const char *directory = getenv("XDG_CACHE_HOME");
+    char host[256];
+    int length;
+
+    if (directory && *directory) {
+        length = snprintf(path, size, "%s", directory);
+    }
+    else if ((directory = getenv("HOME")) && *directory) {
+        length = snprintf(path, size, "%s/.cache", directory);
+    }
+    else {
+        return 0;
+    }
+    if (length < 0 || (size_t)length >= size) {
+        return 0;
+    }
+    if (mkdir(path, 0700) && errno != EEXIST) {
+        return 0;
+    }
+
+    if (gethostname(host, sizeof(host))) {
+        strcpy(host, "localhost");
+    }
+    host[sizeof(host) - 1] = '\0';
+
+    length = snprintf(path + length, size - length,
+        "/inamazing3d-autotune-%s", host) + length;
+
+    return length > 0 && (size_t)length < size;
+}
+
+AutotuneCache
+autotune_load(const char *path, const char *key, StereogramTuning *tuning)
+{
+    FILE *file;
+    char line[512];
+    StereogramTuning result;
+    int is_valid;
+
+    file = fopen(path, "r");
+    if (!file) {
+        return AUTOTUNE_CACHE_MISSING;
+    }
+
+    /* The first line is the key */
+    is_valid = fgets(line, sizeof(line), file) != NULL;
+    if (is_valid) {
+        line[strcspn(line, "\n")] = '\0';
+        is_valid = strncmp(line, "key ", 4) == 0
+            && strcmp(line + 4, key) == 0;
+    }
+    is_valid = is_valid
+        && fscanf(file, "threads %u\n", &result.threads) == 1
+        && fscanf(file, "band_height %u\n", &result.band_height) == 1
+        && fscanf(file, "is_generic %d\n", &result.is_generic) == 1
+        && result.threads > 0;
+    fclose(file);
+
+    if (!is_valid) {
+        return AUTOTUNE_CACHE_STALE;
+    }
+
+    *tuning = result;
+
+    return AUTOTUNE_CACHE_HIT;
+}
+
+int
+autotune_save(const char *path, const char *key,
+    const StereogramTuning *tuning)
+{
+    FILE *file;
+    int result;
+
+    file = fopen(path, "w");
+    if (!file) {
+        return 0;
+    }
+
+    result = fprintf(file, "key %s\nthreads %u\nband_height %u\n"
+        "is_generic %d\n",
+        key, tuning->threads, tuning->band_height, tuning->is_generic) > 0;
+
+    return fclose(file) == 0 && result;
+}
+
+/**
+ * Times the generation of an image with the current tuning of a kernel.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param depth
+ *     The depth values.
+ * @param pixels
+ *     The output buffer.
+ * @return the time taken by the fastest of a number of runs, in seconds
+ */
+static double
+autotune_time(Stereogram *stereogram, const uint16_t *depth, void *pixels)
+{
+    uint64_t best = 0;
+    int i;
+
+    /* Warm the caches and the worker threads up first */
+    stereogram_apply(stereogram, depth, stereogram->width, pixels,
+        stereogram->width);
+
+    for (i = 0; i < ROUNDS; i++) {
+        uint64_t start = metrics_now();
+        uint64_t elapsed;
+
+        stereogram_apply(stereogram, depth, stereogram->width, pixels,
+            stereogram->width);
+        elapsed = metrics_now() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return best / 1000000000.0;
+}
+
+double
+autotune_run(Stereogram *stereogram, StereogramTuning *tuning)
+{
+    unsigned int count = stereogram->width * stereogram->height;
+    unsigned int processors = autotune_processors();
+    StereogramTuning candidate, best;
+    double best_time = -1.0;
+    uint16_t *depth;
+    void *pixels;
+    uint32_t seed = 1;
+    unsigned int i, threads;
+    int is_generic;
+
+    depth = malloc(count * sizeof(uint16_t));
+    pixels = malloc(count * stereogram->pixel_size);
+    if (!depth || !pixels) {
+        free(depth);
+        free(pixels);
+        return -1.0;
+    }
+
+    /* Use a far background with noisy objects in front of it, so that
+       separations vary as much as in a real scene */
+    for (i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        depth[i] = (i / stereogram->width) % 64 < 32
+            ? 0xFFFF
+            : seed >> 16;
+    }
+
+    /* Try powers of two up to the number of processors, and that number */
+    if (processors > THREADS_MAX) {
+        processors = THREADS_MAX;
+    }
+    memset(&best, 0, sizeof(best));
+    for (threads = 1;;
+            threads = threads * 2 < processors ? threads * 2 : processors) {
+        for (i = 0; i < sizeof(band_heights) / sizeof(*band_heights); i++) {
+            /* A single thread generates the whole image in one band */
+            if (threads == 1 && i > 0) {
+                break;
+            }
+
+            for (is_generic = 0; is_generic < 2; is_generic++) {
+                double time;
+
+                candidate.threads = threads;
+                candidate.band_height = band_heights[i];
+                candidate.is_generic = is_generic;
+                if (!stereogram_tune(stereogram, &candidate)) {
+                    continue;
+                }
+
+                time = autotune_time(stereogram, depth, pixels);
+                if (best_time < 0.0 || time < best_time) {
+                    best = candidate;
+                    best_time = time;
+                }
+
+                /* Only time the generic implementation if there is a
+                   specialised one */
+                if (stereogram->kernel == stereogram->generic) {
+                    break;
+                }
+            }
+        }
+
+        if (threads >= processors) {
+            break;
+        }
+    }
+
+    free(depth);
+    free(pixels);
+
+    if (best_time < 0.0) {
+        return -1.0;
+    }
+
+    stereogram_tune(stereogram, &best);
+    *tuning = best;
+
+    return best_time;
+}
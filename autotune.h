@@ -0,0 +1,103 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+
+#include "stereogram.h"
+
+/**
+ * The outcome of loading tuning from a cache file.
+ */
+typedef enum {
+    /** The file does not exist */
+    AUTOTUNE_CACHE_MISSING,
+
+    /** The file was written for a different configuration, or could not be
+        parsed */
+    AUTOTUNE_CACHE_STALE,
+
+    /** The tuning was loaded */
+    AUTOTUNE_CACHE_HIT
+} AutotuneCache;
+
+/**
+ * Describes the configuration that the tuning of a kernel depends on.
+ *
+ * The key covers the image and pattern dimensions, the pixel format, whether
+ * sources are recorded and the number of processors. Tuning is only reused
+ * for an identical key.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param key
+ *     The buffer receiving the key.
+ * @param size
+ *     The size of the buffer.
+ */
+void
+autotune_key(const Stereogram *stereogram, char *key, size_t size);
+
+/**
+ * Retrieves the path of the cache file of this host.
+ *
+ * The file is kept in $XDG_CACHE_HOME, or in ~/.cache if that is not set, and
+ * its name contains the host name, so that a home directory shared by several
+ * machines holds the tuning of each of them. The directory is created if it
+ * does not exist.
+ *
+ * @param path
+ *     The buffer receiving the path.
+ * @param size
+ *     The size of the buffer.
+ * @return non-zero upon success and 0 if no cache directory is known
+ */
+int
+autotune_path(char *path, size_t size);
+
+/**
+ * Loads tuning from a cache file.
+ *
+ * @param path
+ *     The cache file.
+ * @param key
+ *     The key of the current configuration; see autotune_key.
+ * @param tuning
+ *     Receives the tuning if it is found.
+ * @return AUTOTUNE_CACHE_HIT if the tuning was loaded, and otherwise why not
+ */
+AutotuneCache
+autotune_load(const char *path, const char *key, StereogramTuning *tuning);
+
+/**
+ * Writes tuning to a cache file.
+ *
+ * @param path
+ *     The cache file.
+ * @param key
+ *     The key of the current configuration; see autotune_key.
+ * @param tuning
+ *     The tuning.
+ * @return non-zero upon success and 0 otherwise
+ */
+int
+autotune_save(const char *path, const char *key,
+    const StereogramTuning *tuning);
+
+/**
+ * Finds the fastest way for a kernel to generate images.
+ *
+ * Every combination of thread count, band height and implementation is timed
+ * generating images from a synthetic depth buffer, and the fastest one is
+ * applied to the kernel.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param tuning
+ *     Receives the fastest tuning.
+ * @return the time taken to generate an image with the fastest tuning, in
+ *     seconds, or a negative value upon failure
+ */
+double
+autotune_run(Stereogram *stereogram, StereogramTuning *tuning);
+
+#endif
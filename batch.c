@@ -0,0 +1,464 @@
+#include <dirent.h>
+#include <png.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "metrics.h"
+#include "stereogram.h"
+#include "trace.h"
+
+/* The zlib compression level of the written images; low levels are much
+   faster and stereograms compress poorly anyway */
+#define COMPRESSION_LEVEL 3
+
+/**
+ * The state shared by all workers.
+ */
+typedef struct {
+    /** The directories */
+    const char *input, *output;
+
+    /** The names of the images, sorted */
+    char **names;
+    unsigned int count;
+
+    /** The index of the next image to convert */
+    unsigned int next;
+
+    /** The stereogram settings */
+    StereoPattern *pattern;
+    double strength;
+
+    /** The number of images converted and failed */
+    unsigned int images, failed;
+} Batch;
+
+/**
+ * The buffers of a single worker, reused from one image to the next.
+ */
+typedef struct {
+    /** The batch */
+    Batch *batch;
+
+    /** The kernel, created for the dimensions of the last image */
+    Stereogram *kernel;
+
+    /** The depth values of the current image, and their capacity */
+    uint16_t *depth;
+    size_t depth_capacity;
+
+    /** The stereogram pixels, and their capacity */
+    uint32_t *pixels;
+    size_t pixels_capacity;
+
+    /** The row pointers passed to libpng, and their capacity */
+    png_bytep *rows;
+    size_t rows_capacity;
+
+    /** The dimensions of the current image */
+    unsigned int width, height;
+} BatchWorker;
+
+/**
+ * Makes sure that a buffer holds at least a number of bytes.
+ *
+ * @param buffer
+ *     The buffer, which is reallocated if it is too small.
+ * @param capacity
+ *     The current size of the buffer, which is updated.
+ * @param size
+ *     The required size.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+batch_reserve(void **buffer, size_t *capacity, size_t size)
+{
+    void *result;
+
+    if (*capacity >= size) {
+        return 1;
+    }
+
+    result = realloc(*buffer, size);
+    if (!result) {
+        return 0;
+    }
+    *buffer = result;
+    *capacity = size;
+
+    return 1;
+}
+
+/**
+ * Reads a depth map image.
+ *
+ * Images are converted to 16 bit grayscale; 8 bit values are scaled so that
+ * white is 65535 in both cases.
+ *
+ * @param worker
+ *     The worker, whose depth buffer and dimensions receive the image.
+ * @param path
+ *     The image file.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+batch_decode(BatchWorker *worker, const char *path)
+{
+    static const uint16_t endianness = 1;
+    png_structp png;
+    png_infop info;
+    FILE *file;
+    unsigned int x, y;
+    int bit_depth, color_type;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (!info) {
+        png_destroy_read_struct(&png, NULL, NULL);
+        fclose(file);
+        return 0;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(file);
+        return 0;
+    }
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    /* Convert everything to one grayscale channel of 8 or 16 bits, in host
+       byte order */
+    color_type = png_get_color_type(png, info);
+    png_set_expand(png);
+    png_set_strip_alpha(png);
+    if (color_type & PNG_COLOR_MASK_COLOR) {
+        png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+    }
+    if (*(const uint8_t*)&endianness) {
+        png_set_swap(png);
+    }
+    png_read_update_info(png, info);
+
+    worker->width = png_get_image_width(png, info);
+    worker->height = png_get_image_height(png, info);
+    bit_depth = png_get_bit_depth(png, info);
+
+    /* Read 8 bit rows into the start of the 16 bit rows, and expand them in
+       place from the end */
+    if (!batch_reserve((void**)&worker->depth, &worker->depth_capacity,
+                (size_t)worker->width * worker->height * sizeof(uint16_t))
+            || !batch_reserve((void**)&worker->rows, &worker->rows_capacity,
+                worker->height * sizeof(png_bytep))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(file);
+        return 0;
+    }
+    for (y = 0; y < worker->height; y++) {
+        worker->rows[y] = (png_bytep)(worker->depth + y * worker->width);
+    }
+    png_read_image(png, worker->rows);
+    png_read_end(png, NULL);
+
+    if (bit_depth == 8) {
+        for (y = 0; y < worker->height; y++) {
+            uint16_t *row = worker->depth + y * worker->width;
+
+            for (x = worker->width; x-- > 0;) {
+                row[x] = ((const uint8_t*)row)[x] * 257;
+            }
+        }
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(file);
+
+    return 1;
+}
+
+/**
+ * Writes the stereogram of a worker as an RGBA image.
+ *
+ * @param worker
+ *     The worker.
+ * @param path
+ *     The image file.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+batch_encode(BatchWorker *worker, const char *path)
+{
+    png_structp png;
+    png_infop info;
+    FILE *file;
+    unsigned int y;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        return 0;
+    }
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (!info) {
+        png_destroy_write_struct(&png, NULL);
+        fclose(file);
+        return 0;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        return 0;
+    }
+
+    png_init_io(png, file);
+    png_set_compression_level(png, COMPRESSION_LEVEL);
+    png_set_IHDR(png, info, worker->width, worker->height, 8,
+        PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (y = 0; y < worker->height; y++) {
+        worker->rows[y] = (png_bytep)(worker->pixels + y * worker->width);
+    }
+    png_write_image(png, worker->rows);
+    png_write_end(png, NULL);
+
+    png_destroy_write_struct(&png, &info);
+
+    return fclose(file) == 0;
+}
+
+/**
+ * Converts a single depth map image.
+ *
+ * @param worker
+ *     The worker.
+ * @param name
+ *     The name of the image in the input and output directories.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+batch_convert(BatchWorker *worker, const char *name)
+{
+    Batch *batch = worker->batch;
+    char path[4096];
+    int result;
+
+    snprintf(path, sizeof(path), "%s/%s", batch->input, name);
+    trace_begin("decode");
+    result = batch_decode(worker, path);
+    trace_end();
+    if (!result) {
+        return 0;
+    }
+
+    /* Recreate the kernel only when the dimensions change */
+    if (!worker->kernel || worker->kernel->width != worker->width
+            || worker->kernel->height != worker->height) {
+        stereogram_free(worker->kernel);
+        worker->kernel = stereogram_create(worker->width, worker->height,
+            batch->pattern, batch->strength, STEREOGRAM_FORMAT_RGBA);
+        if (!worker->kernel) {
+            return 0;
+        }
+        stereogram_depth_linear(worker->kernel);
+    }
+    if (!batch_reserve((void**)&worker->pixels, &worker->pixels_capacity,
+            (size_t)worker->width * worker->height * sizeof(uint32_t))) {
+        return 0;
+    }
+
+    trace_begin("stereogram apply");
+    stereogram_apply(worker->kernel, worker->depth, worker->width,
+        worker->pixels, worker->width);
+    trace_end();
+
+    snprintf(path, sizeof(path), "%s/%s", batch->output, name);
+    trace_begin("encode");
+    result = batch_encode(worker, path);
+    trace_end();
+
+    return result;
+}
+
+/**
+ * Converts images until none are left.
+ *
+ * @param data
+ *     The worker.
+ * @return NULL
+ */
+static void*
+batch_worker(void *data)
+{
+    BatchWorker *worker = data;
+    Batch *batch = worker->batch;
+    unsigned int i;
+
+    trace_thread_name("batch");
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED))
+            < batch->count) {
+        if (batch_convert(worker, batch->names[i])) {
+            __atomic_fetch_add(&batch->images, 1, __ATOMIC_RELAXED);
+        }
+        else {
+            fprintf(stderr, "Unable to convert %s\n", batch->names[i]);
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Compares two strings for qsort.
+ */
+static int
+batch_compare(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Lists the PNG images in a directory.
+ *
+ * @param batch
+ *     The batch, whose names and count receive the list.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+batch_list(Batch *batch)
+{
+    DIR *directory;
+    struct dirent *entry;
+    unsigned int capacity = 0;
+
+    directory = opendir(batch->input);
+    if (!directory) {
+        return 0;
+    }
+
+    while ((entry = readdir(directory))) {
+        size_t length = strlen(entry->d_name);
+
+        if (length <= 4
+                || strcasecmp(entry->d_name + length - 4, ".png") != 0) {
+            continue;
+        }
+
+        if (batch->count == capacity) {
+            char **names;
+
+            capacity = capacity ? 2 * capacity : 64;
+            names = realloc(batch->names, capacity * sizeof(char*));
+            if (!names) {
+                closedir(directory);
+                return 0;
+            }
+            batch->names = names;
+        }
+        batch->names[batch->count] = strdup(entry->d_name);
+        if (!batch->names[batch->count]) {
+            closedir(directory);
+            return 0;
+        }
+        batch->count++;
+    }
+    closedir(directory);
+
+    qsort(batch->names, batch->count, sizeof(char*), batch_compare);
+
+    return 1;
+}
+
+int
+batch_run(const char *input, const char *output, StereoPattern *pattern,
+    double strength, unsigned int threads, BatchResult *result)
+{
+    Batch batch;
+    BatchWorker *workers;
+    pthread_t *handles;
+    uint64_t start = metrics_now();
+    unsigned int i, started;
+    int is_listed;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.input = input;
+    batch.output = output;
+    batch.pattern = pattern;
+    batch.strength = strength;
+
+    memset(result, 0, sizeof(BatchResult));
+
+    is_listed = batch_list(&batch);
+    if (!is_listed) {
+        for (i = 0; i < batch.count; i++) {
+            free(batch.names[i]);
+        }
+        free(batch.names);
+        return 0;
+    }
+
+    if (threads == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = processors > 0 ? processors : 1;
+    }
+    if (threads > batch.count) {
+        threads = batch.count > 0 ? batch.count : 1;
+    }
+
+    workers = calloc(threads, sizeof(BatchWorker));
+    handles = calloc(threads, sizeof(pthread_t));
+    if (!workers || !handles) {
+        threads = 0;
+    }
+
+    /* Run the first worker on this thread, so that a batch completes even
+       if no thread can be started */
+    for (started = 1; started < threads; started++) {
+        workers[started].batch = &batch;
+        if (pthread_create(&handles[started], NULL, batch_worker,
+                &workers[started])) {
+            break;
+        }
+    }
+    if (threads > 0) {
+        workers[0].batch = &batch;
+        batch_worker(&workers[0]);
+    }
+    for (i = 1; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    for (i = 0; i < threads; i++) {
+        stereogram_free(workers[i].kernel);
+        free(workers[i].depth);
+        free(workers[i].pixels);
+        free(workers[i].rows);
+    }
+    free(workers);
+    free(handles);
+
+    for (i = 0; i < batch.count; i++) {
+        free(batch.names[i]);
+    }
+    free(batch.names);
+
+    result->images = batch.images;
+    result->failed = batch.failed + (threads == 0 ? batch.count : 0);
+    result->seconds = (metrics_now() - start) / 1000000000.0;
+
+    return 1;
+}
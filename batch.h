@@ -0,0 +1,53 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stereo.h>
+
+/**
+ * The outcome of a batch run.
+ */
+typedef struct {
+    /** The number of images converted */
+    unsigned int images;
+
+    /** The number of images that could not be converted */
+    unsigned int failed;
+
+    /** The time taken, in seconds */
+    double seconds;
+} BatchResult;
+
+/**
+ * Generates stereograms from all depth map images in a directory.
+ *
+ * Every PNG image in the input directory is read as a grayscale depth map,
+ * with white being nearest, and a stereogram with the same name and
+ * dimensions is written to the output directory as an RGBA PNG image. The
+ * separations are those libstereo generates from a z-buffer holding the
+ * inverse of the depth map.
+ *
+ * The images are spread over a number of worker threads. Each worker reads,
+ * converts and writes one image at a time, reusing its buffers for the next
+ * image, so the number of images in memory is bounded by the number of
+ * workers.
+ *
+ * @param input
+ *     The directory containing the depth maps.
+ * @param output
+ *     The directory to which to write the stereograms. It must exist.
+ * @param pattern
+ *     The background pattern. Its pixels must be 32 bits wide.
+ * @param strength
+ *     The strength of the effect; see the stereogram-strength option.
+ * @param threads
+ *     The number of worker threads. If this is 0, one thread per processor
+ *     is used.
+ * @param result
+ *     Receives the number of images converted and the time taken.
+ * @return non-zero if the input directory could be read and 0 otherwise
+ */
+int
+batch_run(const char *input, const char *output, StereoPattern *pattern,
+    double strength, unsigned int threads, BatchResult *result);
+
+#endif
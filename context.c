@@ -1,7 +1,13 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "context.h"
+#include "gl-state.h"
+#include "metrics.h"
+#include "sphere.h"
+#include "stereogram-gl.h"
+#include "trace.h"
 
 #define ARGUMENTS_READ_ONLY
 #include "arguments/arguments.h"
@@ -13,6 +19,26 @@
 /* The precision of the sphere approximation */
 #define SPHERE_PRECISION 20
 
+/* The smallest change in position that causes a redraw */
+#define IDLE_EPSILON 0.0001
+
+/* The strength with which the autopilot keeps to the centre of corridors */
+#define AUTOPILOT_CENTERING 4.0
+
+/* The near and far clipping planes */
+#define Z_NEAR (CAMERA_Z - 1.5)
+#define Z_FAR (CAMERA_Z + 1.0)
+
+/* The number of rooms around the camera to render */
+#define VIEW_RADIUS 5
+
+/* The height of the walls of the maze */
+#define WALL_HEIGHT 0.1
+
+/* The room at the entrance, where the camera starts */
+#define ENTRANCE_X 0
+#define ENTRANCE_Y 0
+
 /* The margin of the target */
 #define TARGET_MARGIN (ARGUMENT_VALUE(wall_width) + ARGUMENT_VALUE(slope_width))
 #define ITARGET_MARGIN (1.0 - TARGET_MARGIN)
@@ -79,42 +105,31 @@ context_object_target(struct context_object *object,
 static void
 context_object_render(const Context *context)
 {
-    int i, j;
-
     glPushMatrix();
 
     glTranslatef(context->target.x,
         context->maze.data->height - context->target.y, TARGET_Z);
-    glScalef(0.2, 0.2, 0.2);
-
-    for (i = 0; i < SPHERE_PRECISION / 2; i++) {
-        GLfloat theta1, theta2;
-        theta1 = i * 2.0 * M_PI / SPHERE_PRECISION - M_PI / 2.0;
-        theta2 = (i + 1) * 2.0 * M_PI / SPHERE_PRECISION - M_PI / 2.0;
-
-        glBegin(GL_TRIANGLE_STRIP);
-        for (j = 0; j <= SPHERE_PRECISION; j++) {
-            GLfloat theta3 = j * 2.0 * M_PI / SPHERE_PRECISION;
-            GLfloat x, y, z;
-
-            x = cos(theta1) * cos(theta3);
-            y = sin(theta1);
-            z = cos(theta1) * sin(theta3);
-            glNormal3f(x, y, z);
-            glVertex3f(x, y, z);
-
-            x = cos(theta2) * cos(theta3);
-            y = sin(theta2);
-            z = cos(theta2) * sin(theta3);
-            glNormal3f(x, y, z);
-            glVertex3f(x, y, z);
-        }
-        glEnd();
-    }
+    glScalef(TARGET_RADIUS, TARGET_RADIUS, TARGET_RADIUS);
+    glCallList(context->gl.sphere_list);
 
     glPopMatrix();
 }
 
+/**
+ * Renders the objects wandering the maze around the camera.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_swarm_render(const Context *context)
+{
+    if (context->maze.swarm) {
+        maze_swarm_render(context->maze.swarm, context->camera.x,
+            context->camera.y, VIEW_RADIUS, SWARM_Z);
+    }
+}
+
 /**
  * @see gluPerspective
  */
@@ -204,388 +219,1602 @@ mgluLookAt(GLfloat eyex, GLfloat eyey, GLfloat eyez,
     glTranslatef(-eyex, -eyey, -eyez);
 }
 
-int
-context_initialize(Context *context,
-    unsigned int image_width, unsigned int image_height,
-    unsigned int screen_width, unsigned int screen_height,
-    StereoPattern *pattern_base)
+/**
+ * Generates a new random maze with an entrance and an exit.
+ *
+ * The entrance is opened to the left of the top left room, and the exit to
+ * the right of the bottom right room. Shortcuts are then opened according to
+ * the shortcut ratio.
+ *
+ * @param seed
+ *     The state of the random sequence placing the shortcuts. This is
+ *     updated.
+ * @return a new maze, or NULL upon failure
+ */
+static Maze*
+random_maze_create(unsigned int *seed)
 {
-    double wave_strengths[2 * 4];
+    Maze *maze;
     int i;
-    StereoPattern *pattern;
-
-    /* Make sure that the context is passed */
-    if (!context || !pattern_base) {
-        return 0;
-    }
 
-    /* Initialise the maze */
-    context->maze.data = maze_create(ARGUMENT_VALUE(maze_size).width,
+    maze = maze_create(ARGUMENT_VALUE(maze_size).width,
         ARGUMENT_VALUE(maze_size).height);
-    if (!context->maze.data) {
-        return 0;
+    if (!maze) {
+        return NULL;
     }
-    maze_initialize_randomized_prim(context->maze.data, NULL, NULL);
-    maze_door_open(context->maze.data,
+    maze_initialize_randomized_prim(maze, NULL, NULL);
+    maze_door_open(maze,
         0, 0,
         MAZE_WALL_LEFT);
-    maze_door_open(context->maze.data,
-        context->maze.data->width - 1, context->maze.data->height - 1,
+    maze_door_open(maze,
+        maze->width - 1, maze->height - 1,
         MAZE_WALL_RIGHT);
 
+    /* Open shortcuts */
     for (i = 0;
             i < 4 * ARGUMENT_VALUE(maze_size).width
                 * ARGUMENT_VALUE(maze_size).height
                 * ARGUMENT_VALUE(shortcut_ratio);
             i++) {
-        int x = rand() % ARGUMENT_VALUE(maze_size).width;
-        int y = rand() % ARGUMENT_VALUE(maze_size).height;
-        int wall = rand() % 4;
+        int x = rand_r(seed) % ARGUMENT_VALUE(maze_size).width;
+        int y = rand_r(seed) % ARGUMENT_VALUE(maze_size).height;
+        int wall = rand_r(seed) % 4;
 
         switch (wall) {
         case 0:
             if (x > 0) {
-                maze_door_open(context->maze.data, x, y, MAZE_WALL_LEFT);
+                maze_door_open(maze, x, y, MAZE_WALL_LEFT);
             }
             break;
         case 1:
             if (x < ARGUMENT_VALUE(maze_size).width - 1) {
-                maze_door_open(context->maze.data, x, y, MAZE_WALL_RIGHT);
+                maze_door_open(maze, x, y, MAZE_WALL_RIGHT);
             }
             break;
         case 2:
             if (y > 0) {
-                maze_door_open(context->maze.data, x, y, MAZE_WALL_UP);
+                maze_door_open(maze, x, y, MAZE_WALL_UP);
             }
             break;
         case 3:
             if (y < ARGUMENT_VALUE(maze_size).height - 1) {
-                maze_door_open(context->maze.data, x, y, MAZE_WALL_DOWN);
+                maze_door_open(maze, x, y, MAZE_WALL_DOWN);
             }
             break;
         }
     }
 
-    /* Initialise the stereogram z-buffer */
-    context->stereo.zbuffer = stereo_zbuffer_create(image_width, image_height,
-        1);
+    return maze;
+}
 
-    /* Randomise the effect parameters */
-    for (i = 0; i < sizeof(wave_strengths) / sizeof(double); i++) {
-        wave_strengths[i] = WAVE_STRENGTH_BASE + WAVE_STRENGTH_EXTRA
-            * (double)(rand() - RAND_MAX / 2) / RAND_MAX / (i + 1);
+/**
+ * Releases a generated maze and the data derived from it.
+ *
+ * @param maze
+ *     The maze. All its fields are reset to NULL.
+ */
+static void
+context_maze_release(ContextMaze *maze)
+{
+    maze_mesh_preload_free(maze->preload);
+    free(maze->walls);
+    if (maze->height) {
+        maze_height_free(maze->height);
     }
+    if (maze->path) {
+        maze_path_free(maze->path);
+    }
+    if (maze->data) {
+        maze_free(maze->data);
+    }
+    memset(maze, 0, sizeof(*maze));
+}
 
-    /* Initialise the effect */
-    pattern = stereo_pattern_create(pattern_base->width, pattern_base->height);
-    context->stereo.effect = stereo_pattern_effect_wave(pattern,
-        sizeof(wave_strengths) / sizeof(double) / 2, wave_strengths,
-        pattern_base);
-    stereo_pattern_effect_apply(context->stereo.effect);
-
-    /* Initialise the stereogram image */
-    context->stereo.image = stereo_image_create_from_zbuffer(
-        context->stereo.zbuffer, pattern, ARGUMENT_VALUE(stereogram_strength),
-        1);
-
-    /* Automatically update the pattern every frame */
-    context->stereo.update_pattern = 1;
+/**
+ * Generates a new random maze, its distance field to the exit and, if depth
+ * is reprojected, its heightfield.
+ *
+ * The data derived from the maze for the swarm and the mesh renderer is
+ * built as well if requested, so that installing the maze only has to copy
+ * and upload it.
+ *
+ * This does not use the context, so it may be called on any thread.
+ *
+ * @param maze
+ *     Receives the new maze. Its fields are NULL upon failure.
+ * @param seed
+ *     The state of the random sequence of the calling thread. This is
+ *     updated.
+ * @param is_derived
+ *     Whether to build the data derived from the maze; this is only useful
+ *     once the swarm and the mesh renderer have been created.
+ * @return non-zero upon success and 0 otherwise
+ */
+static int
+context_maze_build(ContextMaze *maze, unsigned int *seed, int is_derived)
+{
+    memset(maze, 0, sizeof(*maze));
+    maze->data = random_maze_create(seed);
+    if (!maze->data) {
+        return 0;
+    }
+    maze->path = maze_path_create(maze->data, maze->data->width - 1,
+        maze->data->height - 1);
+    if (!maze->path) {
+        context_maze_release(maze);
+        return 0;
+    }
+    /* The heightfield models the walls of the merged mesh */
+    if (ARGUMENT_VALUE(reprojection).frames > 0
+            && ARGUMENT_VALUE(merge_walls)) {
+        maze->height = maze_height_create(maze->data,
+            ARGUMENT_VALUE(wall_width), ARGUMENT_VALUE(slope_width),
+            WALL_HEIGHT);
+        if (!maze->height) {
+            context_maze_release(maze);
+            return 0;
+        }
+    }
 
-    /* Initialise the OpenGL data */
-    context->gl.ratio = (GLfloat)screen_width / screen_height;
-    glGenFramebuffers(sizeof(context->gl.framebuffers) / sizeof(GLuint),
-        context->gl.framebuffers);
-    glGenRenderbuffers(sizeof(context->gl.renderbuffers) / sizeof(GLuint),
-        context->gl.renderbuffers);
-    glGenTextures(sizeof(context->gl.textures) / sizeof(GLuint),
-        context->gl.textures);
-    context->gl.render_stereo = 1;
-    context->gl.apply_texture = 0;
+    /* The derived data only saves time when the maze is installed, so it is
+       not an error if it cannot be built */
+    if (is_derived && ARGUMENT_VALUE(objects) > 0) {
+        maze->walls = malloc(maze->data->width * maze->data->height);
+        if (maze->walls) {
+            maze_swarm_walls(maze->data, maze->walls);
+        }
+    }
+    if (is_derived && ARGUMENT_VALUE(merge_walls)) {
+        maze->preload = maze_mesh_preload_create(maze->data,
+            ARGUMENT_VALUE(wall_width), ARGUMENT_VALUE(slope_width),
+            WALL_HEIGHT, ENTRANCE_X, ENTRANCE_Y, VIEW_RADIUS);
+    }
 
-    /* Specify the renderbuffer */
-    GLuint renderbuffer = context->gl.renderbuffers[0];
-    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT,
-        image_width, image_height);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    return 1;
+}
 
-    /* Specify the render buffer */
-    GLuint framebuffer = context->gl.framebuffers[0];
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-        GL_RENDERBUFFER_EXT, renderbuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    /* Initialise the camera and target */
-    context->camera.x = context->target.x = 0.0;
-    context->camera.y = context->target.y = 0.5;
+/**
+ * Replaces the maze of a context.
+ *
+ * The camera and target are moved to the entrance of the new maze.
+ *
+ * @param context
+ *     The context.
+ * @param maze
+ *     The new maze. Ownership of the maze, its distance field and its
+ *     heightfield is assumed by the context, and the derived data is
+ *     released; all its fields are reset to NULL.
+ */
+static void
+context_maze_install(Context *context, ContextMaze *maze)
+{
+    if (context->maze.height) {
+        maze_height_free(context->maze.height);
+    }
+    if (context->maze.path) {
+        maze_path_free(context->maze.path);
+    }
+    if (context->maze.data) {
+        maze_free(context->maze.data);
+    }
+    context->maze.data = maze->data;
+    context->maze.path = maze->path;
+    context->maze.height = maze->height;
+    if (context->maze.mesh) {
+        maze_mesh_reset(context->maze.mesh, maze->data, maze->preload);
+    }
+    if (context->maze.swarm) {
+        maze_swarm_reset(context->maze.swarm, maze->data, maze->walls);
+    }
+    if (context->stereo.reprojection) {
+        reprojection_invalidate(context->stereo.reprojection);
+    }
+    maze->data = NULL;
+    maze->path = NULL;
+    maze->height = NULL;
+    context_maze_release(maze);
+
+    /* Move the camera and target to the entrance */
+    context->camera.x = context->target.x = ENTRANCE_X;
+    context->camera.y = context->target.y = ENTRANCE_Y + 0.5;
     context->camera.vx = context->target.vx = 0.0;
     context->camera.vy = context->target.vy = 0.0;
     context->camera.ax = context->target.ax = 0.0;
     context->camera.ay = context->target.ay = 0.0;
+}
 
-    return 1;
+/**
+ * Generates the next maze on the worker thread.
+ *
+ * @param data
+ *     The context.
+ * @return NULL
+ */
+static void*
+context_maze_worker(void *data)
+{
+    Context *context = data;
+
+    trace_thread_name("maze");
+    trace_begin("maze generate");
+    context_maze_build(&context->maze.next.maze, &context->maze.next.seed, 1);
+    trace_end();
+
+    __atomic_store_n(&context->maze.next.is_ready, 1, __ATOMIC_RELEASE);
+
+    return NULL;
 }
 
 /**
- * Sets up the camera for the context.
+ * Starts generating the next maze in the background.
  *
- * The current OpenGL matrix is modified.
+ * If no worker thread can be started, the next maze is generated on demand
+ * by context_maze_next instead.
  *
  * @param context
  *     The context.
  */
 static void
-camera_setup(Context *context)
+context_maze_prefetch(Context *context)
 {
-    glMatrixMode(GL_MODELVIEW);
-    mgluPerspective(45, context->gl.ratio, CAMERA_Z - 1.5, CAMERA_Z + 1.0);
-    mgluLookAt(
-        context->camera.x,
-        context->maze.data->height - context->camera.y,
-        CAMERA_Z,
-
-        context->target.x,
-        context->maze.data->height - context->target.y,
-        TARGET_Z,
-
-        0.1, 1.0, 0.0);
+    memset(&context->maze.next.maze, 0, sizeof(context->maze.next.maze));
+    context->maze.next.seed = rand();
+    context->maze.next.is_ready = 0;
+    context->maze.next.is_running = pthread_create(
+        &context->maze.next.thread, NULL, context_maze_worker, context) == 0;
 }
 
 /**
- * Sets up the lights for the context.
+ * Waits for the worker thread and releases any maze it has generated.
  *
  * @param context
  *     The context.
  */
 static void
-lights_setup(Context *context, int enable)
+context_maze_prefetch_cancel(Context *context)
 {
-    if (enable) {
-        GLfloat light_position[] = {
-            2.0 * context->camera.ax,
-            -2.0 * context->camera.ay,
-            -1.0, 1.0};
-        static GLfloat light_ambient[] = {0.0, 0.0, 0.0, 1.0};
-        static GLfloat light_diffuse[] = {1.0, 1.0, 1.0, 1.0};
-        static GLfloat light_specular[] = {1.0, 1.0, 1.0, 1.0};
-        static GLfloat material_emission[] = {0.0, 0.0, 0.0, 1.0};
-        static GLfloat material_diffuse[] = {0.0, 0.0, 0.0, 1.0};
-        static GLfloat material_specular[] = {0.0, 0.0, 0.0, 1.0};
+    if (!context->maze.next.is_running) {
+        return;
+    }
 
-        /* Select the correct matrix for "light at eye" mode */
-        glMatrixMode(GL_MODELVIEW);
-        glPushMatrix();
-        glLoadIdentity();
+    pthread_join(context->maze.next.thread, NULL);
+    context->maze.next.is_running = 0;
 
-        glLightfv(GL_LIGHT0, GL_POSITION, light_position);
-        glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
-        glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
-        glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
-        glEnable(GL_LIGHTING);
-        glEnable(GL_LIGHT0);
+    context_maze_release(&context->maze.next.maze);
+}
 
-        glEnable(GL_COLOR_MATERIAL);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, material_emission);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, material_diffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, material_specular);
+/**
+ * The state shared by the threads of context_prepare.
+ */
+struct context_prepare_state {
+    /** The context being prepared */
+    Context *context;
 
-        glPopMatrix();
-    }
-    else {
-        glDisable(GL_LIGHTING);
-        glDisable(GL_LIGHT0);
+    /** The dimensions of the stereogram image */
+    unsigned int image_width, image_height;
 
-        glDisable(GL_COLOR_MATERIAL);
-    }
-}
+    /** The background pattern, and the pattern generated from it */
+    StereoPattern *pattern_base, *pattern;
 
-void
-context_free(Context *context)
-{
-    /* Make sure that the context is passed */
-    if (!context) {
-        return;
-    }
+    /** The parameters of the pattern effect */
+    double wave_strengths[2 * 4];
 
-    if (context->maze.data) {
-        maze_free(context->maze.data);
-        context->maze.data = NULL;
-    }
+    /** The maze, and the state of the random sequence generating it */
+    ContextMaze maze;
+    unsigned int seed;
 
-    if (context->stereo.zbuffer) {
-        stereo_zbuffer_free(context->stereo.zbuffer);
-        context->stereo.zbuffer = NULL;
-    }
+    /** The results of the threads */
+    int is_maze_ready, is_stereo_ready, is_kernel_ready;
+};
 
-    if (context->stereo.effect) {
-        stereo_pattern_effect_free(context->stereo.effect);
-        context->stereo.effect = NULL;
-    }
+/**
+ * Generates the maze of a context being prepared.
+ *
+ * @param data
+ *     The preparation state.
+ * @return NULL
+ */
+static void*
+context_prepare_maze(void *data)
+{
+    struct context_prepare_state *state = data;
 
-    if (context->stereo.image) {
-        stereo_image_free(context->stereo.image);
-        context->stereo.image = NULL;
-    }
+    trace_thread_name("prepare maze");
+    trace_begin("maze generate");
+    state->is_maze_ready = context_maze_build(&state->maze, &state->seed, 0);
+    trace_end();
 
-    glDeleteTextures(sizeof(context->gl.textures) / sizeof(GLuint),
-        context->gl.textures);
-    glDeleteRenderbuffers(sizeof(context->gl.renderbuffers) / sizeof(GLuint),
-        context->gl.renderbuffers);
-    glDeleteFramebuffers(sizeof(context->gl.framebuffers) / sizeof(GLuint),
-        context->gl.framebuffers);
+    return NULL;
 }
 
 /**
- * Renders the scene in stereogram mode.
- *
- * This will make the maze be displayed as an animated stereogram.
+ * Generates the pattern and the stereogram image of a context being
+ * prepared, and moves their buffers into the arena.
  *
- * @param context
- *     The context.
+ * @param data
+ *     The preparation state.
+ * @return NULL
  */
-static void
-context_render_stereo(Context *context)
+static void*
+context_prepare_stereo(void *data)
 {
-    /* Determine the size of the texture */
-    GLsizei width, height;
-    width = context->stereo.zbuffer->width;
-    height = context->stereo.zbuffer->height;
-
-    /* Bind the frame buffer and the render buffer */
-    GLuint framebuffer = context->gl.framebuffers[0];
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    GLuint renderbuffer = context->gl.renderbuffers[0];
-    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    struct context_prepare_state *state = data;
+    Context *context = state->context;
 
-    /* Clear the buffer */
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    trace_thread_name("prepare stereogram");
+    trace_begin("stereogram prepare");
 
-    /* Store the old viewport and set one the size of the texture */
-    GLint old_viewport[4];
-    glGetIntegerv(GL_VIEWPORT, old_viewport);
-    glViewport(0, 0, width, height);
-
-    /* Draw the maze with a floor */
-    maze_render_gl(context->maze.data, ARGUMENT_VALUE(wall_width),
-        ARGUMENT_VALUE(slope_width), 0.1, (int)context->camera.x,
-        (int)context->camera.y, 5, MAZE_RENDER_GL_WALLS | MAZE_RENDER_GL_FLOOR
-            | MAZE_RENDER_GL_TOP);
-    context_object_render(context);
+    /* Initialise the stereogram z-buffer */
+    context->stereo.zbuffer = stereo_zbuffer_create(state->image_width,
+        state->image_height, 1);
 
-    /* Retrieve the depth data to the z-buffer */
-    glPixelStorei(GL_PACK_ROW_LENGTH, context->stereo.zbuffer->rowoffset);
-    glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT,
-        GL_UNSIGNED_BYTE, context->stereo.zbuffer->data);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    /* Initialise the effect */
+    context->stereo.effect = stereo_pattern_effect_wave(state->pattern,
+        sizeof(state->wave_strengths) / sizeof(double) / 2,
+        state->wave_strengths, state->pattern_base);
+    stereo_pattern_effect_apply(context->stereo.effect);
 
-    /* Regenerate the stereogram from the depth data generated by OpenGL */
-    stereo_image_apply(context->stereo.image, context->stereo.zbuffer, 0);
+    /* Initialise the stereogram image */
+    context->stereo.image = stereo_image_create_from_zbuffer(
+        context->stereo.zbuffer, state->pattern,
+        ARGUMENT_VALUE(stereogram_strength), 1);
 
-    /* Clear the depth buffer to enable the texture to be displayed */
-    glClear(GL_DEPTH_BUFFER_BIT);
+    /* Move the per-frame buffers into the arena */
+    state->is_stereo_ready = context_buffers_bind(context);
 
-    /* Activate the stereogram texture */
-    glEnable(GL_TEXTURE_2D);
-    GLuint stereogram_texture = context->gl.textures[0];
-    glBindTexture(GL_TEXTURE_2D, stereogram_texture);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-        GL_UNSIGNED_BYTE, context->stereo.image->image->pixels);
-
-    /* Restore the matrix and the viewport */
-    glLoadIdentity();
-    glViewport(old_viewport[0], old_viewport[1],
-        old_viewport[2], old_viewport[3]);
+    trace_end();
 
-    /* Draw a rectangle with the stereogram as texture */
-    glBegin(GL_QUADS);
-    glTexCoord2f(0.0, 0.0);
-    glVertex2f(-1.0, -1.0);
-    glTexCoord2f(1.0, 0.0);
-    glVertex2f(1.0, -1.0);
-    glTexCoord2f(1.0, 1.0);
-    glVertex2f(1.0, 1.0);
-    glTexCoord2f(0.0, 1.0);
-    glVertex2f(-1.0, 1.0);
-    glEnd();
+    return NULL;
 }
 
 /**
- * Renders the scene in plain 3D mode.
+ * Creates and tunes the fused stereogram kernel of a context being prepared.
  *
- * @param context
- *     The context.
+ * The pattern is still being generated, so the kernel is created from the
+ * background pattern, which has the same dimensions; context_prepare
+ * switches it to the generated pattern.
+ *
+ * @param data
+ *     The preparation state.
+ * @return NULL
  */
-static void
-context_render_plain(Context *context)
+static void*
+context_prepare_kernel(void *data)
 {
-    int flags = MAZE_RENDER_GL_WALLS | MAZE_RENDER_GL_FLOOR
-        | MAZE_RENDER_GL_TOP;
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    struct context_prepare_state *state = data;
+    Context *context = state->context;
+
+    trace_thread_name("prepare kernel");
+    trace_begin("kernel prepare");
+
+    state->is_kernel_ready = 0;
+    context->stereo.kernel = stereogram_create(state->image_width,
+        state->image_height, state->pattern_base,
+        ARGUMENT_VALUE(stereogram_strength), ARGUMENT_VALUE(pixel_format));
+    if (!context->stereo.kernel) {
+        trace_end();
+        return NULL;
+    }
 
-    /* Activate the pattern texture if it is turned on */
-    if (context->gl.apply_texture) {
-        glEnable(GL_TEXTURE_2D);
-        GLuint pattern_texture = context->gl.textures[1];
-        glBindTexture(GL_TEXTURE_2D, pattern_texture);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-            context->stereo.image->pattern->width,
-            context->stereo.image->pattern->height, 0, GL_RGBA,
-            GL_UNSIGNED_BYTE, context->stereo.image->pattern->pixels);
-        flags |= MAZE_RENDER_GL_TEXTURE;
+    /* Images are still generated on this thread if the workers cannot be
+       started */
+    if (context->stereo.tuning.threads > 0) {
+        stereogram_tune(context->stereo.kernel, &context->stereo.tuning);
     }
-    else {
-        glDisable(GL_TEXTURE_2D);
+
+    /* Reproject the depth on as many threads as generate images; the walls
+       are only known for the merged mesh */
+    if (ARGUMENT_VALUE(reprojection).frames > 0
+            && ARGUMENT_VALUE(merge_walls)) {
+        context->stereo.reprojection = reprojection_create(
+            state->image_width, state->image_height,
+            context->stereo.tuning.threads);
+        if (!context->stereo.reprojection) {
+            trace_end();
+            return NULL;
+        }
     }
 
-    maze_render_gl(context->maze.data, ARGUMENT_VALUE(wall_width),
-        ARGUMENT_VALUE(slope_width), 0.1, (int)context->camera.x,
-        (int)context->camera.y, 5, flags);
+    state->is_kernel_ready = 1;
+    trace_end();
 
-    glDisable(GL_TEXTURE_2D);
-    context_object_render(context);
+    return NULL;
 }
 
-void
-context_render(Context *context)
+/**
+ * Starts a thread of context_prepare.
+ *
+ * If the thread cannot be started, the function is run before this function
+ * returns.
+ *
+ * @param thread
+ *     The thread.
+ * @param function
+ *     The function to run.
+ * @param state
+ *     The preparation state.
+ * @return non-zero if the thread was started and must be joined, and 0
+ *     otherwise
+ */
+static int
+context_prepare_start(pthread_t *thread, void *(*function)(void*),
+    struct context_prepare_state *state)
 {
-    camera_setup(context);
-    lights_setup(context, !context->gl.render_stereo);
-
-    /* Update the pattern if required */
-    if (context->stereo.update_pattern) {
-        stereo_pattern_effect_apply(context->stereo.effect);
+    if (pthread_create(thread, NULL, function, state) == 0) {
+        return 1;
     }
 
-    if (context->gl.render_stereo) {
-        context_render_stereo(context);
-    }
-    else {
-        context_render_plain(context);
-    }
-}
+    function(state);
 
-void
-context_camera_move(Context *context)
-{
-    context_object_target(&context->camera,
-        context->target.x, context->target.y, 0.7);
-    context_object_update_position(&context->camera);
-    context_object_update_speed(&context->camera, 0.1);
+    return 0;
 }
 
-void
-context_target_accelerate_x(Context *context, double a)
+int
+context_prepare(Context *context,
+    unsigned int image_width, unsigned int image_height,
+    StereoPattern *pattern_base)
+{
+    struct context_prepare_state state;
+    pthread_t maze_thread, stereo_thread, kernel_thread;
+    int has_maze_thread, has_stereo_thread, has_kernel_thread = 0;
+    int i;
+
+    /* Make sure that the context is passed */
+    if (!context || !pattern_base) {
+        return 0;
+    }
+
+    trace_begin("context_prepare");
+
+    memset(&state, 0, sizeof(state));
+    state.context = context;
+    state.image_width = image_width;
+    state.image_height = image_height;
+    state.pattern_base = pattern_base;
+    state.seed = rand();
+    state.is_kernel_ready = 1;
+
+    /* Randomise the effect parameters here, so that only the maze is
+       generated from the random sequence concurrently */
+    for (i = 0; i < sizeof(state.wave_strengths) / sizeof(double); i++) {
+        state.wave_strengths[i] = WAVE_STRENGTH_BASE + WAVE_STRENGTH_EXTRA
+            * (double)(rand() - RAND_MAX / 2) / RAND_MAX / (i + 1);
+    }
+    state.pattern = stereo_pattern_create(pattern_base->width,
+        pattern_base->height);
+
+    /* Generate the maze, the pattern and the kernel at the same time; the
+       compact pixel formats are only supported by the fused kernel */
+    has_maze_thread = context_prepare_start(&maze_thread,
+        context_prepare_maze, &state);
+    has_stereo_thread = context_prepare_start(&stereo_thread,
+        context_prepare_stereo, &state);
+    if (ARGUMENT_VALUE(fused_stereogram)
+            || ARGUMENT_VALUE(pixel_format) != STEREOGRAM_FORMAT_RGBA) {
+        has_kernel_thread = context_prepare_start(&kernel_thread,
+            context_prepare_kernel, &state);
+    }
+    if (has_maze_thread) {
+        pthread_join(maze_thread, NULL);
+    }
+    if (has_stereo_thread) {
+        pthread_join(stereo_thread, NULL);
+    }
+    if (has_kernel_thread) {
+        pthread_join(kernel_thread, NULL);
+    }
+
+    /* Initialise the maze */
+    if (!state.is_maze_ready) {
+        trace_end();
+        return 0;
+    }
+    context_maze_install(context, &state.maze);
+
+    /* Initialise the wandering objects */
+    if (ARGUMENT_VALUE(objects) > 0) {
+        context->maze.swarm = maze_swarm_create(context->maze.data,
+            ARGUMENT_VALUE(objects), TARGET_MARGIN);
+        if (!context->maze.swarm) {
+            trace_end();
+            return 0;
+        }
+    }
+
+    if (!state.is_stereo_ready || !state.is_kernel_ready) {
+        trace_end();
+        return 0;
+    }
+
+    /* The kernel was created before the pattern was generated */
+    if (context->stereo.kernel) {
+        stereogram_pattern_set(context->stereo.kernel, state.pattern);
+    }
+
+    /* Automatically update the pattern every frame */
+    context->stereo.update_pattern = 1;
+
+    /* Start generating the next maze */
+    context_maze_prefetch(context);
+
+    trace_end();
+
+    return 1;
+}
+
+int
+context_initialize_gl(Context *context,
+    unsigned int screen_width, unsigned int screen_height)
+{
+    unsigned int image_width = context->stereo.zbuffer->width;
+    unsigned int image_height = context->stereo.zbuffer->height;
+
+    trace_begin("context_initialize_gl");
+
+    /* Initialise the OpenGL data */
+    context->gl.ratio = (GLfloat)screen_width / screen_height;
+    if (ARGUMENT_VALUE(merge_walls)) {
+        context->maze.mesh = maze_mesh_create(context->maze.data,
+            ARGUMENT_VALUE(wall_width), ARGUMENT_VALUE(slope_width),
+            WALL_HEIGHT);
+        if (!context->maze.mesh) {
+            trace_end();
+            return 0;
+        }
+    }
+    glGenFramebuffers(sizeof(context->gl.framebuffers) / sizeof(GLuint),
+        context->gl.framebuffers);
+    glGenTextures(sizeof(context->gl.textures) / sizeof(GLuint),
+        context->gl.textures);
+    glGenQueries(sizeof(context->gl.queries) / sizeof(GLuint),
+        context->gl.queries);
+    glGenBuffers(sizeof(context->gl.pixel_buffers) / sizeof(GLuint),
+        context->gl.pixel_buffers);
+    context->gl.sphere_list = sphere_list_create(SPHERE_PRECISION, 1.0);
+    context->gl.render_stereo = 1;
+    context->gl.apply_texture = 0;
+
+    /* Specify the depth texture, the size of the z-buffer */
+    GLuint depth_texture = context->gl.textures[2];
+    gl_state_bind_texture(depth_texture);
+    gl_state_tex_filter(GL_NEAREST, GL_NEAREST);
+    gl_state_tex_image(GL_DEPTH_COMPONENT, image_width, image_height,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+    gl_state_bind_texture(0);
+
+    /* Specify the frame buffer; it has no colour attachment, so no colour
+       buffer is drawn to or read from */
+    GLuint framebuffer = context->gl.framebuffers[0];
+    gl_state_bind_framebuffer(framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+        depth_texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    gl_state_bind_framebuffer(0);
+
+    /* Initialise the pixel buffers of the fused stereogram kernel */
+    if (context->stereo.kernel) {
+        gl_state_bind_buffer(GL_PIXEL_PACK_BUFFER,
+            context->gl.pixel_buffers[0]);
+        gl_state_buffer_data(GL_PIXEL_PACK_BUFFER,
+            image_width * image_height * sizeof(uint16_t), NULL,
+            GL_STREAM_READ);
+        gl_state_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+        gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+            context->gl.pixel_buffers[1]);
+        gl_state_buffer_data(GL_PIXEL_UNPACK_BUFFER,
+            image_width * image_height * context->stereo.kernel->pixel_size,
+            NULL, GL_STREAM_DRAW);
+        gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        /* Indexed images are expanded through the pixel maps on upload */
+        if (context->stereo.kernel->format == STEREOGRAM_FORMAT_INDEXED) {
+            stereogram_gl_palette();
+        }
+    }
+
+    trace_end();
+
+    return 1;
+}
+
+int
+context_initialize(Context *context,
+    unsigned int image_width, unsigned int image_height,
+    unsigned int screen_width, unsigned int screen_height,
+    StereoPattern *pattern_base)
+{
+    return context_prepare(context, image_width, image_height, pattern_base)
+        && context_initialize_gl(context, screen_width, screen_height);
+}
+
+int
+context_buffers_bind(Context *context)
+{
+    ZBuffer *zbuffer = context->stereo.zbuffer;
+    StereoPattern *image = context->stereo.image->image;
+    StereoPattern *pattern = context->stereo.image->pattern;
+    size_t zbuffer_stride, zbuffer_size, image_size, pattern_size;
+
+    /* Calculate the size of the buffers */
+    zbuffer_stride = arena_stride(zbuffer->width, sizeof(*zbuffer->data));
+    zbuffer_size = zbuffer_stride * zbuffer->height;
+    image_size = arena_stride(image->width * image->height,
+        sizeof(*image->pixels));
+    pattern_size = arena_stride(pattern->width * pattern->height,
+        sizeof(*pattern->pixels));
+
+    /* If the buffers are already in the arena, move them back to the
+       original buffers before the arena is reset, so that the originals are
+       saved again below instead of arena memory; the generated image and
+       pattern are kept */
+    if (context->memory.image_pixels) {
+        memcpy(context->memory.image_pixels, image->pixels,
+            image->width * image->height * sizeof(*image->pixels));
+    }
+    if (context->memory.pattern_pixels) {
+        memcpy(context->memory.pattern_pixels, pattern->pixels,
+            pattern->width * pattern->height * sizeof(*pattern->pixels));
+    }
+    context_buffers_unbind(context);
+
+    /* Reuse the arena if it is large enough */
+    if (context->memory.arena && context->memory.arena->size
+            < zbuffer_size + image_size + pattern_size) {
+        arena_free(context->memory.arena);
+        context->memory.arena = NULL;
+    }
+    if (!context->memory.arena) {
+        context->memory.arena = arena_create(
+            zbuffer_size + image_size + pattern_size,
+            ARGUMENT_VALUE(huge_pages) ? ARENA_HUGE_PAGES : 0);
+        if (!context->memory.arena) {
+            return 0;
+        }
+    }
+    else {
+        arena_reset(context->memory.arena);
+    }
+
+    /* Keep the original buffers so that they can be restored */
+    context->memory.zbuffer_data = zbuffer->data;
+    context->memory.zbuffer_rowoffset = zbuffer->rowoffset;
+    context->memory.image_pixels = image->pixels;
+    context->memory.pattern_pixels = pattern->pixels;
+
+    /* The z-buffer is overwritten every frame, so its content is not copied;
+       the image and pattern may already have been generated */
+    zbuffer->data = arena_alloc(context->memory.arena, zbuffer_size);
+    zbuffer->rowoffset = zbuffer_stride / sizeof(*zbuffer->data);
+    image->pixels = arena_alloc(context->memory.arena, image_size);
+    memcpy(image->pixels, context->memory.image_pixels,
+        image->width * image->height * sizeof(*image->pixels));
+    pattern->pixels = arena_alloc(context->memory.arena, pattern_size);
+    memcpy(pattern->pixels, context->memory.pattern_pixels,
+        pattern->width * pattern->height * sizeof(*pattern->pixels));
+
+    return 1;
+}
+
+void
+context_buffers_unbind(Context *context)
+{
+    if (context->memory.zbuffer_data) {
+        context->stereo.zbuffer->data = context->memory.zbuffer_data;
+        context->stereo.zbuffer->rowoffset =
+            context->memory.zbuffer_rowoffset;
+        context->memory.zbuffer_data = NULL;
+    }
+
+    if (context->memory.image_pixels) {
+        context->stereo.image->image->pixels = context->memory.image_pixels;
+        context->memory.image_pixels = NULL;
+    }
+
+    if (context->memory.pattern_pixels) {
+        context->stereo.image->pattern->pixels =
+            context->memory.pattern_pixels;
+        context->memory.pattern_pixels = NULL;
+    }
+}
+
+/**
+ * Sets up the camera for the context.
+ *
+ * The current OpenGL matrix is modified.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+camera_setup(Context *context)
+{
+    glMatrixMode(GL_MODELVIEW);
+    mgluPerspective(45, context->gl.ratio, Z_NEAR, Z_FAR);
+    mgluLookAt(
+        context->camera.x,
+        context->maze.data->height - context->camera.y,
+        CAMERA_Z,
+
+        context->target.x,
+        context->maze.data->height - context->target.y,
+        TARGET_Z,
+
+        0.1, 1.0, 0.0);
+}
+
+/**
+ * Sets up the lights for the context.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+lights_setup(Context *context, int enable)
+{
+    if (enable) {
+        GLfloat light_position[] = {
+            2.0 * context->camera.ax,
+            -2.0 * context->camera.ay,
+            -1.0, 1.0};
+        static GLfloat light_ambient[] = {0.0, 0.0, 0.0, 1.0};
+        static GLfloat light_diffuse[] = {1.0, 1.0, 1.0, 1.0};
+        static GLfloat light_specular[] = {1.0, 1.0, 1.0, 1.0};
+        static GLfloat material_emission[] = {0.0, 0.0, 0.0, 1.0};
+        static GLfloat material_diffuse[] = {0.0, 0.0, 0.0, 1.0};
+        static GLfloat material_specular[] = {0.0, 0.0, 0.0, 1.0};
+
+        /* Select the correct matrix for "light at eye" mode */
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+
+        gl_state_light(GL_POSITION, light_position);
+        gl_state_light(GL_AMBIENT, light_ambient);
+        gl_state_light(GL_DIFFUSE, light_diffuse);
+        gl_state_light(GL_SPECULAR, light_specular);
+        gl_state_enable(GL_LIGHTING, 1);
+        gl_state_enable(GL_LIGHT0, 1);
+
+        gl_state_enable(GL_COLOR_MATERIAL, 1);
+        gl_state_material(GL_EMISSION, material_emission);
+        gl_state_material(GL_DIFFUSE, material_diffuse);
+        gl_state_material(GL_SPECULAR, material_specular);
+
+        glPopMatrix();
+    }
+    else {
+        gl_state_enable(GL_LIGHTING, 0);
+        gl_state_enable(GL_LIGHT0, 0);
+
+        gl_state_enable(GL_COLOR_MATERIAL, 0);
+    }
+}
+
+void
+context_free(Context *context)
+{
+    /* Make sure that the context is passed */
+    if (!context) {
+        return;
+    }
+
+    context_maze_prefetch_cancel(context);
+
+    if (context->maze.mesh) {
+        maze_mesh_free(context->maze.mesh);
+        context->maze.mesh = NULL;
+    }
+
+    if (context->maze.swarm) {
+        maze_swarm_free(context->maze.swarm);
+        context->maze.swarm = NULL;
+    }
+
+    if (context->maze.height) {
+        maze_height_free(context->maze.height);
+        context->maze.height = NULL;
+    }
+
+    if (context->maze.path) {
+        maze_path_free(context->maze.path);
+        context->maze.path = NULL;
+    }
+
+    if (context->maze.data) {
+        maze_free(context->maze.data);
+        context->maze.data = NULL;
+    }
+
+    if (context->stereo.recording) {
+        recording_writer_close(context->stereo.recording);
+        context->stereo.recording = NULL;
+    }
+
+    /* Give the buffers back to libstereo before freeing the objects */
+    context_buffers_unbind(context);
+
+    if (context->stereo.zbuffer) {
+        stereo_zbuffer_free(context->stereo.zbuffer);
+        context->stereo.zbuffer = NULL;
+    }
+
+    if (context->stereo.effect) {
+        stereo_pattern_effect_free(context->stereo.effect);
+        context->stereo.effect = NULL;
+    }
+
+    if (context->stereo.reprojection) {
+        reprojection_free(context->stereo.reprojection);
+        context->stereo.reprojection = NULL;
+    }
+
+    if (context->stereo.kernel) {
+        stereogram_free(context->stereo.kernel);
+        context->stereo.kernel = NULL;
+    }
+
+    if (context->stereo.image) {
+        stereo_image_free(context->stereo.image);
+        context->stereo.image = NULL;
+    }
+
+    if (context->memory.arena) {
+        arena_free(context->memory.arena);
+        context->memory.arena = NULL;
+    }
+
+    glDeleteTextures(sizeof(context->gl.textures) / sizeof(GLuint),
+        context->gl.textures);
+    glDeleteBuffers(sizeof(context->gl.pixel_buffers) / sizeof(GLuint),
+        context->gl.pixel_buffers);
+    glDeleteQueries(sizeof(context->gl.queries) / sizeof(GLuint),
+        context->gl.queries);
+    glDeleteFramebuffers(sizeof(context->gl.framebuffers) / sizeof(GLuint),
+        context->gl.framebuffers);
+    if (context->gl.sphere_list) {
+        glDeleteLists(context->gl.sphere_list, 1);
+    }
+
+    /* The deleted objects may have been bound */
+    gl_state_reset();
+}
+
+/**
+ * Starts timing a stage of rendering.
+ *
+ * @param stage
+ *     The stage.
+ * @return the start time, to pass to context_stage_end
+ * @see context_stage_end
+ */
+static uint64_t
+context_stage_begin(MetricsStage stage)
+{
+    static const char *names[METRICS_STAGE_COUNT] = {
+        "stereo_pattern_effect_apply",
+        "maze draw",
+        "readback",
+        "depth reproject",
+        "stereogram apply",
+        "texture upload",
+        "SDL_GL_SwapBuffers",
+        "frame",
+        "input"};
+
+    trace_begin(names[stage]);
+
+    return metrics_now();
+}
+
+/**
+ * Stops timing a stage of rendering.
+ *
+ * @param stage
+ *     The stage passed to context_stage_begin.
+ * @param start
+ *     The time returned by context_stage_begin.
+ */
+static void
+context_stage_end(MetricsStage stage, uint64_t start)
+{
+    metrics_observe(stage, start);
+    trace_end();
+}
+
+/**
+ * Renders the maze around the camera.
+ *
+ * If wall merging is enabled, the maze is rendered from the cached mesh,
+ * otherwise it is rendered room by room by libmaze.
+ *
+ * @param context
+ *     The context.
+ * @param flags
+ *     The parts of the maze to render; see maze_render_gl.
+ */
+static void
+context_maze_render(Context *context, int flags)
+{
+    if (context->maze.mesh) {
+        maze_mesh_render(context->maze.mesh, (int)context->camera.x,
+            (int)context->camera.y, VIEW_RADIUS, flags);
+    }
+    else {
+        maze_render_gl(context->maze.data, ARGUMENT_VALUE(wall_width),
+            ARGUMENT_VALUE(slope_width), WALL_HEIGHT, (int)context->camera.x,
+            (int)context->camera.y, VIEW_RADIUS, flags);
+    }
+}
+
+/**
+ * Appends a generated stereogram to the recording, if one is being made.
+ *
+ * The stereogram is stamped with the current time, so that playback keeps
+ * the pauses during which nothing was rendered.
+ *
+ * @param context
+ *     The context.
+ * @param pixels
+ *     The stereogram image, with packed rows.
+ */
+static void
+context_record(Context *context, const void *pixels)
+{
+    if (context->stereo.recording) {
+        recording_writer_add(context->stereo.recording, pixels,
+            context->stereo.zbuffer->width, metrics_now());
+    }
+}
+
+/**
+ * Returns how the pixel unpack buffer must be mapped for the fused kernel to
+ * write the stereogram to it.
+ *
+ * @param context
+ *     The context.
+ * @return the access of the mapping; the image is read back when recording
+ */
+static GLenum
+context_pixels_access(const Context *context)
+{
+    return context->stereo.recording ? GL_READ_WRITE : GL_WRITE_ONLY;
+}
+
+/**
+ * Returns the depth of the floor at the centre of the view.
+ *
+ * The camera looks down at the target from above, so the depth of the floor
+ * changes little across the view, and the depth buffer is cleared to this
+ * value instead of drawing the floor.
+ *
+ * @param context
+ *     The context.
+ * @return the depth of the floor in window coordinates
+ */
+static GLclampd
+context_floor_depth(const Context *context)
+{
+    double dx = context->target.x - context->camera.x;
+    double dy = context->target.y - context->camera.y;
+    double dz = CAMERA_Z - TARGET_Z;
+    double distance;
+
+    /* The line of sight passes through the target and hits the floor
+       further along; the distance along it is the distance from the eye */
+    distance = sqrt(dx * dx + dy * dy + dz * dz) * CAMERA_Z / dz;
+    if (distance <= Z_NEAR) {
+        return 0.0;
+    }
+    else if (distance >= Z_FAR) {
+        return 1.0;
+    }
+    else {
+        return Z_FAR * (distance - Z_NEAR) / (distance * (Z_FAR - Z_NEAR));
+    }
+}
+
+/**
+ * Describes the view of the current camera for depth reprojection.
+ *
+ * The camera must have been set up on the modelview matrix; the projection
+ * matrix is the identity.
+ *
+ * @param context
+ *     The context.
+ * @param view
+ *     Receives the view.
+ */
+static void
+context_reprojection_view(const Context *context, ReprojectionView *view)
+{
+    double height = context->maze.data->height;
+
+    glGetDoublev(GL_MODELVIEW_MATRIX, view->matrix);
+    view->eye[0] = context->camera.x;
+    view->eye[1] = height - context->camera.y;
+    view->eye[2] = CAMERA_Z;
+    view->background = context_floor_depth(context);
+    view->object[0] = context->target.x;
+    view->object[1] = height - context->target.y;
+    view->object[2] = TARGET_Z;
+    view->object_radius = TARGET_RADIUS;
+}
+
+/**
+ * Generates the stereogram with the fused kernel.
+ *
+ * The depth buffer of the currently bound framebuffer is read back at 16 bit
+ * precision to the pixel pack buffer, and the stereogram is generated from
+ * the mapped pack buffer straight into the mapped pixel unpack buffer. When
+ * this function returns, the framebuffer is unbound and the unpack buffer is
+ * bound, ready for uploading the image.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the image was generated and 0 if a buffer could not be
+ *     mapped
+ */
+static int
+context_stereogram_fused(Context *context)
+{
+    Stereogram *kernel = context->stereo.kernel;
+    const uint16_t *depth;
+    void *pixels;
+    int result;
+    uint64_t start = context_stage_begin(METRICS_STAGE_READBACK);
+
+    /* Read the depth values to the pack buffer */
+    gl_state_bind_buffer(GL_PIXEL_PACK_BUFFER, context->gl.pixel_buffers[0]);
+    gl_state_pixel_store(GL_PACK_ROW_LENGTH, 0);
+    gl_state_pixel_store(GL_PACK_ALIGNMENT, sizeof(uint16_t));
+    gl_state_read_pixels(0, 0, kernel->width, kernel->height,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+    gl_state_bind_framebuffer(0);
+
+    /* Orphan the previous image so that mapping does not wait for it to be
+       uploaded */
+    gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+        context->gl.pixel_buffers[1]);
+    gl_state_buffer_data(GL_PIXEL_UNPACK_BUFFER,
+        kernel->width * kernel->height * kernel->pixel_size, NULL,
+        GL_STREAM_DRAW);
+
+    /* Mapping the pack buffer waits for the read back to complete */
+    depth = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER,
+        context_pixels_access(context));
+    context_stage_end(METRICS_STAGE_READBACK, start);
+
+    /* Keep the depth values as the reference for the following frames */
+    if (depth && context->stereo.reprojection) {
+        ReprojectionView view;
+
+        start = context_stage_begin(METRICS_STAGE_REPROJECT);
+        context_reprojection_view(context, &view);
+        reprojection_reference(context->stereo.reprojection, depth,
+            kernel->width, &view);
+        context->stereo.reprojected = 0;
+        context_stage_end(METRICS_STAGE_REPROJECT, start);
+    }
+
+    start = context_stage_begin(METRICS_STAGE_STEREOGRAM);
+    result = depth && pixels;
+    if (result) {
+        stereogram_apply(kernel, depth, kernel->width, pixels, kernel->width);
+        context_record(context, pixels);
+    }
+    if (pixels) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    if (depth) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    context_stage_end(METRICS_STAGE_STEREOGRAM, start);
+
+    gl_state_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return result;
+}
+
+/**
+ * Generates the stereogram with the fused kernel from depth values
+ * reprojected from the last rendered frame.
+ *
+ * Nothing is drawn. When this function returns non-zero, the pixel unpack
+ * buffer is bound, ready for uploading the image.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the image was generated, and 0 if the depth must be
+ *     rendered because the camera has moved too far or too many frames have
+ *     been estimated since the last rendered frame
+ */
+static int
+context_stereogram_reprojected(Context *context)
+{
+    Stereogram *kernel = context->stereo.kernel;
+    ReprojectionView view;
+    const uint16_t *depth;
+    void *pixels;
+    double error;
+    uint64_t start;
+
+    /* The wandering objects are not part of the reference frame */
+    if (!context->stereo.reprojection || context->maze.swarm
+            || context->stereo.reprojected
+                >= ARGUMENT_VALUE(reprojection).frames) {
+        return 0;
+    }
+
+    start = context_stage_begin(METRICS_STAGE_REPROJECT);
+    context_reprojection_view(context, &view);
+    depth = reprojection_apply(context->stereo.reprojection,
+        context->maze.height, &view, ARGUMENT_VALUE(reprojection).error,
+        &error);
+    context_stage_end(METRICS_STAGE_REPROJECT, start);
+    if (!depth) {
+        return 0;
+    }
+
+    start = context_stage_begin(METRICS_STAGE_STEREOGRAM);
+    gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+        context->gl.pixel_buffers[1]);
+    gl_state_buffer_data(GL_PIXEL_UNPACK_BUFFER,
+        kernel->width * kernel->height * kernel->pixel_size, NULL,
+        GL_STREAM_DRAW);
+    pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER,
+        context_pixels_access(context));
+    if (pixels) {
+        stereogram_apply(kernel, depth, kernel->width, pixels, kernel->width);
+        context_record(context, pixels);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    context_stage_end(METRICS_STAGE_STEREOGRAM, start);
+    if (!pixels) {
+        return 0;
+    }
+
+    context->stereo.reprojected++;
+    metrics_add(METRICS_FRAMES_REPROJECTED, 1);
+
+    return 1;
+}
+
+/**
+ * Regenerates the stereogram with the fused kernel from the sources recorded
+ * for the last depth values.
+ *
+ * When this function returns, the pixel unpack buffer is bound, ready for
+ * uploading the image.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the image was generated and 0 if the buffer could not
+ *     be mapped
+ */
+static int
+context_stereogram_recolour(Context *context)
+{
+    Stereogram *kernel = context->stereo.kernel;
+    void *pixels;
+    uint64_t start = context_stage_begin(METRICS_STAGE_STEREOGRAM);
+
+    gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+        context->gl.pixel_buffers[1]);
+    gl_state_buffer_data(GL_PIXEL_UNPACK_BUFFER,
+        kernel->width * kernel->height * kernel->pixel_size, NULL,
+        GL_STREAM_DRAW);
+    pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER,
+        context_pixels_access(context));
+    if (pixels) {
+        stereogram_recolour(kernel, pixels, kernel->width);
+        context_record(context, pixels);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    context_stage_end(METRICS_STAGE_STEREOGRAM, start);
+
+    return pixels != NULL;
+}
+
+/**
+ * Makes the fused kernel record sources only while the pattern is animated.
+ *
+ * Recording sources slows down generating an image, and they are only used
+ * to regenerate a still scene for an updated pattern.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_sources_update(Context *context)
+{
+    Stereogram *kernel = context->stereo.kernel;
+
+    if (!kernel) {
+        return;
+    }
+
+    if (context->stereo.update_pattern && !kernel->sources) {
+        /* The images are still generated directly upon failure */
+        stereogram_sources_enable(kernel);
+        context->stereo.sources.is_valid = 0;
+    }
+    else if (!context->stereo.update_pattern && kernel->sources) {
+        stereogram_sources_disable(kernel);
+        context->stereo.sources.is_valid = 0;
+    }
+}
+
+/**
+ * Returns whether the sources recorded by the fused kernel still match the
+ * scene.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if only the pattern may have changed since the sources
+ *     were recorded and 0 otherwise
+ */
+static int
+context_sources_are_valid(const Context *context)
+{
+    return context->stereo.kernel
+        && context->stereo.kernel->has_sources
+        && context->stereo.sources.is_valid
+        && !context->maze.swarm
+        && fabs(context->camera.x - context->stereo.sources.camera_x)
+            <= IDLE_EPSILON
+        && fabs(context->camera.y - context->stereo.sources.camera_y)
+            <= IDLE_EPSILON
+        && fabs(context->target.x - context->stereo.sources.target_x)
+            <= IDLE_EPSILON
+        && fabs(context->target.y - context->stereo.sources.target_y)
+            <= IDLE_EPSILON;
+}
+
+/**
+ * Renders the depth of the scene to the depth texture.
+ *
+ * Only the depth values are read back, so colour writes are masked off and
+ * lighting and texturing are disabled. The floor is not drawn; the depth
+ * buffer is cleared to its depth instead, which also hides the bottom of walls
+ * below it.
+ *
+ * The primitives generated and the fragments passing the depth test are
+ * counted; see context_depth_counters.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_render_depth(Context *context)
+{
+    gl_state_bind_framebuffer(context->gl.framebuffers[0]);
+    gl_state_color_mask(0);
+    gl_state_enable(GL_LIGHTING, 0);
+    gl_state_enable(GL_TEXTURE_2D, 0);
+
+    /* The floor is the background */
+    gl_state_clear_depth(context_floor_depth(context));
+    glClear(GL_DEPTH_BUFFER_BIT);
+    gl_state_clear_depth(1.0);
+
+    glBeginQuery(GL_PRIMITIVES_GENERATED, context->gl.queries[0]);
+    glBeginQuery(GL_SAMPLES_PASSED, context->gl.queries[1]);
+    context_maze_render(context, MAZE_RENDER_GL_WALLS | MAZE_RENDER_GL_TOP);
+    context_object_render(context);
+    context_swarm_render(context);
+    glEndQuery(GL_SAMPLES_PASSED);
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+
+    gl_state_color_mask(1);
+}
+
+/**
+ * Retrieves the results of the queries of the last depth pass.
+ *
+ * This must only be called once the depth values have been read back, since
+ * the queries are then complete and retrieving their results does not wait.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_depth_counters(Context *context)
+{
+    glGetQueryObjectuiv(context->gl.queries[0], GL_QUERY_RESULT,
+        &context->gl.depth_primitives);
+    glGetQueryObjectuiv(context->gl.queries[1], GL_QUERY_RESULT,
+        &context->gl.depth_fragments);
+    metrics_add(METRICS_DEPTH_PRIMITIVES, context->gl.depth_primitives);
+    metrics_add(METRICS_DEPTH_FRAGMENTS, context->gl.depth_fragments);
+}
+
+/**
+ * Renders the scene in stereogram mode.
+ *
+ * This will make the maze be displayed as an animated stereogram.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_render_stereo(Context *context)
+{
+    uint64_t start;
+    int is_generated = 1;
+
+    /* Determine the size of the texture */
+    GLsizei width, height;
+    width = context->stereo.zbuffer->width;
+    height = context->stereo.zbuffer->height;
+
+    /* Store the old viewport and set one the size of the texture */
+    GLint old_viewport[4];
+    gl_state_get_viewport(old_viewport);
+    gl_state_viewport(0, 0, width, height);
+
+    if (context_sources_are_valid(context)) {
+        /* Only the pattern has changed, so the depth need not be rendered
+           again */
+        is_generated = context_stereogram_recolour(context);
+    }
+    else if (context->stereo.kernel) {
+        if (context_stereogram_reprojected(context)) {
+            /* The depth was estimated from the last rendered frame, and the
+               sources recorded for it */
+            context->stereo.sources.is_valid = 1;
+        }
+        else {
+            /* Draw the depth of the scene */
+            start = context_stage_begin(METRICS_STAGE_DRAW);
+            context_render_depth(context);
+            context_stage_end(METRICS_STAGE_DRAW, start);
+
+            /* Generate the stereogram directly from the depth buffer into
+               the pixel unpack buffer */
+            is_generated = context->stereo.sources.is_valid =
+                context_stereogram_fused(context);
+            context_depth_counters(context);
+        }
+
+        /* Remember the scene for which the sources were recorded */
+        context->stereo.sources.camera_x = context->camera.x;
+        context->stereo.sources.camera_y = context->camera.y;
+        context->stereo.sources.target_x = context->target.x;
+        context->stereo.sources.target_y = context->target.y;
+    }
+    else {
+        /* Draw the depth of the scene */
+        start = context_stage_begin(METRICS_STAGE_DRAW);
+        context_render_depth(context);
+        context_stage_end(METRICS_STAGE_DRAW, start);
+
+        /* Retrieve the depth data to the z-buffer */
+        start = context_stage_begin(METRICS_STAGE_READBACK);
+        gl_state_pixel_store(GL_PACK_ROW_LENGTH,
+            context->stereo.zbuffer->rowoffset);
+        gl_state_read_pixels(0, 0, width, height, GL_DEPTH_COMPONENT,
+            GL_UNSIGNED_BYTE, context->stereo.zbuffer->data);
+        gl_state_bind_framebuffer(0);
+        context_stage_end(METRICS_STAGE_READBACK, start);
+
+        /* Regenerate the stereogram from the depth data generated by
+           OpenGL */
+        start = context_stage_begin(METRICS_STAGE_STEREOGRAM);
+        stereo_image_apply(context->stereo.image, context->stereo.zbuffer,
+            0);
+        context_record(context, context->stereo.image->image->pixels);
+        context_stage_end(METRICS_STAGE_STEREOGRAM, start);
+        context_depth_counters(context);
+    }
+
+    /* Clear the depth buffer to enable the texture to be displayed */
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    /* Activate the stereogram texture; the fused kernel leaves the image in
+       the bound pixel unpack buffer, and if it could not write the image
+       there, the texture keeps the previous one */
+    start = context_stage_begin(METRICS_STAGE_UPLOAD);
+    gl_state_enable(GL_TEXTURE_2D, 1);
+    GLuint stereogram_texture = context->gl.textures[0];
+    gl_state_bind_texture(stereogram_texture);
+    gl_state_pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    gl_state_tex_env_mode(GL_MODULATE);
+    gl_state_tex_filter(GL_LINEAR, GL_LINEAR);
+    if (context->stereo.kernel) {
+        GLenum format, type;
+
+        if (is_generated) {
+            stereogram_gl_format(context->stereo.kernel->format, &format,
+                &type);
+            gl_state_tex_image(
+                stereogram_gl_internal_format(context->stereo.kernel->format),
+                width, height, format, type, NULL);
+        }
+        gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else {
+        gl_state_tex_image(GL_RGBA, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+            context->stereo.image->image->pixels);
+    }
+    context_stage_end(METRICS_STAGE_UPLOAD, start);
+
+    /* Restore the viewport and draw the stereogram on screen */
+    gl_state_viewport(old_viewport[0], old_viewport[1],
+        old_viewport[2], old_viewport[3]);
+    stereogram_gl_draw();
+}
+
+/**
+ * Renders the scene in plain 3D mode.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+context_render_plain(Context *context)
+{
+    int flags = MAZE_RENDER_GL_WALLS | MAZE_RENDER_GL_FLOOR
+        | MAZE_RENDER_GL_TOP;
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    /* Activate the pattern texture if it is turned on */
+    if (context->gl.apply_texture) {
+        gl_state_enable(GL_TEXTURE_2D, 1);
+        GLuint pattern_texture = context->gl.textures[1];
+        gl_state_bind_texture(pattern_texture);
+        gl_state_pixel_store(GL_UNPACK_ALIGNMENT, 1);
+        gl_state_tex_env_mode(GL_MODULATE);
+        gl_state_tex_filter(GL_LINEAR, GL_LINEAR);
+
+        /* Only upload the pattern if it has changed; the kernel keeps a
+           copy in its compact pixel format */
+        if (!context->gl.pattern_uploaded || context->pattern_generation
+                != context->gl.pattern_uploaded_generation) {
+            StereoPattern *pattern = context->stereo.image->pattern;
+            uint64_t start = context_stage_begin(METRICS_STAGE_UPLOAD);
+
+            if (context->stereo.kernel) {
+                GLenum format, type;
+
+                stereogram_gl_format(context->stereo.kernel->format, &format,
+                    &type);
+                gl_state_tex_image(stereogram_gl_internal_format(
+                        context->stereo.kernel->format),
+                    pattern->width, pattern->height, format, type,
+                    context->stereo.kernel->pattern_pixels);
+            }
+            else {
+                gl_state_tex_image(GL_RGBA, pattern->width, pattern->height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, pattern->pixels);
+            }
+            context_stage_end(METRICS_STAGE_UPLOAD, start);
+            context->gl.pattern_uploaded = 1;
+            context->gl.pattern_uploaded_generation =
+                context->pattern_generation;
+        }
+        flags |= MAZE_RENDER_GL_TEXTURE;
+    }
+    else {
+        gl_state_enable(GL_TEXTURE_2D, 0);
+    }
+
+    uint64_t start = context_stage_begin(METRICS_STAGE_DRAW);
+    context_maze_render(context, flags);
+
+    gl_state_enable(GL_TEXTURE_2D, 0);
+    context_object_render(context);
+    context_swarm_render(context);
+    context_stage_end(METRICS_STAGE_DRAW, start);
+}
+
+void
+context_render(Context *context)
+{
+    trace_begin("context_render");
+    camera_setup(context);
+    lights_setup(context, !context->gl.render_stereo);
+
+    /* Update the pattern if required */
+    if (context->stereo.update_pattern) {
+        uint64_t start = context_stage_begin(METRICS_STAGE_PATTERN);
+
+        stereo_pattern_effect_apply(context->stereo.effect);
+        if (context->stereo.kernel) {
+            stereogram_pattern_update(context->stereo.kernel);
+        }
+        context->pattern_generation++;
+        context_stage_end(METRICS_STAGE_PATTERN, start);
+    }
+    context_sources_update(context);
+
+    if (context->gl.render_stereo) {
+        context_render_stereo(context);
+    }
+    else {
+        context_render_plain(context);
+    }
+
+    /* Store the state of the rendered scene */
+    context->rendered.is_valid = 1;
+    context->rendered.camera_x = context->camera.x;
+    context->rendered.camera_y = context->camera.y;
+    context->rendered.target_x = context->target.x;
+    context->rendered.target_y = context->target.y;
+    context->rendered.pattern_generation = context->pattern_generation;
+    context->rendered.render_stereo = context->gl.render_stereo;
+    context->rendered.apply_texture = context->gl.apply_texture;
+    trace_end();
+}
+
+/**
+ * Returns whether a context object is moving.
+ *
+ * @param object
+ *     The object.
+ * @return non-zero if the object is moving or accelerating
+ */
+static int
+context_object_is_moving(const struct context_object *object)
+{
+    return fabs(object->vx) > IDLE_EPSILON || fabs(object->vy) > IDLE_EPSILON
+        || fabs(object->ax) > IDLE_EPSILON || fabs(object->ay) > IDLE_EPSILON;
+}
+
+int
+context_is_dirty(const Context *context)
+{
+    /* The pattern only affects the output when it is displayed */
+    int pattern_visible = context->gl.render_stereo
+        || context->gl.apply_texture;
+
+    return !context->rendered.is_valid
+        || (pattern_visible && (context->stereo.update_pattern
+            || context->pattern_generation
+                != context->rendered.pattern_generation))
+        || context->gl.render_stereo != context->rendered.render_stereo
+        || context->gl.apply_texture != context->rendered.apply_texture
+        || fabs(context->camera.x - context->rendered.camera_x) > IDLE_EPSILON
+        || fabs(context->camera.y - context->rendered.camera_y) > IDLE_EPSILON
+        || fabs(context->target.x - context->rendered.target_x) > IDLE_EPSILON
+        || fabs(context->target.y - context->rendered.target_y) > IDLE_EPSILON
+        || context_object_is_moving(&context->camera)
+        || context_object_is_moving(&context->target)
+        || context_target_at_exit(context)
+        || context->maze.swarm != NULL;
+}
+
+void
+context_invalidate(Context *context)
+{
+    context->rendered.is_valid = 0;
+    context->stereo.sources.is_valid = 0;
+    if (context->stereo.reprojection) {
+        reprojection_invalidate(context->stereo.reprojection);
+    }
+}
+
+void
+context_camera_move(Context *context)
+{
+    context_object_target(&context->camera,
+        context->target.x, context->target.y, 0.7);
+    context_object_update_position(&context->camera);
+    context_object_update_speed(&context->camera, 0.1);
+}
+
+void
+context_swarm_move(Context *context)
+{
+    if (context->maze.swarm) {
+        maze_swarm_update(context->maze.swarm);
+    }
+}
+
+void
+context_target_accelerate_x(Context *context, double a)
 {
     context->target.ax = a;
 }
@@ -603,3 +1832,77 @@ context_target_move(Context *context)
         context->target.vx, context->target.vy, TARGET_MARGIN, TARGET_MARGIN);
     context_object_update_speed(&context->target, 0.2);
 }
+
+int
+context_target_at_exit(const Context *context)
+{
+    return (int)context->target.y == context->maze.data->height - 1
+        && context->target.x > context->maze.data->width - 0.5;
+}
+
+void
+context_autopilot(Context *context, double a)
+{
+    int x = (int)context->target.x;
+    int y = (int)context->target.y;
+    int next_x, next_y;
+    double dx, dy;
+
+    /* Leave through the exit door when in the exit room */
+    if (!maze_path_next(context->maze.path, context->maze.data, x, y,
+            &next_x, &next_y)) {
+        if (maze_path_distance(context->maze.path, x, y) == 0) {
+            next_x = x + 1;
+            next_y = y;
+        }
+        else {
+            context_target_accelerate_x(context, 0.0);
+            context_target_accelerate_y(context, 0.0);
+            return;
+        }
+    }
+
+    /* Move towards the next room, while keeping to the centre of the
+       corridor to avoid the corners */
+    dx = next_x - x;
+    dy = next_y - y;
+    if (dx == 0.0) {
+        dx = AUTOPILOT_CENTERING * (x + 0.5 - context->target.x);
+    }
+    if (dy == 0.0) {
+        dy = AUTOPILOT_CENTERING * (y + 0.5 - context->target.y);
+    }
+    context_target_accelerate_x(context, a * fmax(-1.0, fmin(1.0, dx)));
+    context_target_accelerate_y(context, a * fmax(-1.0, fmin(1.0, dy)));
+}
+
+int
+context_maze_next(Context *context)
+{
+    ContextMaze maze;
+
+    if (context->maze.next.is_running) {
+        /* Keep playing the current maze until the next one is complete */
+        if (!__atomic_load_n(&context->maze.next.is_ready, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+
+        pthread_join(context->maze.next.thread, NULL);
+        context->maze.next.is_running = 0;
+        maze = context->maze.next.maze;
+        if (!maze.data) {
+            /* Try again on a later frame */
+            context_maze_prefetch(context);
+            return 0;
+        }
+    }
+    else if (!context_maze_build(&maze, &context->maze.next.seed, 1)) {
+        return 0;
+    }
+
+    context_maze_install(context, &maze);
+    context_maze_prefetch(context);
+    context_invalidate(context);
+
+    return 1;
+}
@@ -1,6 +1,8 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <pthread.h>
+
 #include <GL/gl.h>
 
 #include <maze/maze.h>
@@ -9,6 +11,40 @@
 #include <effect.h>
 #include <stereo.h>
 
+#include "arena.h"
+#include "maze-height.h"
+#include "maze-mesh.h"
+#include "maze-path.h"
+#include "maze-swarm.h"
+#include "recording.h"
+#include "reprojection.h"
+#include "stereogram.h"
+
+/**
+ * A generated maze and the data derived from it.
+ *
+ * This is built without a context or OpenGL, so that it may be generated by
+ * a worker thread.
+ */
+typedef struct {
+    /** The maze data */
+    Maze *data;
+
+    /** The distance from every room to the exit */
+    MazePath *path;
+
+    /** The heightfield of the walls, or NULL if depth is not reprojected */
+    MazeHeight *height;
+
+    /** The closed walls of every room as cached by the swarm, or NULL if
+        there are no objects */
+    uint8_t *walls;
+
+    /** The mesh chunks around the entrance, or NULL if walls are not
+        merged */
+    MazeMeshPreload *preload;
+} ContextMaze;
+
 /**
  * The z-coordinate of the camera.
  */
@@ -19,6 +55,16 @@
  */
 #define TARGET_Z 0.7
 
+/**
+ * The radius of the target.
+ */
+#define TARGET_RADIUS 0.2
+
+/**
+ * The z-coordinate of the wandering objects.
+ */
+#define SWARM_Z 0.4
+
 /**
  * The properties of an object in 2D space.
  */
@@ -40,6 +86,37 @@ typedef struct {
     struct {
         /** The maze data */
         Maze *data;
+
+        /** The distance from every room to the exit */
+        MazePath *path;
+
+        /** The mesh renderer, if walls are merged */
+        MazeMesh *mesh;
+
+        /** The heightfield of the walls, if depth is reprojected */
+        MazeHeight *height;
+
+        /** The objects wandering the maze, if any */
+        MazeSwarm *swarm;
+
+        /**
+         * The next maze, generated by a worker thread while the current one
+         * is played.
+         */
+        struct {
+            /** The worker thread, and whether it has been started */
+            pthread_t thread;
+            int is_running;
+
+            /** Whether the worker thread has completed */
+            int is_ready;
+
+            /** The state of the random sequence of the worker thread */
+            unsigned int seed;
+
+            /** The generated maze; its data is NULL if generation failed */
+            ContextMaze maze;
+        } next;
     } maze;
 
     /**
@@ -55,10 +132,69 @@ typedef struct {
         /** The stereogram image */
         StereoImage *image;
 
+        /** The fused stereogram kernel, if it is used instead of
+            stereo_image_apply */
+        Stereogram *kernel;
+
+        /** The way in which the fused kernel generates images; this is
+            ignored if the number of threads is 0 */
+        StereogramTuning tuning;
+
         /** Whether to update the pattern for every frame */
         int update_pattern;
+
+        /** The file to which every stereogram generated is appended, if
+            any; context_free closes it if it is still open */
+        RecordingWriter *recording;
+
+        /** Estimates the depth of the scene from the last rendered frame,
+            if depth is reprojected, and the number of frames estimated since
+            that frame */
+        Reprojection *reprojection;
+        int reprojected;
+
+        /**
+         * The scene for which the fused kernel last recorded the sources of
+         * its pixels.
+         *
+         * While the camera and target stay there, a new image for an
+         * updated pattern is gathered through the sources instead of
+         * rendering and reading back the depth again.
+         */
+        struct {
+            /** Whether the sources have been recorded for the current
+                maze */
+            int is_valid;
+
+            /** The positions of the camera and target */
+            double camera_x, camera_y;
+            double target_x, target_y;
+        } sources;
     } stereo;
 
+    /**
+     * The memory backing the per-frame buffers.
+     *
+     * The z-buffer, stereogram image and pattern buffers are moved into a
+     * single arena when the context is initialised, so that no allocations
+     * take place while rendering. The buffers originally allocated by
+     * libstereo are kept here and restored before the objects are freed.
+     */
+    struct {
+        /** The arena holding the buffers */
+        Arena *arena;
+
+        /** The original z-buffer data and row offset */
+        void *zbuffer_data;
+        unsigned int zbuffer_rowoffset;
+
+        /** The original stereogram image pixels */
+        void *image_pixels;
+
+        /** The original pattern pixels */
+        void *pattern_pixels;
+    } memory;
+
     /**
      * Data used by OpenGL.
      */
@@ -69,11 +205,23 @@ typedef struct {
         /** The frame buffers used */
         GLuint framebuffers[1];
 
-        /** The render buffers used */
-        GLuint renderbuffers[1];
+        /** The textures used; the stereogram, the pattern and the depth
+            texture of the depth pass */
+        GLuint textures[3];
+
+        /** The primitive and occlusion queries of the depth pass */
+        GLuint queries[2];
+
+        /** The number of primitives generated and fragments passing the
+            depth test in the last depth pass */
+        GLuint depth_primitives, depth_fragments;
 
-        /** The textures used */
-        GLuint textures[2];
+        /** The pixel pack and unpack buffers used by the fused stereogram
+            kernel */
+        GLuint pixel_buffers[2];
+
+        /** The display list drawing the target as a unit sphere */
+        GLuint sphere_list;
 
         /** Whether to render a stereogram */
         int render_stereo;
@@ -81,8 +229,40 @@ typedef struct {
         /** Whether to apply the pattern as texture when using plain
             rendering */
         int apply_texture;
+
+        /** Whether the pattern texture has been uploaded, and the pattern
+            generation uploaded */
+        int pattern_uploaded;
+        unsigned int pattern_uploaded_generation;
     } gl;
 
+    /**
+     * The state of the scene when it was last rendered.
+     *
+     * This is used to skip rendering when nothing has changed since the
+     * previous frame.
+     */
+    struct {
+        /** Whether a frame has been rendered with the current values */
+        int is_valid;
+
+        /** The positions of the camera and target */
+        double camera_x, camera_y;
+        double target_x, target_y;
+
+        /** The pattern generation */
+        unsigned int pattern_generation;
+
+        /** The rendering toggles */
+        int render_stereo;
+        int apply_texture;
+    } rendered;
+
+    /**
+     * The number of times the pattern has been updated.
+     */
+    unsigned int pattern_generation;
+
     /**
      * The location of the camera.
      *
@@ -98,10 +278,59 @@ typedef struct {
     struct context_object target;
 } Context;
 
+/**
+ * Initialises the parts of a context that do not use OpenGL.
+ *
+ * The maze, stereogram and z-buffer fields are created, and their buffers are
+ * moved into an arena; see context_buffers_bind.
+ *
+ * The maze, the pattern and the fused stereogram kernel are generated on
+ * separate threads, which are joined before this function returns.
+ *
+ * This function may be called on any thread, so that the context is prepared
+ * while OpenGL is being initialised. context_initialize_gl must then be
+ * called to complete the initialisation.
+ *
+ * If this function and context_initialize_gl complete sucessfully,
+ * context_free must be called.
+ *
+ * @param context
+ *     The context to initialise. This must have been zeroed, except for the
+ *     tuning of the fused kernel, which may be set.
+ * @param image_width, image_height
+ *     The dimensions of the stereogram image.
+ * @param pattern_base
+ *     The background pattern for the stereogram. If this function returns
+ *     non-zero, ownership of this pattern is assumed by the context, and it
+ *     should not be freed.
+ * @return non-zero upon success and 0 otherwise
+ * @see context_initialize_gl
+ */
+int
+context_prepare(Context *context,
+    unsigned int image_width, unsigned int image_height,
+    StereoPattern *pattern_base);
+
+/**
+ * Creates the OpenGL objects of a context prepared by context_prepare.
+ *
+ * This must be called on the thread owning the OpenGL context.
+ *
+ * @param context
+ *     The prepared context.
+ * @param screen_width, screen_height
+ *     The dimensions of the screen.
+ * @return non-zero upon success and 0 otherwise
+ * @see context_free
+ */
+int
+context_initialize_gl(Context *context,
+    unsigned int screen_width, unsigned int screen_height);
+
 /**
  * Initialises a context.
  *
- * The maze, stereogram and z-buffer fields are created.
+ * This calls context_prepare and then context_initialize_gl.
  *
  * If this function completes sucessfully, context_free must be called.
  *
@@ -124,6 +353,41 @@ context_initialize(Context *context,
     unsigned int screen_width, unsigned int screen_height,
     StereoPattern *pattern_base);
 
+/**
+ * Moves the z-buffer, stereogram image and pattern buffers into an arena.
+ *
+ * Rows of the z-buffer are aligned to ARENA_ALIGNMENT and padded to a
+ * multiple of it, so the row offset of the z-buffer may be larger than its
+ * width after this call. The image and pattern buffers are aligned to
+ * ARENA_ALIGNMENT, but their rows are packed since libstereo does not support
+ * a row offset for them.
+ *
+ * If the context already has an arena large enough for the buffers, it is
+ * reused; this function may thus be called again after the stereogram objects
+ * have been recreated for a new resolution. If the buffers are still bound,
+ * they are first restored with their content, as if context_buffers_unbind
+ * had been called.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero upon success and 0 otherwise
+ * @see context_buffers_unbind
+ */
+int
+context_buffers_bind(Context *context);
+
+/**
+ * Restores the buffers originally allocated by libstereo.
+ *
+ * This must be called before the z-buffer, stereogram image or pattern is
+ * freed. The arena is kept for reuse by context_buffers_bind.
+ *
+ * @param context
+ *     The context.
+ */
+void
+context_buffers_unbind(Context *context);
+
 /**
  * Releases a previously created context.
  *
@@ -142,6 +406,31 @@ context_free(Context *context);
 void
 context_render(Context *context);
 
+/**
+ * Returns whether the scene must be rendered.
+ *
+ * A scene is dirty if it has never been rendered, if it has been invalidated,
+ * if the pattern or any rendering toggle has changed since the last frame,
+ * if the camera or target has moved, or is about to move, more than a
+ * negligible distance, if the target is at the exit waiting for the next
+ * maze, or if objects are wandering the maze.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the scene must be rendered and 0 otherwise
+ */
+int
+context_is_dirty(const Context *context);
+
+/**
+ * Forces the scene to be rendered in the next frame.
+ *
+ * @param context
+ *     The context.
+ */
+void
+context_invalidate(Context *context);
+
 /**
  * Moves the camera towards the target.
  *
@@ -151,6 +440,15 @@ context_render(Context *context);
 void
 context_camera_move(Context *context);
 
+/**
+ * Moves the objects wandering the maze.
+ *
+ * @param context
+ *     The context.
+ */
+void
+context_swarm_move(Context *context);
+
 /**
  * Updates the horizontal acceleration of the context target.
  *
@@ -184,4 +482,45 @@ context_target_accelerate_y(Context *context, double a);
 void
 context_target_move(Context *context);
 
+/**
+ * Returns whether the target has reached the exit of the maze.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the target is at the exit door and 0 otherwise
+ */
+int
+context_target_at_exit(const Context *context);
+
+/**
+ * Steers the target along the shortest path to the exit.
+ *
+ * This function updates the acceleration of the target, and should be called
+ * once for every frame.
+ *
+ * @param context
+ *     The context whose target to steer.
+ * @param a
+ *     The acceleration.
+ */
+void
+context_autopilot(Context *context, double a);
+
+/**
+ * Replaces the maze with a newly generated one.
+ *
+ * The camera and target are moved to the entrance of the new maze.
+ *
+ * The next maze is generated in the background while the current one is
+ * played, so this function only swaps it in. If it is not yet complete,
+ * nothing happens, and this function should be called again for a later
+ * frame.
+ *
+ * @param context
+ *     The context.
+ * @return non-zero if the maze was replaced and 0 otherwise
+ */
+int
+context_maze_next(Context *context);
+
 #endif
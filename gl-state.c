@@ -0,0 +1,605 @@
+#include <string.h>
+
+#include "gl-state.h"
+
+/* The maximum number of textures whose state is tracked */
+#define TEXTURE_COUNT 8
+
+/* The value of a cached integer whose state is unknown */
+#define UNKNOWN -1
+
+/* The capabilities tracked */
+static const GLenum capabilities[] = {
+    GL_COLOR_MATERIAL,
+    GL_CULL_FACE,
+    GL_DEPTH_TEST,
+    GL_LIGHT0,
+    GL_LIGHTING,
+    GL_TEXTURE_2D};
+#define CAPABILITY_COUNT (sizeof(capabilities) / sizeof(GLenum))
+
+/* The light and material parameters tracked */
+static const GLenum light_parameters[] = {
+    GL_POSITION,
+    GL_AMBIENT,
+    GL_DIFFUSE,
+    GL_SPECULAR};
+#define LIGHT_PARAMETER_COUNT (sizeof(light_parameters) / sizeof(GLenum))
+static const GLenum material_parameters[] = {
+    GL_EMISSION,
+    GL_DIFFUSE,
+    GL_SPECULAR};
+#define MATERIAL_PARAMETER_COUNT (sizeof(material_parameters) / sizeof(GLenum))
+
+/* The buffer targets tracked */
+static const GLenum buffer_targets[] = {
+    GL_ARRAY_BUFFER,
+    GL_PIXEL_PACK_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER};
+#define BUFFER_TARGET_COUNT (sizeof(buffer_targets) / sizeof(GLenum))
+
+/**
+ * The cached state of a texture.
+ */
+struct texture_state {
+    /** The texture name, or 0 if this slot is unused */
+    GLuint name;
+
+    /** The filters */
+    GLint mag_filter, min_filter;
+
+    /** Whether storage has been specified, and its size and format */
+    int has_storage;
+    GLint internal_format;
+    GLsizei width, height;
+    GLenum format, type;
+};
+
+/**
+ * The cached OpenGL state.
+ */
+static struct {
+    /** The state of the capabilities; UNKNOWN, 0 or 1 */
+    int capabilities[CAPABILITY_COUNT];
+
+    /** Whether colours are written; UNKNOWN, 0 or 1 */
+    int color_mask;
+
+    /** The depth clear value, and whether it is known */
+    GLclampd clear_depth;
+    int clear_depth_known;
+
+    /** The viewport, and whether it is known */
+    GLint viewport[4];
+    int viewport_known;
+
+    /** The bound objects, and whether they are known */
+    GLuint framebuffer, renderbuffer;
+    int framebuffer_known, renderbuffer_known;
+
+    /** The buffers bound to the targets in buffer_targets, and whether they
+        are known */
+    GLuint buffers[BUFFER_TARGET_COUNT];
+    int buffers_known[BUFFER_TARGET_COUNT];
+
+    /** The texture states, and the index of the bound one; UNKNOWN if no
+        tracked texture is bound */
+    struct texture_state textures[TEXTURE_COUNT];
+    int texture;
+
+    /** The pixel storage modes */
+    GLint pack_alignment, pack_row_length;
+    GLint unpack_alignment, unpack_row_length;
+
+    /** The texture environment mode */
+    GLint tex_env_mode;
+
+    /** The light and material parameters, and whether they are known */
+    GLfloat light[LIGHT_PARAMETER_COUNT][4];
+    int light_known[LIGHT_PARAMETER_COUNT];
+    GLfloat material[MATERIAL_PARAMETER_COUNT][4];
+    int material_known[MATERIAL_PARAMETER_COUNT];
+
+    /** The counters of the current and last frame */
+    GLStateCounters current, last;
+} state = {
+    .capabilities = {UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN},
+    .color_mask = UNKNOWN,
+    .texture = UNKNOWN,
+    .pack_alignment = UNKNOWN,
+    .pack_row_length = UNKNOWN,
+    .unpack_alignment = UNKNOWN,
+    .unpack_row_length = UNKNOWN,
+    .tex_env_mode = UNKNOWN};
+
+/**
+ * Returns the index of a value in a list.
+ *
+ * @param list
+ *     The list.
+ * @param count
+ *     The number of items in the list.
+ * @param value
+ *     The value to find.
+ * @return the index, or UNKNOWN if the value is not in the list
+ */
+static int
+gl_state_index(const GLenum *list, int count, GLenum value)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (list[i] == value) {
+            return i;
+        }
+    }
+
+    return UNKNOWN;
+}
+
+/**
+ * Returns the size of a pixel.
+ *
+ * @param format, type
+ *     The format and type of the pixel data.
+ * @return the number of bytes per pixel
+ */
+static unsigned long
+gl_state_pixel_size(GLenum format, GLenum type)
+{
+    int components;
+
+    switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_24_8:
+        return 4;
+    }
+
+    switch (format) {
+    case GL_RGBA:
+    case GL_BGRA:
+        components = 4;
+        break;
+
+    case GL_RGB:
+    case GL_BGR:
+        components = 3;
+        break;
+
+    case GL_LUMINANCE_ALPHA:
+        components = 2;
+        break;
+
+    default:
+        components = 1;
+        break;
+    }
+
+    switch (type) {
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+        return 2 * components;
+
+    case GL_UNSIGNED_INT:
+    case GL_INT:
+    case GL_FLOAT:
+        return 4 * components;
+
+    default:
+        return components;
+    }
+}
+
+void
+gl_state_reset(void)
+{
+    int i;
+
+    for (i = 0; i < CAPABILITY_COUNT; i++) {
+        state.capabilities[i] = UNKNOWN;
+    }
+    state.color_mask = UNKNOWN;
+    state.clear_depth_known = 0;
+    state.viewport_known = 0;
+    state.framebuffer_known = 0;
+    state.renderbuffer_known = 0;
+    memset(state.buffers_known, 0, sizeof(state.buffers_known));
+    memset(state.textures, 0, sizeof(state.textures));
+    state.texture = UNKNOWN;
+    state.pack_alignment = UNKNOWN;
+    state.pack_row_length = UNKNOWN;
+    state.unpack_alignment = UNKNOWN;
+    state.unpack_row_length = UNKNOWN;
+    state.tex_env_mode = UNKNOWN;
+    memset(state.light_known, 0, sizeof(state.light_known));
+    memset(state.material_known, 0, sizeof(state.material_known));
+}
+
+void
+gl_state_frame(void)
+{
+    state.last = state.current;
+    memset(&state.current, 0, sizeof(state.current));
+}
+
+GLStateCounters
+gl_state_counters(void)
+{
+    return state.last;
+}
+
+void
+gl_state_enable(GLenum cap, int enable)
+{
+    int index = gl_state_index(capabilities, CAPABILITY_COUNT, cap);
+
+    enable = !!enable;
+    if (index != UNKNOWN && state.capabilities[index] == enable) {
+        state.current.redundant++;
+        return;
+    }
+
+    if (enable) {
+        glEnable(cap);
+    }
+    else {
+        glDisable(cap);
+    }
+    state.current.calls++;
+
+    if (index != UNKNOWN) {
+        state.capabilities[index] = enable;
+    }
+}
+
+void
+gl_state_color_mask(int enable)
+{
+    enable = !!enable;
+    if (state.color_mask == enable) {
+        state.current.redundant++;
+        return;
+    }
+
+    glColorMask(enable, enable, enable, enable);
+    state.current.calls++;
+
+    state.color_mask = enable;
+}
+
+void
+gl_state_clear_depth(GLclampd depth)
+{
+    if (state.clear_depth_known && state.clear_depth == depth) {
+        state.current.redundant++;
+        return;
+    }
+
+    glClearDepth(depth);
+    state.current.calls++;
+
+    state.clear_depth = depth;
+    state.clear_depth_known = 1;
+}
+
+void
+gl_state_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (state.viewport_known
+            && state.viewport[0] == x && state.viewport[1] == y
+            && state.viewport[2] == width && state.viewport[3] == height) {
+        state.current.redundant++;
+        return;
+    }
+
+    glViewport(x, y, width, height);
+    state.current.calls++;
+
+    state.viewport[0] = x;
+    state.viewport[1] = y;
+    state.viewport[2] = width;
+    state.viewport[3] = height;
+    state.viewport_known = 1;
+}
+
+void
+gl_state_get_viewport(GLint viewport[4])
+{
+    if (!state.viewport_known) {
+        glGetIntegerv(GL_VIEWPORT, state.viewport);
+        state.current.calls++;
+        state.viewport_known = 1;
+    }
+
+    memcpy(viewport, state.viewport, sizeof(state.viewport));
+}
+
+void
+gl_state_bind_texture(GLuint texture)
+{
+    int i, free_slot = UNKNOWN;
+
+    if (state.texture != UNKNOWN
+            && state.textures[state.texture].name == texture) {
+        state.current.redundant++;
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    state.current.calls++;
+    state.current.binds++;
+
+    /* Find the texture state, or allocate a new one */
+    state.texture = UNKNOWN;
+    if (!texture) {
+        return;
+    }
+    for (i = 0; i < TEXTURE_COUNT; i++) {
+        if (state.textures[i].name == texture) {
+            state.texture = i;
+            return;
+        }
+        else if (!state.textures[i].name && free_slot == UNKNOWN) {
+            free_slot = i;
+        }
+    }
+    if (free_slot != UNKNOWN) {
+        memset(&state.textures[free_slot], 0, sizeof(struct texture_state));
+        state.textures[free_slot].name = texture;
+        state.textures[free_slot].mag_filter = UNKNOWN;
+        state.textures[free_slot].min_filter = UNKNOWN;
+        state.texture = free_slot;
+    }
+}
+
+void
+gl_state_bind_framebuffer(GLuint framebuffer)
+{
+    if (state.framebuffer_known && state.framebuffer == framebuffer) {
+        state.current.redundant++;
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state.current.calls++;
+    state.current.binds++;
+
+    state.framebuffer = framebuffer;
+    state.framebuffer_known = 1;
+}
+
+void
+gl_state_bind_renderbuffer(GLuint renderbuffer)
+{
+    if (state.renderbuffer_known && state.renderbuffer == renderbuffer) {
+        state.current.redundant++;
+        return;
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    state.current.calls++;
+    state.current.binds++;
+
+    state.renderbuffer = renderbuffer;
+    state.renderbuffer_known = 1;
+}
+
+void
+gl_state_bind_buffer(GLenum target, GLuint buffer)
+{
+    int index = gl_state_index(buffer_targets, BUFFER_TARGET_COUNT, target);
+
+    if (index != UNKNOWN && state.buffers_known[index]
+            && state.buffers[index] == buffer) {
+        state.current.redundant++;
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    state.current.calls++;
+    state.current.binds++;
+
+    if (index != UNKNOWN) {
+        state.buffers[index] = buffer;
+        state.buffers_known[index] = 1;
+    }
+}
+
+void
+gl_state_buffer_data(GLenum target, GLsizeiptr size, const GLvoid *data,
+    GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+    state.current.calls++;
+    if (data) {
+        state.current.bytes_uploaded += size;
+    }
+}
+
+void
+gl_state_pixel_store(GLenum pname, GLint param)
+{
+    GLint *cached;
+
+    switch (pname) {
+    case GL_PACK_ALIGNMENT:
+        cached = &state.pack_alignment;
+        break;
+
+    case GL_PACK_ROW_LENGTH:
+        cached = &state.pack_row_length;
+        break;
+
+    case GL_UNPACK_ALIGNMENT:
+        cached = &state.unpack_alignment;
+        break;
+
+    case GL_UNPACK_ROW_LENGTH:
+        cached = &state.unpack_row_length;
+        break;
+
+    default:
+        cached = NULL;
+        break;
+    }
+
+    if (cached && *cached == param) {
+        state.current.redundant++;
+        return;
+    }
+
+    glPixelStorei(pname, param);
+    state.current.calls++;
+
+    if (cached) {
+        *cached = param;
+    }
+}
+
+void
+gl_state_tex_env_mode(GLint mode)
+{
+    if (state.tex_env_mode == mode) {
+        state.current.redundant++;
+        return;
+    }
+
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, mode);
+    state.current.calls++;
+
+    state.tex_env_mode = mode;
+}
+
+void
+gl_state_tex_filter(GLint mag_filter, GLint min_filter)
+{
+    struct texture_state *texture = state.texture != UNKNOWN
+        ? &state.textures[state.texture]
+        : NULL;
+
+    if (texture && texture->mag_filter == mag_filter) {
+        state.current.redundant++;
+    }
+    else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+        state.current.calls++;
+    }
+
+    if (texture && texture->min_filter == min_filter) {
+        state.current.redundant++;
+    }
+    else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+        state.current.calls++;
+    }
+
+    if (texture) {
+        texture->mag_filter = mag_filter;
+        texture->min_filter = min_filter;
+    }
+}
+
+void
+gl_state_tex_image(GLint internal_format, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const GLvoid *pixels)
+{
+    struct texture_state *texture = state.texture != UNKNOWN
+        ? &state.textures[state.texture]
+        : NULL;
+
+    /* Reuse the storage if possible */
+    if (texture && texture->has_storage
+            && texture->internal_format == internal_format
+            && texture->width == width && texture->height == height
+            && texture->format == format && texture->type == type) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type,
+            pixels);
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+            format, type, pixels);
+    }
+    state.current.calls++;
+    state.current.bytes_uploaded += (unsigned long)width * height
+        * gl_state_pixel_size(format, type);
+
+    if (texture) {
+        texture->has_storage = 1;
+        texture->internal_format = internal_format;
+        texture->width = width;
+        texture->height = height;
+        texture->format = format;
+        texture->type = type;
+    }
+}
+
+void
+gl_state_tex_sub_image(GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const GLvoid *pixels)
+{
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, type,
+        pixels);
+    state.current.calls++;
+    state.current.bytes_uploaded += (unsigned long)width * height
+        * gl_state_pixel_size(format, type);
+}
+
+void
+gl_state_read_pixels(GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, GLvoid *pixels)
+{
+    glReadPixels(x, y, width, height, format, type, pixels);
+    state.current.calls++;
+    state.current.bytes_read += (unsigned long)width * height
+        * gl_state_pixel_size(format, type);
+}
+
+void
+gl_state_light(GLenum pname, const GLfloat *params)
+{
+    int index = gl_state_index(light_parameters, LIGHT_PARAMETER_COUNT,
+        pname);
+
+    if (index != UNKNOWN && state.light_known[index]
+            && memcmp(state.light[index], params, sizeof(state.light[index]))
+                == 0) {
+        state.current.redundant++;
+        return;
+    }
+
+    glLightfv(GL_LIGHT0, pname, params);
+    state.current.calls++;
+
+    if (index != UNKNOWN) {
+        memcpy(state.light[index], params, sizeof(state.light[index]));
+        state.light_known[index] = 1;
+    }
+}
+
+void
+gl_state_material(GLenum pname, const GLfloat *params)
+{
+    int index = gl_state_index(material_parameters, MATERIAL_PARAMETER_COUNT,
+        pname);
+
+    if (index != UNKNOWN && state.material_known[index]
+            && memcmp(state.material[index], params,
+                sizeof(state.material[index])) == 0) {
+        state.current.redundant++;
+        return;
+    }
+
+    glMaterialfv(GL_FRONT_AND_BACK, pname, params);
+    state.current.calls++;
+
+    if (index != UNKNOWN) {
+        memcpy(state.material[index], params, sizeof(state.material[index]));
+        state.material_known[index] = 1;
+    }
+}
@@ -0,0 +1,237 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/gl.h>
+
+/**
+ * Counters for the calls made through the state tracker.
+ */
+typedef struct {
+    /** The number of calls passed on to OpenGL */
+    unsigned long calls;
+
+    /** The number of calls not passed on since they would not change the
+        state */
+    unsigned long redundant;
+
+    /** The number of texture, framebuffer and renderbuffer binds */
+    unsigned long binds;
+
+    /** The number of bytes uploaded to textures */
+    unsigned long bytes_uploaded;
+
+    /** The number of bytes read back from OpenGL */
+    unsigned long bytes_read;
+} GLStateCounters;
+
+/**
+ * Forgets all cached state.
+ *
+ * This must be called whenever OpenGL state has been modified without using
+ * the state tracker, and when objects have been deleted.
+ */
+void
+gl_state_reset(void);
+
+/**
+ * Marks the end of a frame.
+ *
+ * The counters for the current frame are made available through
+ * gl_state_counters and then cleared.
+ */
+void
+gl_state_frame(void);
+
+/**
+ * Retrieves the counters for the last completed frame.
+ *
+ * @return the counters
+ */
+GLStateCounters
+gl_state_counters(void);
+
+/**
+ * Enables or disables a capability.
+ *
+ * @param cap
+ *     The capability.
+ * @param enable
+ *     Whether to enable the capability.
+ * @see glEnable
+ */
+void
+gl_state_enable(GLenum cap, int enable);
+
+/**
+ * Enables or disables writing to all colour components.
+ *
+ * @param enable
+ *     Whether to write colours.
+ * @see glColorMask
+ */
+void
+gl_state_color_mask(int enable);
+
+/**
+ * Sets the value to which glClear clears the depth buffer.
+ *
+ * @see glClearDepth
+ */
+void
+gl_state_clear_depth(GLclampd depth);
+
+/**
+ * Sets the viewport.
+ *
+ * @see glViewport
+ */
+void
+gl_state_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+/**
+ * Retrieves the viewport without querying OpenGL.
+ *
+ * @param viewport
+ *     The x, y, width and height of the viewport.
+ */
+void
+gl_state_get_viewport(GLint viewport[4]);
+
+/**
+ * Binds a texture to GL_TEXTURE_2D.
+ *
+ * @see glBindTexture
+ */
+void
+gl_state_bind_texture(GLuint texture);
+
+/**
+ * Binds a framebuffer to GL_FRAMEBUFFER.
+ *
+ * @see glBindFramebuffer
+ */
+void
+gl_state_bind_framebuffer(GLuint framebuffer);
+
+/**
+ * Binds a renderbuffer to GL_RENDERBUFFER.
+ *
+ * @see glBindRenderbuffer
+ */
+void
+gl_state_bind_renderbuffer(GLuint renderbuffer);
+
+/**
+ * Binds a buffer.
+ *
+ * @param target
+ *     The target; one of GL_ARRAY_BUFFER, GL_PIXEL_PACK_BUFFER and
+ *     GL_PIXEL_UNPACK_BUFFER.
+ * @param buffer
+ *     The buffer.
+ * @see glBindBuffer
+ */
+void
+gl_state_bind_buffer(GLenum target, GLuint buffer);
+
+/**
+ * Specifies the data of the buffer bound to a target.
+ *
+ * If data is not NULL, its size is counted as uploaded.
+ *
+ * @see glBufferData
+ */
+void
+gl_state_buffer_data(GLenum target, GLsizeiptr size, const GLvoid *data,
+    GLenum usage);
+
+/**
+ * Sets a pixel storage mode.
+ *
+ * Only GL_PACK_ALIGNMENT, GL_PACK_ROW_LENGTH, GL_UNPACK_ALIGNMENT and
+ * GL_UNPACK_ROW_LENGTH are cached; other modes are always passed on.
+ *
+ * @see glPixelStorei
+ */
+void
+gl_state_pixel_store(GLenum pname, GLint param);
+
+/**
+ * Sets the texture environment mode.
+ *
+ * @see glTexEnvi
+ */
+void
+gl_state_tex_env_mode(GLint mode);
+
+/**
+ * Sets the filters of the currently bound texture.
+ *
+ * @param mag_filter, min_filter
+ *     The magnification and minification filters.
+ * @see glTexParameteri
+ */
+void
+gl_state_tex_filter(GLint mag_filter, GLint min_filter);
+
+/**
+ * Uploads an image to the currently bound texture.
+ *
+ * If the texture already has storage of the same size and format, the
+ * storage is reused with glTexSubImage2D.
+ *
+ * @see glTexImage2D
+ */
+void
+gl_state_tex_image(GLint internal_format, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const GLvoid *pixels);
+
+/**
+ * Uploads part of an image to the currently bound texture, which must already
+ * have storage.
+ *
+ * @see glTexSubImage2D
+ */
+void
+gl_state_tex_sub_image(GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const GLvoid *pixels);
+
+/**
+ * Reads pixels from the current framebuffer.
+ *
+ * @see glReadPixels
+ */
+void
+gl_state_read_pixels(GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, GLvoid *pixels);
+
+/**
+ * Sets a parameter of GL_LIGHT0.
+ *
+ * The light position is transformed by the modelview matrix when set, so
+ * the matrix must be the same every time GL_POSITION is set through this
+ * function.
+ *
+ * @param pname
+ *     The parameter; one of GL_POSITION, GL_AMBIENT, GL_DIFFUSE and
+ *     GL_SPECULAR.
+ * @param params
+ *     The four values of the parameter.
+ * @see glLightfv
+ */
+void
+gl_state_light(GLenum pname, const GLfloat *params);
+
+/**
+ * Sets a material parameter for GL_FRONT_AND_BACK.
+ *
+ * @param pname
+ *     The parameter; one of GL_EMISSION, GL_DIFFUSE and GL_SPECULAR.
+ * @param params
+ *     The four values of the parameter.
+ * @see glMaterialfv
+ */
+void
+gl_state_material(GLenum pname, const GLfloat *params);
+
+#endif
@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,7 +9,13 @@
     #include <SDL.h>
 #endif
 
+#include "autotune.h"
+#include "batch.h"
 #include "context.h"
+#include "gl-state.h"
+#include "metrics.h"
+#include "playback.h"
+#include "trace.h"
 
 #include "arguments/arguments.h"
 
@@ -51,10 +59,41 @@
  */
 static int prevent_flooding = 0;
 
+/**
+ * The timer generating display events.
+ *
+ * This is NULL while the timer is suspended because the scene is idle.
+ */
+static SDL_TimerID timer = NULL;
+
+/**
+ * Whether a display event has been queued but not yet handled.
+ *
+ * This is set by the timer thread and cleared by the main thread.
+ */
+static int display_pending = 0;
+
+/**
+ * The time of the earliest input event that has not yet affected the target.
+ *
+ * This is 0 if there is no such event.
+ */
+static uint64_t input_time = 0;
+
+/**
+ * The time of the earliest input event that has affected the target, but not
+ * yet been rendered.
+ *
+ * This is 0 if there is no such event.
+ */
+static uint64_t input_applied_time = 0;
+
 /**
  * The timer callback function.
  *
  * This function pushes an event to SDL to make it execute in the main thread.
+ * If the previous display event has not yet been handled, no new event is
+ * pushed, so that a slow frame does not cause a backlog of display events.
  *
  * @param interval
  *     The timer interval.
@@ -72,14 +111,86 @@ do_timer(Uint32 interval, void *dummy)
     event.user.data1 = NULL;
     event.user.data2 = NULL;
 
-    SDL_PushEvent(&event);
+    trace_thread_name("timer");
+    if (__atomic_exchange_n(&display_pending, 1, __ATOMIC_ACQ_REL)) {
+        metrics_add(METRICS_TIMER_EVENTS_COALESCED, 1);
+        trace_instant("display event coalesced");
+    }
+    else if (SDL_PushEvent(&event) == 0) {
+        metrics_add(METRICS_TIMER_EVENTS_QUEUED, 1);
+        trace_instant("display event queued");
+    }
+    else {
+        __atomic_store_n(&display_pending, 0, __ATOMIC_RELEASE);
+    }
 
     return interval;
 }
 
+/**
+ * Starts the display timer if it has been suspended.
+ *
+ * @return non-zero if the timer is running and 0 otherwise
+ */
+static int
+timer_resume(void)
+{
+    if (!timer) {
+        timer = SDL_AddTimer(TIMER_INTERVAL, do_timer, NULL);
+    }
+
+    return timer != NULL;
+}
+
+/**
+ * Stops the display timer until timer_resume is called.
+ */
+static void
+timer_suspend(void)
+{
+    if (timer) {
+        SDL_RemoveTimer(timer);
+        timer = NULL;
+    }
+}
+
+/**
+ * Moves the target and the camera.
+ *
+ * Any pending input is considered applied once the target has moved.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+do_move(Context *context)
+{
+    context_target_move(context);
+    context_camera_move(context);
+    context_swarm_move(context);
+
+    if (input_time) {
+        if (!input_applied_time) {
+            input_applied_time = input_time;
+        }
+        input_time = 0;
+    }
+
+    /* Start over in a new maze when the exit has been found */
+    if (context_target_at_exit(context)) {
+        context_maze_next(context);
+    }
+}
+
 /**
  * Updates the display.
  *
+ * If nothing in the scene has changed since the previous frame, nothing is
+ * rendered and the timer is suspended until the next input event.
+ *
+ * Unless late latching is enabled, the target and camera are moved after
+ * rendering, so the effect of input is displayed one frame later.
+ *
  * @param context
  *     The context.
  */
@@ -88,21 +199,126 @@ do_display(Context *context)
 {
     static Uint32 last_ticks = 0;
     Uint32 current_ticks = SDL_GetTicks();
+    uint64_t start = metrics_now();
+    uint64_t rendered_input_time = 0;
+    GLStateCounters counters;
+
+    /* Do nothing if the previous frame is still valid */
+    if (!context_is_dirty(context)) {
+        timer_suspend();
+        last_ticks = 0;
+        metrics_add(METRICS_FRAMES_IDLE, 1);
+        trace_instant("idle");
+        return;
+    }
+
+    trace_begin("do_display");
+
     glLoadIdentity();
 
+    /* Let the autopilot steer before the target is moved */
+    if (ARGUMENT_VALUE(autopilot)) {
+        context_autopilot(context, ACCELERATION);
+    }
+
+    /* Move the target and camera just before rendering if late latching */
+    if (ARGUMENT_VALUE(late_latch)) {
+        do_move(context);
+    }
+
     /* Render the context if we have not missed the render window */
     if (!prevent_flooding || !last_ticks
             || current_ticks - last_ticks < TIMER_INTERVAL + TIMER_MARGIN) {
         context_render(context);
+        metrics_add(METRICS_FRAMES_RENDERED, 1);
+        rendered_input_time = input_applied_time;
+        input_applied_time = 0;
+    }
+    else {
+        metrics_add(METRICS_FRAMES_SKIPPED, 1);
+        trace_instant("frame skipped");
     }
     last_ticks = current_ticks;
 
-    /* Update the target and camera */
-    context_target_move(context);
-    context_camera_move(context);
+    /* Update the target and camera for the next frame */
+    if (!ARGUMENT_VALUE(late_latch)) {
+        do_move(context);
+    }
 
     /* Render to screen */
+    trace_begin("SDL_GL_SwapBuffers");
+    uint64_t swap_start = metrics_now();
     SDL_GL_SwapBuffers();
+    metrics_observe(METRICS_STAGE_SWAP, swap_start);
+    trace_end();
+    metrics_observe(METRICS_STAGE_FRAME, start);
+    if (rendered_input_time) {
+        metrics_observe(METRICS_STAGE_INPUT, rendered_input_time);
+        trace_instant("input displayed");
+    }
+
+    /* Close the counters of this frame and publish them */
+    gl_state_frame();
+    counters = gl_state_counters();
+    metrics_add(METRICS_BYTES_UPLOADED, counters.bytes_uploaded);
+    metrics_add(METRICS_BYTES_READ, counters.bytes_read);
+    metrics_set(METRICS_MODE_RENDER_STEREO, context->gl.render_stereo);
+    metrics_set(METRICS_MODE_APPLY_TEXTURE, context->gl.apply_texture);
+    metrics_set(METRICS_MODE_UPDATE_PATTERN, context->stereo.update_pattern);
+    metrics_set(METRICS_MODE_PREVENT_FLOODING, prevent_flooding);
+    trace_end();
+}
+
+/**
+ * Prints the OpenGL, depth pass and maze geometry counters for the last
+ * frame.
+ *
+ * @param context
+ *     The context.
+ */
+static void
+print_stats(const Context *context)
+{
+    GLStateCounters counters = gl_state_counters();
+
+    printf("GL calls: %lu, redundant calls filtered: %lu, binds: %lu, "
+        "bytes uploaded: %lu, bytes read: %lu\n",
+        counters.calls, counters.redundant, counters.binds,
+        counters.bytes_uploaded, counters.bytes_read);
+
+    if (context->gl.render_stereo) {
+        printf("Depth pass primitives: %u, fragments: %u\n",
+            context->gl.depth_primitives, context->gl.depth_fragments);
+    }
+
+    if (context->maze.mesh) {
+        MazeMeshCounters mesh = maze_mesh_counters(context->maze.mesh);
+
+        printf("Maze triangles: %lu, unmerged: %lu, chunks: %lu, "
+            "chunks built: %lu\n",
+            mesh.triangles, mesh.triangles_unmerged, mesh.chunks,
+            mesh.chunks_built);
+    }
+}
+
+/**
+ * Writes the recorded trace events to the trace file, if one was specified.
+ */
+static void
+trace_save(void)
+{
+    const char *path = ARGUMENT_VALUE(trace_file);
+
+    if (!path) {
+        return;
+    }
+
+    if (trace_dump(path)) {
+        printf("Trace written to %s\n", path);
+    }
+    else {
+        printf("Unable to write trace to %s\n", path);
+    }
 }
 
 /**
@@ -116,21 +332,54 @@ handle_events(Context *context)
     SDL_Event event;
 
     while (SDL_WaitEvent(&event)) {
+        trace_begin("handle_events");
+
+        /* Any input may change the scene, so make sure the timer runs */
+        switch (event.type) {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+        case SDL_JOYAXISMOTION:
+            if (!input_time) {
+                input_time = metrics_now();
+                trace_instant("input");
+            }
+            timer_resume();
+            break;
+
+        case SDL_VIDEOEXPOSE:
+            timer_resume();
+            break;
+
+        /* Prevent compiler warning */
+        default: break;
+        }
+
         switch (event.type) {
         /* Exit if the window is closed */
         case SDL_QUIT:
+            trace_end();
             return 0;
 
+        /* Redraw the scene if the window contents were lost */
+        case SDL_VIDEOEXPOSE:
+            context_invalidate(context);
+            break;
+
         /* Check for keypresses */
         case SDL_KEYDOWN:
             switch (event.key.keysym.sym) {
             case SDLK_ESCAPE:
+                trace_end();
                 return 0;
 
             case SDLK_SPACE:
                 context->gl.render_stereo = !context->gl.render_stereo;
                 break;
 
+            case SDLK_d:
+                trace_save();
+                break;
+
             case SDLK_f:
                 prevent_flooding = !prevent_flooding;
                 break;
@@ -140,6 +389,10 @@ handle_events(Context *context)
                     !context->stereo.update_pattern;
                 break;
 
+            case SDLK_s:
+                print_stats(context);
+                break;
+
             case SDLK_t:
                 context->gl.apply_texture = !context->gl.apply_texture;
                 break;
@@ -213,6 +466,7 @@ handle_events(Context *context)
         case SDL_USEREVENT:
             switch (event.user.code) {
             case USER_EVENT_DISPLAY:
+                __atomic_store_n(&display_pending, 0, __ATOMIC_RELEASE);
                 do_display(context);
                 break;
 
@@ -223,6 +477,131 @@ handle_events(Context *context)
         /* Prevent compiler warning */
         default: break;
         }
+
+        trace_end();
+    }
+
+    return 1;
+}
+
+/**
+ * Displays the next frame of a recording.
+ *
+ * @param playback
+ *     The player.
+ * @return non-zero upon success and 0 if the recording is corrupt
+ */
+static int
+do_playback_display(Playback *playback)
+{
+    uint64_t start = metrics_now();
+    GLStateCounters counters;
+    int result;
+
+    trace_begin("do_playback_display");
+
+    result = playback_render(playback);
+    metrics_add(METRICS_FRAMES_RENDERED, 1);
+
+    /* Render to screen */
+    trace_begin("SDL_GL_SwapBuffers");
+    uint64_t swap_start = metrics_now();
+    SDL_GL_SwapBuffers();
+    metrics_observe(METRICS_STAGE_SWAP, swap_start);
+    trace_end();
+    metrics_observe(METRICS_STAGE_FRAME, start);
+
+    /* Close the counters of this frame and publish them */
+    gl_state_frame();
+    counters = gl_state_counters();
+    metrics_add(METRICS_BYTES_UPLOADED, counters.bytes_uploaded);
+    trace_end();
+
+    return result;
+}
+
+/**
+ * Skips a key frame interval backward or forward in a recording.
+ *
+ * Playback continues from the key frame at or before the target, so that
+ * only that frame needs to be uploaded.
+ *
+ * @param playback
+ *     The player.
+ * @param is_forward
+ *     Whether to skip forward.
+ * @return non-zero upon success and 0 if the recording is corrupt
+ */
+static int
+do_playback_skip(Playback *playback, int is_forward)
+{
+    unsigned int frame = is_forward
+        ? playback->frame + RECORDING_KEY_INTERVAL
+        : playback->frame + playback->frames
+            - RECORDING_KEY_INTERVAL % playback->frames;
+
+    return playback_seek(playback, recording_key_frame(playback->recording,
+        frame % playback->frames));
+}
+
+/**
+ * Handles SDL events while playing a recording, until the window is closed.
+ *
+ * @param playback
+ *     The player.
+ * @return non-zero if playback ended normally and 0 if the recording is
+ *     corrupt
+ */
+static int
+handle_playback_events(Playback *playback)
+{
+    SDL_Event event;
+
+    while (SDL_WaitEvent(&event)) {
+        switch (event.type) {
+        /* Exit if the window is closed */
+        case SDL_QUIT:
+            return 1;
+
+        /* Check for keypresses */
+        case SDL_KEYDOWN:
+            switch (event.key.keysym.sym) {
+            case SDLK_ESCAPE:
+                return 1;
+
+            case SDLK_d:
+                trace_save();
+                break;
+
+            case SDLK_LEFT:
+                if (!do_playback_skip(playback, 0)) {
+                    return 0;
+                }
+                break;
+
+            case SDLK_RIGHT:
+                if (!do_playback_skip(playback, 1)) {
+                    return 0;
+                }
+                break;
+
+            /* Prevent compiler warning */
+            default: break;
+            }
+            break;
+
+        case SDL_USEREVENT:
+            if (event.user.code == USER_EVENT_DISPLAY) {
+                __atomic_store_n(&display_pending, 0, __ATOMIC_RELEASE);
+                if (!do_playback_display(playback)) {
+                    return 0;
+                }
+            }
+            break;
+
+        /* Prevent compiler warning */
+        default: break;
+        }
     }
 
     return 1;
@@ -237,34 +616,296 @@ handle_events(Context *context)
 static void
 opengl_initialize(int width, int height)
 {
+    /* Start with no assumptions about the state */
+    gl_state_reset();
+
     /* Culling. */
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
-    glEnable(GL_CULL_FACE);
+    gl_state_enable(GL_CULL_FACE, 1);
 
     /* Enable depth test */
-    glEnable(GL_DEPTH_TEST);
+    gl_state_enable(GL_DEPTH_TEST, 1);
 
     /* Set the clear color. */
     glClearColor(0, 0, 0, 0);
 
     /* Setup our viewport. */
-    glViewport(0, 0, width, height);
+    gl_state_viewport(0, 0, width, height);
+}
+
+/**
+ * Retrieves the tuning of the fused stereogram kernel.
+ *
+ * The tuning is loaded from the cache file of this host. If the kernel is
+ * forced to be tuned, or if the cache file was written for a different
+ * configuration, a kernel is created and timed, and the cache file is
+ * updated. If there is no cache file path, the kernel is only tuned when
+ * forced.
+ *
+ * @param pattern
+ *     The background pattern.
+ * @param strength
+ *     The strength of the effect.
+ * @param format
+ *     The pixel format of the kernel.
+ * @param force
+ *     Whether to tune the kernel even if the cache file is up to date.
+ * @param tuning
+ *     Receives the tuning.
+ * @return non-zero if the tuning was retrieved and 0 otherwise
+ */
+static int
+kernel_tune(StereoPattern *pattern, double strength, StereogramFormat format,
+    int force, StereogramTuning *tuning)
+{
+    Stereogram *kernel;
+    char key[256], path[4096], bands[32];
+    int has_path;
+    double seconds;
+
+    /* Without a cache file, the kernel is only tuned when forced, rather than
+       on every start */
+    has_path = autotune_path(path, sizeof(path));
+    if (!has_path && !force) {
+        return 0;
+    }
+
+    /* The key depends on the kernel as the context uses it at startup, when
+       the pattern is animated and sources are recorded */
+    kernel = stereogram_create(IMAGE_WIDTH, IMAGE_HEIGHT, pattern, strength,
+        format);
+    if (!kernel || !stereogram_sources_enable(kernel)) {
+        stereogram_free(kernel);
+        return 0;
+    }
+    autotune_key(kernel, key, sizeof(key));
+
+    if (has_path) {
+        switch (autotune_load(path, key, tuning)) {
+        case AUTOTUNE_CACHE_HIT:
+            if (!force) {
+                stereogram_free(kernel);
+                return 1;
+            }
+            break;
+
+        case AUTOTUNE_CACHE_MISSING:
+            if (!force) {
+                stereogram_free(kernel);
+                return 0;
+            }
+            break;
+
+        case AUTOTUNE_CACHE_STALE:
+            printf("The configuration has changed since the stereogram "
+                "kernel was tuned.\n");
+            break;
+        }
+    }
+
+    printf("Tuning the stereogram kernel...\n");
+    seconds = autotune_run(kernel, tuning);
+    stereogram_free(kernel);
+    if (seconds < 0.0) {
+        printf("Unable to tune the stereogram kernel.\n");
+        return 0;
+    }
+    if (tuning->band_height > 0) {
+        snprintf(bands, sizeof(bands), "bands of %u rows",
+            tuning->band_height);
+    }
+    else {
+        strcpy(bands, "even bands");
+    }
+    printf("Threads: %u, %s, %s implementation: %.3f ms per image\n",
+        tuning->threads, bands,
+        tuning->is_generic ? "generic" : "specialised", seconds * 1000.0);
+
+    if (has_path && !autotune_save(path, key, tuning)) {
+        printf("Unable to write %s.\n", path);
+    }
+
+    return 1;
+}
+
+/**
+ * The state of a context being prepared while SDL and OpenGL are initialised.
+ */
+struct context_startup {
+    /** The context being prepared */
+    Context *context;
+
+    /** The background pattern passed to context_prepare */
+    StereoPattern *pattern;
+
+    /** The result of context_prepare */
+    int is_prepared;
+
+    /** The thread preparing the context, and whether it is running */
+    pthread_t thread;
+    int is_running;
+};
+
+/**
+ * Prepares a context on the startup thread.
+ *
+ * @param data
+ *     The startup state.
+ * @return NULL
+ */
+static void*
+context_startup_thread(void *data)
+{
+    struct context_startup *startup = data;
+
+    trace_thread_name("startup");
+    startup->is_prepared = context_prepare(startup->context,
+        IMAGE_WIDTH, IMAGE_HEIGHT, startup->pattern);
+
+    return NULL;
+}
+
+/**
+ * Starts preparing a context on a separate thread.
+ *
+ * If no thread can be started, the context is prepared before this function
+ * returns.
+ *
+ * @param startup
+ *     The startup state to initialise.
+ * @param context
+ *     The zeroed context to prepare.
+ * @param pattern
+ *     The background pattern for the stereogram.
+ * @see context_startup_end
+ */
+static void
+context_startup_begin(struct context_startup *startup, Context *context,
+    StereoPattern *pattern)
+{
+    startup->context = context;
+    startup->pattern = pattern;
+    startup->is_prepared = 0;
+    startup->is_running = pthread_create(&startup->thread, NULL,
+        context_startup_thread, startup) == 0;
+    if (!startup->is_running) {
+        context_startup_thread(startup);
+    }
+}
+
+/**
+ * Waits for a context to be prepared.
+ *
+ * @param startup
+ *     The startup state passed to context_startup_begin.
+ * @return non-zero if the context was successfully prepared and 0 otherwise
+ */
+static int
+context_startup_end(struct context_startup *startup)
+{
+    if (startup->is_running) {
+        pthread_join(startup->thread, NULL);
+        startup->is_running = 0;
+    }
+
+    return startup->is_prepared;
 }
 
 static int
 main(int argc, char *argv[],
     window_size_t window_size,
+    int huge_pages,
+    int autopilot,
+    int merge_walls,
+    int late_latch,
+    const char *metrics_socket,
+    const char *trace_file,
+    batch_t batch,
+    const char *record,
+    const char *play,
     maze_size_t maze_size,
     double wall_width,
     double slope_width,
     double shortcut_ratio,
+    int objects,
     double stereogram_strength,
+    int fused_stereogram,
+    StereogramFormat pixel_format,
+    int autotune,
+    reprojection_t reprojection,
     StereoPattern *pattern_image)
 {
+    /* Start tracing before anything else so that start up is recorded */
+    if (trace_file) {
+        trace_start();
+        trace_thread_name("main");
+    }
+
+    /* Convert depth map images without opening a window */
+    if (batch.input) {
+        BatchResult result;
+
+        if (!batch_run(batch.input, batch.output, pattern_image,
+                stereogram_strength, 0, &result)) {
+            printf("Unable to read %s.\n", batch.input);
+            return 1;
+        }
+        printf("%u images in %.2f s (%.1f images/s)",
+            result.images, result.seconds,
+            result.seconds > 0.0 ? result.images / result.seconds : 0.0);
+        if (result.failed > 0) {
+            printf(", %u failed", result.failed);
+        }
+        printf("\n");
+        trace_save();
+
+        return result.failed > 0;
+    }
+
+    /* Play a recording instead of exploring a maze */
+    Playback *playback = NULL;
+    if (play) {
+        playback = playback_create(play);
+        if (!playback) {
+            printf("Unable to read %s.\n", play);
+            return 1;
+        }
+    }
+
+    /* Prepare the maze and the stereogram while SDL and OpenGL are
+       initialised */
+    Context context;
+    struct context_startup startup;
+    memset(&context, 0, sizeof(context));
+    memset(&startup, 0, sizeof(startup));
+
+    if (!playback) {
+        /* Tune the fused kernel before other threads compete for the
+           processors */
+        if (fused_stereogram || pixel_format != STEREOGRAM_FORMAT_RGBA) {
+            kernel_tune(pattern_image, stereogram_strength, pixel_format,
+                autotune, &context.stereo.tuning);
+        }
+        else if (autotune) {
+            printf("Only the fused stereogram kernel can be tuned.\n");
+        }
+        if (reprojection.frames > 0 && !fused_stereogram
+                && pixel_format == STEREOGRAM_FORMAT_RGBA) {
+            printf("Depth reprojection requires the fused stereogram "
+                "kernel.\n");
+        }
+        if (reprojection.frames > 0 && !merge_walls) {
+            printf("Depth reprojection requires the merge-walls option.\n");
+        }
+
+        context_startup_begin(&startup, &context, pattern_image);
+    }
+
     /* Initialize SDL */
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         printf("Unable to init SDL: %s\n", SDL_GetError());
+        context_startup_end(&startup);
         return 1;
     }
     atexit(SDL_Quit);
@@ -276,6 +917,7 @@ main(int argc, char *argv[],
     const SDL_VideoInfo *vinfo = SDL_GetVideoInfo();
     if (!vinfo) {
         printf("Unable to get video info: %s\n", SDL_GetError());
+        context_startup_end(&startup);
         return 1;
     }
 
@@ -293,17 +935,42 @@ main(int argc, char *argv[],
     if (!screen) {
         printf("Unable to set %dx%d video: %s\n",
             vinfo->current_w, vinfo->current_h, SDL_GetError());
+        context_startup_end(&startup);
         return 1;
     }
 
     /* Setup OpenGL */
     opengl_initialize(vinfo->current_w, vinfo->current_h);
 
-    /* Initialise the context */
-    Context context;
-    memset(&context, 0, sizeof(context));
-    if (!context_initialize(&context, IMAGE_WIDTH, IMAGE_HEIGHT,
-            vinfo->current_w, vinfo->current_h, pattern_image)) {
+    /* Show an empty window until the first frame is ready */
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    SDL_GL_SwapBuffers();
+
+    /* Play the recording until the window is closed */
+    if (playback) {
+        int is_valid;
+
+        playback_initialize_gl(playback);
+        if (!timer_resume()) {
+            playback_free(playback);
+            printf("Unable to add timer.\n");
+            return 1;
+        }
+        is_valid = handle_playback_events(playback);
+        timer_suspend();
+        trace_save();
+        playback_free(playback);
+        if (!is_valid) {
+            printf("%s is corrupt.\n", play);
+        }
+
+        return !is_valid;
+    }
+
+    /* Complete the context once it has been prepared */
+    if (!context_startup_end(&startup)
+            || !context_initialize_gl(&context,
+                vinfo->current_w, vinfo->current_h)) {
         printf("Unable to initialise context.\n");
         return 1;
     }
@@ -311,9 +978,33 @@ main(int argc, char *argv[],
     /* Zero the cached value, since the pattern now is owned by the context */
     ARGUMENT_VALUE(pattern_image) = NULL;
 
+    /* Start recording the stereograms displayed */
+    if (record) {
+        context.stereo.recording = recording_writer_create(record,
+            context.stereo.zbuffer->width, context.stereo.zbuffer->height,
+            context.stereo.kernel
+                ? context.stereo.kernel->format
+                : STEREOGRAM_FORMAT_RGBA);
+        if (!context.stereo.recording) {
+            context_free(&context);
+            printf("Unable to write %s.\n", record);
+            return 1;
+        }
+    }
+
+    /* Start serving metrics */
+    if (metrics_socket && !metrics_serve(metrics_socket)) {
+        context_free(&context);
+        printf("Unable to serve metrics on %s: %s.\n", metrics_socket,
+            strerror(errno));
+        return 1;
+    }
+
     /* Create the timer */
-    SDL_TimerID timer = SDL_AddTimer(TIMER_INTERVAL, do_timer, NULL);
-    if (!timer) {
+    if (!timer_resume()) {
+        if (metrics_socket) {
+            metrics_stop();
+        }
         context_free(&context);
         printf("Unable to add timer.\n");
         return 1;
@@ -340,7 +1031,20 @@ main(int argc, char *argv[],
 
     SDL_JoystickClose(joystick);
 
-    SDL_RemoveTimer(timer);
+    timer_suspend();
+
+    trace_save();
+
+    if (metrics_socket) {
+        metrics_stop();
+    }
+
+    if (context.stereo.recording) {
+        if (!recording_writer_close(context.stereo.recording)) {
+            printf("Unable to write %s.\n", record);
+        }
+        context.stereo.recording = NULL;
+    }
 
     context_free(&context);
 
@@ -0,0 +1,236 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "maze-height.h"
+
+/* The number of bisection steps refining the crossing of a ray */
+#define REFINE_STEPS 6
+
+/**
+ * Returns whether there is a closed wall on a line between two rooms.
+ *
+ * @param maze
+ *     The maze.
+ * @param vertical
+ *     Whether the line is vertical.
+ * @param line
+ *     The column of the line if it is vertical, and its row otherwise; the
+ *     outer walls are on lines 0 and the width or height of the maze.
+ * @param index
+ *     The row of the wall along a vertical line, and its column along a
+ *     horizontal line.
+ * @return non-zero if the wall is closed and 0 if it is open or outside of
+ *     the maze
+ */
+static int
+maze_height_wall(Maze *maze, int vertical, int line, int index)
+{
+    if (vertical) {
+        if (index < 0 || index >= maze->height || line < 0
+                || line > maze->width) {
+            return 0;
+        }
+        return line < maze->width
+            ? !maze_is_open(maze, line, index, MAZE_WALL_LEFT)
+            : !maze_is_open(maze, line - 1, index, MAZE_WALL_RIGHT);
+    }
+    else {
+        if (index < 0 || index >= maze->width || line < 0
+                || line > maze->height) {
+            return 0;
+        }
+        return line < maze->height
+            ? !maze_is_open(maze, index, line, MAZE_WALL_UP)
+            : !maze_is_open(maze, index, line - 1, MAZE_WALL_DOWN);
+    }
+}
+
+/**
+ * Calculates the height of a wall at a distance from its line.
+ *
+ * @param distance
+ *     The distance from the wall line.
+ * @param wall_width, slope_width
+ *     The width of the wall and of its slope.
+ * @return the height as a fraction of the wall height
+ */
+static double
+maze_height_profile(double distance, double wall_width, double slope_width)
+{
+    if (distance <= wall_width) {
+        return 1.0;
+    }
+    else if (distance < wall_width + slope_width) {
+        return (wall_width + slope_width - distance) / slope_width;
+    }
+    else {
+        return 0.0;
+    }
+}
+
+/**
+ * Calculates the height of the walls at a point.
+ *
+ * The walls run along the whole edge of a room and end there, so only the
+ * walls of the room containing the point can reach it.
+ *
+ * @param maze
+ *     The maze.
+ * @param x, y
+ *     The point, in room units with the y axis pointing down as in the maze.
+ * @param wall_width, slope_width
+ *     The width of the walls and of their slopes.
+ * @return the height as a fraction of the wall height
+ */
+static double
+maze_height_sample(Maze *maze, double x, double y, double wall_width,
+    double slope_width)
+{
+    int room_x = (int)x, room_y = (int)y;
+    double result = 0.0;
+    int line;
+
+    for (line = room_y; line <= room_y + 1; line++) {
+        if (maze_height_wall(maze, 0, line, room_x)) {
+            result = fmax(result, maze_height_profile(fabs(y - line),
+                wall_width, slope_width));
+        }
+    }
+    for (line = room_x; line <= room_x + 1; line++) {
+        if (maze_height_wall(maze, 1, line, room_y)) {
+            result = fmax(result, maze_height_profile(fabs(x - line),
+                wall_width, slope_width));
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Returns whether a point on a ray is below the top of the walls.
+ *
+ * @param height
+ *     The heightfield.
+ * @param origin, direction
+ *     The ray.
+ * @param t
+ *     The ray parameter of the point.
+ * @return non-zero if the point is below the top of the walls and 0
+ *     otherwise
+ */
+static int
+maze_height_is_below(const MazeHeight *height, const double origin[3],
+    const double direction[3], double t)
+{
+    double x = origin[0] + t * direction[0];
+    double y = origin[1] + t * direction[1];
+    double z = origin[2] + t * direction[2];
+    int sx = (int)floor(x * MAZE_HEIGHT_RESOLUTION);
+    int sy = (int)floor(y * MAZE_HEIGHT_RESOLUTION);
+
+    if (sx < 0 || sx >= (int)height->width || sy < 0
+            || sy >= (int)height->height) {
+        return 0;
+    }
+
+    return z * 255.0 < height->wall_height
+        * height->samples[sy * height->width + sx];
+}
+
+MazeHeight*
+maze_height_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height)
+{
+    MazeHeight *result;
+    unsigned int x, y;
+
+    result = malloc(sizeof(MazeHeight));
+    if (!result) {
+        return NULL;
+    }
+
+    result->width = maze->width * MAZE_HEIGHT_RESOLUTION;
+    result->height = maze->height * MAZE_HEIGHT_RESOLUTION;
+    result->wall_height = wall_height;
+    result->samples = malloc(result->width * result->height);
+    if (!result->samples) {
+        free(result);
+        return NULL;
+    }
+
+    /* Sample the centre of every cell; rows are stored from the bottom, so
+       the y axis is flipped */
+    for (y = 0; y < result->height; y++) {
+        double maze_y = maze->height
+            - (y + 0.5) / MAZE_HEIGHT_RESOLUTION;
+
+        for (x = 0; x < result->width; x++) {
+            double maze_x = (x + 0.5) / MAZE_HEIGHT_RESOLUTION;
+
+            result->samples[y * result->width + x] = (uint8_t)lrint(255.0
+                * maze_height_sample(maze, maze_x, maze_y, wall_width,
+                    slope_width));
+        }
+    }
+
+    return result;
+}
+
+void
+maze_height_free(MazeHeight *height)
+{
+    free(height->samples);
+    free(height);
+}
+
+int
+maze_height_trace(const MazeHeight *height, const double origin[3],
+    const double direction[3], double *distance)
+{
+    double planar = sqrt(direction[0] * direction[0]
+        + direction[1] * direction[1]);
+    double start, end, step, t, previous;
+    int i;
+
+    /* Only the part of the ray between the top of the walls and the floor
+       can hit a wall */
+    if (direction[2] >= 0.0) {
+        return 0;
+    }
+    start = (origin[2] - height->wall_height) / -direction[2];
+    if (start < 0.0) {
+        start = 0.0;
+    }
+    end = origin[2] / -direction[2];
+    step = planar > 0.0
+        ? 0.5 / (MAZE_HEIGHT_RESOLUTION * planar)
+        : end - start;
+
+    for (previous = t = start;; previous = t, t += step) {
+        if (t > end) {
+            t = end;
+        }
+
+        if (maze_height_is_below(height, origin, direction, t)) {
+            /* The crossing lies between the previous step and this one */
+            double below = t, above = previous;
+
+            for (i = 0; i < REFINE_STEPS && t > start; i++) {
+                double middle = 0.5 * (above + below);
+
+                if (maze_height_is_below(height, origin, direction, middle)) {
+                    below = middle;
+                }
+                else {
+                    above = middle;
+                }
+            }
+            *distance = below;
+            return 1;
+        }
+
+        if (t >= end) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef MAZE_HEIGHT_H
+#define MAZE_HEIGHT_H
+
+#include <stdint.h>
+
+#include <maze/maze.h>
+
+/**
+ * The number of samples along each side of a room.
+ */
+#define MAZE_HEIGHT_RESOLUTION 16
+
+/**
+ * The height of the walls of a maze sampled on a regular grid.
+ *
+ * The walls are modelled as they are drawn: a flat top of the wall width on
+ * either side of the wall line, sloping down to the floor over the slope
+ * width, along the whole edge of a room. Coordinates are those used when
+ * rendering, with the y axis flipped so that the first row of rooms is at the
+ * top.
+ */
+typedef struct {
+    /** The number of samples along each axis */
+    unsigned int width, height;
+
+    /** The height of the top of the walls */
+    double wall_height;
+
+    /** The samples, row by row from the bottom of the maze, as fractions of
+        the wall height scaled to 255 */
+    uint8_t *samples;
+} MazeHeight;
+
+/**
+ * Samples the height of the walls of a maze.
+ *
+ * The maze must not be modified while the heightfield is used.
+ *
+ * If this function completes successfully, maze_height_free must be called.
+ *
+ * @param maze
+ *     The maze.
+ * @param wall_width, slope_width
+ *     The width of the walls and of their slopes; see the wall-width and
+ *     slope-width options.
+ * @param wall_height
+ *     The height of the top of the walls.
+ * @return a new heightfield, or NULL upon failure
+ * @see maze_height_free
+ */
+MazeHeight*
+maze_height_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height);
+
+/**
+ * Releases a previously created heightfield.
+ *
+ * @param height
+ *     The heightfield to free.
+ */
+void
+maze_height_free(MazeHeight *height);
+
+/**
+ * Finds where a ray first passes below the top of the walls.
+ *
+ * The ray is followed from where it descends below the top of the walls to
+ * where it reaches the floor, one half sample at a time, and the crossing is
+ * then refined by bisection.
+ *
+ * @param height
+ *     The heightfield.
+ * @param origin
+ *     The start of the ray. It must be above the floor.
+ * @param direction
+ *     The direction of the ray. It must point downwards.
+ * @param distance
+ *     Receives the ray parameter of the crossing, in units of the direction.
+ * @return non-zero if the ray hits a wall and 0 if it reaches the floor
+ *     first
+ */
+int
+maze_height_trace(const MazeHeight *height, const double origin[3],
+    const double direction[3], double *distance);
+
+#endif
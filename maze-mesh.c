@@ -0,0 +1,645 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <maze/maze.h>
+#include <maze/maze-render.h>
+
+#include "gl-state.h"
+#include "maze-mesh.h"
+
+/* The maximum number of runs in a chunk; every wall is a run of its own */
+#define CHUNK_RUNS (2 * MAZE_MESH_CHUNK_SIZE * (MAZE_MESH_CHUNK_SIZE + 1))
+
+/* The number of quads used for the top and the slopes of a run */
+#define RUN_TOP_QUADS 1
+#define RUN_WALL_QUADS 2
+
+/* The maximum number of vertices in a chunk; every run consists of the top
+   and two slopes, and the floor is a single quad */
+#define CHUNK_VERTICES (6 * (1 + CHUNK_RUNS * (RUN_TOP_QUADS + RUN_WALL_QUADS)))
+
+/* The number of triangles per room when drawn room by room */
+#define ROOM_FLOOR_TRIANGLES 2
+#define ROOM_TOP_TRIANGLES 2
+#define ROOM_WALL_TRIANGLES 4
+
+/**
+ * A number of consecutive walls on the same line.
+ */
+struct run {
+    /** Whether the run is vertical */
+    int vertical;
+
+    /** The position of the line */
+    double line;
+
+    /** The start and end of the run along the line */
+    double start, end;
+};
+
+/**
+ * Returns whether there is a wall along the top of a room.
+ *
+ * @param maze
+ *     The maze.
+ * @param x
+ *     The column of the room.
+ * @param line
+ *     The row of the room, or the height of the maze for the bottom wall of
+ *     the last row.
+ * @return non-zero if the wall is closed and 0 otherwise
+ */
+static int
+maze_mesh_wall_horizontal(Maze *maze, int x, int line)
+{
+    if (line < maze->height) {
+        return !maze_is_open(maze, x, line, MAZE_WALL_UP);
+    }
+    else {
+        return !maze_is_open(maze, x, line - 1, MAZE_WALL_DOWN);
+    }
+}
+
+/**
+ * Returns whether there is a wall along the left side of a room.
+ *
+ * @param maze
+ *     The maze.
+ * @param line
+ *     The column of the room, or the width of the maze for the right wall of
+ *     the last column.
+ * @param y
+ *     The row of the room.
+ * @return non-zero if the wall is closed and 0 otherwise
+ */
+static int
+maze_mesh_wall_vertical(Maze *maze, int line, int y)
+{
+    if (line < maze->width) {
+        return !maze_is_open(maze, line, y, MAZE_WALL_LEFT);
+    }
+    else {
+        return !maze_is_open(maze, line - 1, y, MAZE_WALL_RIGHT);
+    }
+}
+
+/**
+ * Appends a quad as two triangles.
+ *
+ * The winding is chosen so that the front face points away from the wall.
+ *
+ * @param vertices
+ *     The vertex buffer.
+ * @param count
+ *     The number of vertices in the buffer. This is updated.
+ * @param p
+ *     The corners of the quad, in order around its edge.
+ * @param outward
+ *     A vector pointing in the general direction of the front face.
+ */
+static void
+maze_mesh_quad(MazeMeshVertex *vertices, GLsizei *count,
+    const GLfloat p[4][3], const GLfloat outward[3])
+{
+    static const int forward[] = {0, 1, 2, 0, 2, 3};
+    static const int backward[] = {0, 3, 2, 0, 2, 1};
+    const int *order;
+    GLfloat a[3], b[3], n[3], mag;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        a[i] = p[1][i] - p[0][i];
+        b[i] = p[2][i] - p[0][i];
+    }
+    n[0] = a[1] * b[2] - a[2] * b[1];
+    n[1] = a[2] * b[0] - a[0] * b[2];
+    n[2] = a[0] * b[1] - a[1] * b[0];
+
+    /* Make sure that the quad faces outward */
+    if (n[0] * outward[0] + n[1] * outward[1] + n[2] * outward[2] < 0.0) {
+        order = backward;
+        n[0] = -n[0];
+        n[1] = -n[1];
+        n[2] = -n[2];
+    }
+    else {
+        order = forward;
+    }
+
+    mag = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (mag) {
+        n[0] /= mag;
+        n[1] /= mag;
+        n[2] /= mag;
+    }
+
+    for (i = 0; i < 6; i++) {
+        MazeMeshVertex *v = &vertices[(*count)++];
+        const GLfloat *corner = p[order[i]];
+
+        v->s = corner[0];
+        v->t = corner[1];
+        v->nx = n[0];
+        v->ny = n[1];
+        v->nz = n[2];
+        v->x = corner[0];
+        v->y = corner[1];
+        v->z = corner[2];
+    }
+}
+
+/**
+ * Stores a point relative to a run in world coordinates.
+ *
+ * @param run
+ *     The run.
+ * @param u
+ *     The position along the run.
+ * @param v
+ *     The position across the run, relative to its line.
+ * @param z
+ *     The height.
+ * @param result
+ *     The point.
+ */
+static void
+maze_mesh_run_point(const struct run *run, double u, double v, double z,
+    GLfloat result[3])
+{
+    if (run->vertical) {
+        result[0] = run->line + v;
+        result[1] = u;
+    }
+    else {
+        result[0] = u;
+        result[1] = run->line + v;
+    }
+    result[2] = z;
+}
+
+/**
+ * Appends the top of a run.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param count
+ *     The number of vertices in the buffer. This is updated.
+ * @param run
+ *     The run.
+ */
+static void
+maze_mesh_run_top(MazeMesh *mesh, GLsizei *count, const struct run *run)
+{
+    static const GLfloat up[] = {0.0, 0.0, 1.0};
+    double w = mesh->wall_width;
+    double h = mesh->wall_height;
+    GLfloat p[4][3];
+
+    maze_mesh_run_point(run, run->start, -w, h, p[0]);
+    maze_mesh_run_point(run, run->end, -w, h, p[1]);
+    maze_mesh_run_point(run, run->end, w, h, p[2]);
+    maze_mesh_run_point(run, run->start, w, h, p[3]);
+    maze_mesh_quad(mesh->vertices, count, p, up);
+}
+
+/**
+ * Appends the slopes of a run.
+ *
+ * As with maze_render_gl, the slopes end with the run, and where walls meet
+ * they intersect instead of being joined.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param count
+ *     The number of vertices in the buffer. This is updated.
+ * @param run
+ *     The run.
+ */
+static void
+maze_mesh_run_walls(MazeMesh *mesh, GLsizei *count, const struct run *run)
+{
+    double w = mesh->wall_width;
+    double o = mesh->wall_width + mesh->slope_width;
+    double h = mesh->wall_height;
+    GLfloat p[4][3], outward[3];
+    int side;
+
+    for (side = -1; side <= 1; side += 2) {
+        maze_mesh_run_point(run, run->start, side * o, 0.0, p[0]);
+        maze_mesh_run_point(run, run->end, side * o, 0.0, p[1]);
+        maze_mesh_run_point(run, run->end, side * w, h, p[2]);
+        maze_mesh_run_point(run, run->start, side * w, h, p[3]);
+        outward[run->vertical ? 1 : 0] = 0.0;
+        outward[run->vertical ? 0 : 1] = side;
+        outward[2] = 1.0;
+        maze_mesh_quad(mesh->vertices, count, p, outward);
+    }
+}
+
+/**
+ * Generates the vertices of a chunk into the vertex buffer of a mesh
+ * renderer.
+ *
+ * This does not use OpenGL.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param chunk
+ *     The chunk. The position must be set.
+ * @return the number of vertices
+ */
+static GLsizei
+maze_mesh_chunk_generate(MazeMesh *mesh, struct maze_mesh_chunk *chunk)
+{
+    static const GLfloat up[] = {0.0, 0.0, 1.0};
+    struct run runs[CHUNK_RUNS];
+    Maze *maze = mesh->maze;
+    int x0, x1, y0, y1, x, y, line, last;
+    unsigned int run_count = 0;
+    GLsizei count = 0;
+    GLfloat p[4][3];
+    unsigned int i;
+
+    /* The rooms of the chunk; the chunks at the right and bottom edges also
+       contain the outer walls of the maze */
+    x0 = chunk->x * MAZE_MESH_CHUNK_SIZE;
+    x1 = x0 + MAZE_MESH_CHUNK_SIZE;
+    if (x1 > maze->width) {
+        x1 = maze->width;
+    }
+    y0 = chunk->y * MAZE_MESH_CHUNK_SIZE;
+    y1 = y0 + MAZE_MESH_CHUNK_SIZE;
+    if (y1 > maze->height) {
+        y1 = maze->height;
+    }
+    chunk->rooms = (x1 - x0) * (y1 - y0);
+    chunk->walls = 0;
+
+    /* Find the horizontal runs; the y axis is flipped as in maze_render_gl */
+    last = y1 == maze->height ? y1 : y1 - 1;
+    for (line = y0; line <= last; line++) {
+        int start = -1;
+
+        for (x = x0; x <= x1; x++) {
+            int is_wall = x < x1 && maze_mesh_wall_horizontal(maze, x, line);
+
+            if (is_wall) {
+                chunk->walls++;
+                if (start < 0) {
+                    start = x;
+                }
+            }
+            else if (start >= 0) {
+                runs[run_count].vertical = 0;
+                runs[run_count].line = maze->height - line;
+                runs[run_count].start = start;
+                runs[run_count].end = x;
+                run_count++;
+                start = -1;
+            }
+        }
+    }
+
+    /* Find the vertical runs */
+    last = x1 == maze->width ? x1 : x1 - 1;
+    for (line = x0; line <= last; line++) {
+        int start = -1;
+
+        for (y = y0; y <= y1; y++) {
+            int is_wall = y < y1 && maze_mesh_wall_vertical(maze, line, y);
+
+            if (is_wall) {
+                chunk->walls++;
+                if (start < 0) {
+                    start = y;
+                }
+            }
+            else if (start >= 0) {
+                runs[run_count].vertical = 1;
+                runs[run_count].line = line;
+                runs[run_count].start = maze->height - y;
+                runs[run_count].end = maze->height - start;
+                run_count++;
+                start = -1;
+            }
+        }
+    }
+
+    /* The floor is a single quad */
+    p[0][0] = x0;
+    p[0][1] = maze->height - y1;
+    p[1][0] = x1;
+    p[1][1] = maze->height - y1;
+    p[2][0] = x1;
+    p[2][1] = maze->height - y0;
+    p[3][0] = x0;
+    p[3][1] = maze->height - y0;
+    p[0][2] = p[1][2] = p[2][2] = p[3][2] = 0.0;
+    maze_mesh_quad(mesh->vertices, &count, p, up);
+    chunk->floor_count = count;
+
+    for (i = 0; i < run_count; i++) {
+        maze_mesh_run_top(mesh, &count, &runs[i]);
+    }
+    chunk->top_count = count - chunk->floor_count;
+
+    for (i = 0; i < run_count; i++) {
+        maze_mesh_run_walls(mesh, &count, &runs[i]);
+    }
+    chunk->wall_count = count - chunk->floor_count - chunk->top_count;
+
+    return count;
+}
+
+/**
+ * Uploads the vertices of a chunk to its vertex buffer.
+ *
+ * @param chunk
+ *     The chunk.
+ * @param vertices
+ *     The vertices generated by maze_mesh_chunk_generate.
+ */
+static void
+maze_mesh_chunk_upload(struct maze_mesh_chunk *chunk,
+    const MazeMeshVertex *vertices)
+{
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, chunk->buffer);
+    gl_state_buffer_data(GL_ARRAY_BUFFER, (chunk->floor_count
+            + chunk->top_count + chunk->wall_count) * sizeof(MazeMeshVertex),
+        vertices, GL_STATIC_DRAW);
+}
+
+/**
+ * Finds the chunks intersecting the area around a room.
+ *
+ * @param maze
+ *     The maze.
+ * @param x, y
+ *     The room.
+ * @param radius
+ *     The number of rooms around (x, y).
+ * @param cx0, cx1, cy0, cy1
+ *     Receive the first and last columns and rows of chunks.
+ */
+static void
+maze_mesh_chunk_range(Maze *maze, int x, int y, int radius,
+    int *cx0, int *cx1, int *cy0, int *cy1)
+{
+    *cx0 = (x - radius < 0 ? 0 : x - radius) / MAZE_MESH_CHUNK_SIZE;
+    *cx1 = (x + radius >= maze->width
+        ? maze->width - 1 : x + radius) / MAZE_MESH_CHUNK_SIZE;
+    *cy0 = (y - radius < 0 ? 0 : y - radius) / MAZE_MESH_CHUNK_SIZE;
+    *cy1 = (y + radius >= maze->height
+        ? maze->height - 1 : y + radius) / MAZE_MESH_CHUNK_SIZE;
+}
+
+/**
+ * Finds a chunk in the cache, or builds it in the least recently used slot.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param x, y
+ *     The position of the chunk, in chunks.
+ * @return the chunk
+ */
+static struct maze_mesh_chunk*
+maze_mesh_chunk_get(MazeMesh *mesh, int x, int y)
+{
+    struct maze_mesh_chunk *result = &mesh->chunks[0];
+    int i;
+
+    for (i = 0; i < MAZE_MESH_CACHE_SIZE; i++) {
+        struct maze_mesh_chunk *chunk = &mesh->chunks[i];
+
+        if (chunk->x == x && chunk->y == y) {
+            chunk->last_used = mesh->frame;
+            return chunk;
+        }
+        else if (chunk->last_used < result->last_used) {
+            result = chunk;
+        }
+    }
+
+    result->x = x;
+    result->y = y;
+    result->last_used = mesh->frame;
+    maze_mesh_chunk_generate(mesh, result);
+    maze_mesh_chunk_upload(result, mesh->vertices);
+    mesh->counters.chunks_built++;
+
+    return result;
+}
+
+MazeMesh*
+maze_mesh_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height)
+{
+    MazeMesh *result;
+    GLuint buffers[MAZE_MESH_CACHE_SIZE];
+    int i;
+
+    result = malloc(sizeof(MazeMesh));
+    if (!result) {
+        return NULL;
+    }
+
+    result->vertex_capacity = CHUNK_VERTICES;
+    result->vertices = malloc(result->vertex_capacity
+        * sizeof(MazeMeshVertex));
+    if (!result->vertices) {
+        free(result);
+        return NULL;
+    }
+
+    result->wall_width = wall_width;
+    result->slope_width = slope_width;
+    result->wall_height = wall_height;
+    glGenBuffers(MAZE_MESH_CACHE_SIZE, buffers);
+    for (i = 0; i < MAZE_MESH_CACHE_SIZE; i++) {
+        result->chunks[i].buffer = buffers[i];
+    }
+    maze_mesh_reset(result, maze, NULL);
+
+    return result;
+}
+
+void
+maze_mesh_free(MazeMesh *mesh)
+{
+    GLuint buffers[MAZE_MESH_CACHE_SIZE];
+    int i;
+
+    if (!mesh) {
+        return;
+    }
+
+    for (i = 0; i < MAZE_MESH_CACHE_SIZE; i++) {
+        buffers[i] = mesh->chunks[i].buffer;
+    }
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(MAZE_MESH_CACHE_SIZE, buffers);
+
+    free(mesh->vertices);
+    free(mesh);
+}
+
+void
+maze_mesh_reset(MazeMesh *mesh, Maze *maze, const MazeMeshPreload *preload)
+{
+    unsigned int i;
+
+    mesh->maze = maze;
+    mesh->frame = 1;
+    for (i = 0; i < MAZE_MESH_CACHE_SIZE; i++) {
+        mesh->chunks[i].x = -1;
+        mesh->chunks[i].y = -1;
+        mesh->chunks[i].last_used = 0;
+    }
+
+    /* Upload the chunks that have already been built */
+    for (i = 0; preload && i < preload->count && i < MAZE_MESH_CACHE_SIZE;
+            i++) {
+        struct maze_mesh_chunk *chunk = &mesh->chunks[i];
+        GLuint buffer = chunk->buffer;
+
+        *chunk = preload->chunks[i];
+        chunk->buffer = buffer;
+        chunk->last_used = mesh->frame;
+        maze_mesh_chunk_upload(chunk,
+            preload->vertices + (size_t)i * CHUNK_VERTICES);
+    }
+}
+
+MazeMeshPreload*
+maze_mesh_preload_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height, int x, int y, int radius)
+{
+    MazeMeshPreload *result;
+    MazeMesh mesh;
+    int cx0, cx1, cy0, cy1, cx, cy;
+
+    result = malloc(sizeof(MazeMeshPreload));
+    if (!result) {
+        return NULL;
+    }
+
+    maze_mesh_chunk_range(maze, x, y, radius, &cx0, &cx1, &cy0, &cy1);
+    result->count = (cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+    result->chunks = malloc(result->count * sizeof(*result->chunks));
+    result->vertices = malloc((size_t)result->count * CHUNK_VERTICES
+        * sizeof(MazeMeshVertex));
+    if (!result->chunks || !result->vertices) {
+        free(result->vertices);
+        free(result->chunks);
+        free(result);
+        return NULL;
+    }
+
+    /* Only the fields used to generate vertices are set */
+    mesh.maze = maze;
+    mesh.wall_width = wall_width;
+    mesh.slope_width = slope_width;
+    mesh.wall_height = wall_height;
+    result->count = 0;
+    for (cy = cy0; cy <= cy1; cy++) {
+        for (cx = cx0; cx <= cx1; cx++) {
+            struct maze_mesh_chunk *chunk = &result->chunks[result->count];
+
+            chunk->x = cx;
+            chunk->y = cy;
+            chunk->buffer = 0;
+            mesh.vertices = result->vertices
+                + (size_t)result->count * CHUNK_VERTICES;
+            maze_mesh_chunk_generate(&mesh, chunk);
+            result->count++;
+        }
+    }
+
+    return result;
+}
+
+void
+maze_mesh_preload_free(MazeMeshPreload *preload)
+{
+    if (!preload) {
+        return;
+    }
+
+    free(preload->vertices);
+    free(preload->chunks);
+    free(preload);
+}
+
+void
+maze_mesh_render(MazeMesh *mesh, int x, int y, int radius, int flags)
+{
+    int cx0, cx1, cy0, cy1, cx, cy;
+
+    mesh->frame++;
+    mesh->counters.triangles = 0;
+    mesh->counters.triangles_unmerged = 0;
+    mesh->counters.chunks = 0;
+    mesh->counters.chunks_built = 0;
+
+    /* Find the chunks intersecting the area to render */
+    maze_mesh_chunk_range(mesh->maze, x, y, radius, &cx0, &cx1, &cy0, &cy1);
+
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+    for (cy = cy0; cy <= cy1; cy++) {
+        for (cx = cx0; cx <= cx1; cx++) {
+            struct maze_mesh_chunk *chunk = maze_mesh_chunk_get(mesh, cx, cy);
+            GLsizei first = 0, count = 0;
+
+            gl_state_bind_buffer(GL_ARRAY_BUFFER, chunk->buffer);
+            glInterleavedArrays(GL_T2F_N3F_V3F, 0, NULL);
+            if (!(flags & MAZE_RENDER_GL_TEXTURE)) {
+                glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            }
+
+            /* The parts are stored consecutively, so draw as few ranges as
+               possible */
+            if (flags & MAZE_RENDER_GL_FLOOR) {
+                count += chunk->floor_count;
+                mesh->counters.triangles_unmerged +=
+                    chunk->rooms * ROOM_FLOOR_TRIANGLES;
+            }
+            else {
+                first = chunk->floor_count;
+            }
+            if (flags & MAZE_RENDER_GL_TOP) {
+                count += chunk->top_count;
+                mesh->counters.triangles_unmerged +=
+                    chunk->walls * ROOM_TOP_TRIANGLES;
+            }
+            else {
+                if (count) {
+                    glDrawArrays(GL_TRIANGLES, first, count);
+                    mesh->counters.triangles += count / 3;
+                }
+                first = chunk->floor_count + chunk->top_count;
+                count = 0;
+            }
+            if (flags & MAZE_RENDER_GL_WALLS) {
+                count += chunk->wall_count;
+                mesh->counters.triangles_unmerged +=
+                    chunk->walls * ROOM_WALL_TRIANGLES;
+            }
+            if (count) {
+                glDrawArrays(GL_TRIANGLES, first, count);
+                mesh->counters.triangles += count / 3;
+            }
+
+            mesh->counters.chunks++;
+        }
+    }
+
+    gl_state_bind_buffer(GL_ARRAY_BUFFER, 0);
+    glPopClientAttrib();
+}
+
+MazeMeshCounters
+maze_mesh_counters(const MazeMesh *mesh)
+{
+    return mesh->counters;
+}
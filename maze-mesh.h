@@ -0,0 +1,225 @@
+#ifndef MAZE_MESH_H
+#define MAZE_MESH_H
+
+#include <GL/gl.h>
+
+#include <maze/maze.h>
+
+/**
+ * The number of rooms along each side of a chunk.
+ */
+#define MAZE_MESH_CHUNK_SIZE 8
+
+/**
+ * The maximum number of chunks kept in vertex buffers at any time.
+ */
+#define MAZE_MESH_CACHE_SIZE 32
+
+/**
+ * A vertex as stored in the vertex buffers.
+ *
+ * The layout matches GL_T2F_N3F_V3F.
+ */
+typedef struct {
+    GLfloat s, t;
+    GLfloat nx, ny, nz;
+    GLfloat x, y, z;
+} MazeMeshVertex;
+
+/**
+ * Counters for the geometry drawn by maze_mesh_render.
+ */
+typedef struct {
+    /** The number of triangles drawn */
+    unsigned long triangles;
+
+    /** The number of triangles that would have been drawn had walls and
+        floors been drawn room by room */
+    unsigned long triangles_unmerged;
+
+    /** The number of chunks drawn, and the number of those that had to be
+        built */
+    unsigned long chunks;
+    unsigned long chunks_built;
+} MazeMeshCounters;
+
+/**
+ * A chunk of the maze stored in a vertex buffer.
+ */
+struct maze_mesh_chunk {
+    /** The position of the chunk, in chunks; -1 if the slot is unused */
+    int x, y;
+
+    /** The vertex buffer */
+    GLuint buffer;
+
+    /** The number of floor, top and wall vertices; they are stored in this
+        order */
+    GLsizei floor_count, top_count, wall_count;
+
+    /** The number of rooms in the chunk, and the number of walls between
+        them; used to calculate the number of triangles had the chunk been
+        drawn room by room */
+    unsigned int rooms, walls;
+
+    /** The value of the frame counter when the chunk was last drawn */
+    unsigned long last_used;
+};
+
+/**
+ * The chunks around a room of a maze, built before the maze is passed to
+ * maze_mesh_reset.
+ *
+ * Generating the vertices of a chunk does not use OpenGL, so this may be done
+ * on any thread; maze_mesh_reset then only uploads them.
+ */
+typedef struct {
+    /** The chunks; their vertex buffers are not used */
+    struct maze_mesh_chunk *chunks;
+    unsigned int count;
+
+    /** The vertices of the chunks, at a fixed stride per chunk */
+    MazeMeshVertex *vertices;
+} MazeMeshPreload;
+
+/**
+ * A renderer for a maze that merges walls running along several rooms.
+ *
+ * The maze is split into chunks of MAZE_MESH_CHUNK_SIZE by
+ * MAZE_MESH_CHUNK_SIZE rooms. Within a chunk, walls on the same line running
+ * along several rooms are merged into single long quads, so the geometry is
+ * that of maze_render_gl drawn with fewer primitives: every closed wall has a
+ * flat top the wall width wide on either side of its line, sloping down to
+ * the floor over the slope width, along the whole edge of the room. The
+ * texture is mapped onto the floor plane in room units. Chunks are built
+ * when first needed, and are kept in vertex buffers until evicted by more
+ * recently drawn chunks.
+ */
+typedef struct {
+    /** The maze being rendered */
+    Maze *maze;
+
+    /** The width of the walls and slopes, and the height of the walls */
+    double wall_width, slope_width, wall_height;
+
+    /** The cached chunks */
+    struct maze_mesh_chunk chunks[MAZE_MESH_CACHE_SIZE];
+
+    /** The frame counter */
+    unsigned long frame;
+
+    /** The buffer used when building a chunk */
+    MazeMeshVertex *vertices;
+    unsigned int vertex_capacity;
+
+    /** The counters for the last call to maze_mesh_render */
+    MazeMeshCounters counters;
+} MazeMesh;
+
+/**
+ * Creates a mesh renderer for a maze.
+ *
+ * An OpenGL context must be current.
+ *
+ * If this function completes successfully, maze_mesh_free must be called.
+ *
+ * @param maze
+ *     The maze to render.
+ * @param wall_width, slope_width
+ *     The width of the walls and slopes; see maze_render_gl.
+ * @param wall_height
+ *     The height of the walls, as passed to maze_render_gl.
+ * @return a new mesh renderer, or NULL upon failure
+ * @see maze_mesh_free
+ */
+MazeMesh*
+maze_mesh_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height);
+
+/**
+ * Releases a previously created mesh renderer.
+ *
+ * @param mesh
+ *     The mesh renderer to free.
+ */
+void
+maze_mesh_free(MazeMesh *mesh);
+
+/**
+ * Replaces the maze being rendered.
+ *
+ * All cached chunks are discarded, but their vertex buffers are reused.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param maze
+ *     The new maze.
+ * @param preload
+ *     Chunks of the new maze built by maze_mesh_preload_create, which are
+ *     uploaded so that they need not be built when first drawn, or NULL.
+ *     This is not freed.
+ */
+void
+maze_mesh_reset(MazeMesh *mesh, Maze *maze, const MazeMeshPreload *preload);
+
+/**
+ * Builds the chunks that maze_mesh_render draws around a room.
+ *
+ * This does not use OpenGL, so it may be called on any thread.
+ *
+ * If this function completes successfully, maze_mesh_preload_free must be
+ * called.
+ *
+ * @param maze
+ *     The maze.
+ * @param wall_width, slope_width, wall_height
+ *     The dimensions of the walls, as passed to maze_mesh_create.
+ * @param x, y
+ *     The room.
+ * @param radius
+ *     The number of rooms around (x, y).
+ * @return the built chunks, or NULL upon failure
+ * @see maze_mesh_preload_free
+ */
+MazeMeshPreload*
+maze_mesh_preload_create(Maze *maze, double wall_width, double slope_width,
+    double wall_height, int x, int y, int radius);
+
+/**
+ * Releases chunks built by maze_mesh_preload_create.
+ *
+ * @param preload
+ *     The chunks to free, or NULL.
+ */
+void
+maze_mesh_preload_free(MazeMeshPreload *preload);
+
+/**
+ * Renders the part of the maze around a room.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @param x, y
+ *     The room around which to render.
+ * @param radius
+ *     The number of rooms around (x, y) to render.
+ * @param flags
+ *     Which parts to render; MAZE_RENDER_GL_WALLS, MAZE_RENDER_GL_FLOOR,
+ *     MAZE_RENDER_GL_TOP and MAZE_RENDER_GL_TEXTURE are supported. Texture
+ *     coordinates are only provided if MAZE_RENDER_GL_TEXTURE is set.
+ * @see maze_render_gl
+ */
+void
+maze_mesh_render(MazeMesh *mesh, int x, int y, int radius, int flags);
+
+/**
+ * Retrieves the counters for the last call to maze_mesh_render.
+ *
+ * @param mesh
+ *     The mesh renderer.
+ * @return the counters
+ */
+MazeMeshCounters
+maze_mesh_counters(const MazeMesh *mesh);
+
+#endif
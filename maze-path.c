@@ -0,0 +1,132 @@
+#include <stdlib.h>
+
+#include "maze-path.h"
+
+/**
+ * The directions in which to search, and the walls separating the rooms.
+ */
+static const struct {
+    int dx, dy;
+    MazeWall wall;
+} directions[] = {
+    {-1, 0, MAZE_WALL_LEFT},
+    {0, -1, MAZE_WALL_UP},
+    {1, 0, MAZE_WALL_RIGHT},
+    {0, 1, MAZE_WALL_DOWN}};
+#define DIRECTION_COUNT (sizeof(directions) / sizeof(directions[0]))
+
+MazePath*
+maze_path_create(Maze *maze, int goal_x, int goal_y)
+{
+    MazePath *result;
+    unsigned int *queue;
+    unsigned int head, tail, i, count;
+
+    if (!maze || goal_x < 0 || goal_x >= maze->width
+            || goal_y < 0 || goal_y >= maze->height) {
+        return NULL;
+    }
+    count = maze->width * maze->height;
+
+    result = malloc(sizeof(MazePath));
+    if (!result) {
+        return NULL;
+    }
+    result->distances = malloc(count * sizeof(unsigned int));
+    queue = malloc(count * sizeof(unsigned int));
+    if (!result->distances || !queue) {
+        free(queue);
+        free(result->distances);
+        free(result);
+        return NULL;
+    }
+
+    result->width = maze->width;
+    result->height = maze->height;
+    result->goal_x = goal_x;
+    result->goal_y = goal_y;
+    for (i = 0; i < count; i++) {
+        result->distances[i] = MAZE_PATH_UNREACHABLE;
+    }
+
+    /* Every room is queued at most once, so the queue never wraps */
+    head = tail = 0;
+    queue[tail++] = goal_y * maze->width + goal_x;
+    result->distances[goal_y * maze->width + goal_x] = 0;
+    while (head < tail) {
+        unsigned int room = queue[head++];
+        int x = room % maze->width;
+        int y = room / maze->width;
+
+        for (i = 0; i < DIRECTION_COUNT; i++) {
+            int nx = x + directions[i].dx;
+            int ny = y + directions[i].dy;
+            unsigned int next;
+
+            if (nx < 0 || nx >= maze->width || ny < 0 || ny >= maze->height
+                    || !maze_is_open(maze, x, y, directions[i].wall)) {
+                continue;
+            }
+
+            next = ny * maze->width + nx;
+            if (result->distances[next] == MAZE_PATH_UNREACHABLE) {
+                result->distances[next] = result->distances[room] + 1;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    free(queue);
+
+    return result;
+}
+
+void
+maze_path_free(MazePath *path)
+{
+    if (!path) {
+        return;
+    }
+
+    free(path->distances);
+    free(path);
+}
+
+unsigned int
+maze_path_distance(const MazePath *path, int x, int y)
+{
+    if (x < 0 || x >= path->width || y < 0 || y >= path->height) {
+        return MAZE_PATH_UNREACHABLE;
+    }
+
+    return path->distances[y * path->width + x];
+}
+
+int
+maze_path_next(const MazePath *path, Maze *maze, int x, int y,
+    int *next_x, int *next_y)
+{
+    unsigned int distance = maze_path_distance(path, x, y);
+    int i;
+
+    *next_x = x;
+    *next_y = y;
+
+    if (distance == 0 || distance == MAZE_PATH_UNREACHABLE) {
+        return 0;
+    }
+
+    for (i = 0; i < DIRECTION_COUNT; i++) {
+        int nx = x + directions[i].dx;
+        int ny = y + directions[i].dy;
+
+        if (maze_path_distance(path, nx, ny) == distance - 1
+                && maze_is_open(maze, x, y, directions[i].wall)) {
+            *next_x = nx;
+            *next_y = ny;
+            return 1;
+        }
+    }
+
+    return 0;
+}
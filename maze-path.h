@@ -0,0 +1,84 @@
+#ifndef MAZE_PATH_H
+#define MAZE_PATH_H
+
+#include <maze/maze.h>
+
+/**
+ * The distance of a room from which the goal cannot be reached.
+ */
+#define MAZE_PATH_UNREACHABLE ((unsigned int)-1)
+
+/**
+ * The distance from every room of a maze to a goal room.
+ */
+typedef struct {
+    /** The dimensions of the maze */
+    unsigned int width, height;
+
+    /** The position of the goal */
+    int goal_x, goal_y;
+
+    /** The number of steps from every room to the goal, row by row */
+    unsigned int *distances;
+} MazePath;
+
+/**
+ * Calculates the distance from every room in a maze to a goal room.
+ *
+ * The distances are calculated with a breadth first search from the goal,
+ * so any doors opened after the maze was generated are taken into account.
+ * The maze must not be modified while the path is used.
+ *
+ * If this function completes successfully, maze_path_free must be called.
+ *
+ * @param maze
+ *     The maze.
+ * @param goal_x, goal_y
+ *     The goal room.
+ * @return a new path, or NULL upon failure
+ * @see maze_path_free
+ */
+MazePath*
+maze_path_create(Maze *maze, int goal_x, int goal_y);
+
+/**
+ * Releases a previously created path.
+ *
+ * @param path
+ *     The path to free.
+ */
+void
+maze_path_free(MazePath *path);
+
+/**
+ * Returns the distance from a room to the goal.
+ *
+ * @param path
+ *     The path.
+ * @param x, y
+ *     The room.
+ * @return the number of steps to the goal, or MAZE_PATH_UNREACHABLE if the
+ *     goal cannot be reached or the room is outside of the maze
+ */
+unsigned int
+maze_path_distance(const MazePath *path, int x, int y);
+
+/**
+ * Finds the next room on the shortest path to the goal.
+ *
+ * @param path
+ *     The path.
+ * @param maze
+ *     The maze for which the path was created.
+ * @param x, y
+ *     The current room.
+ * @param next_x, next_y
+ *     The next room. When the current room is the goal, or the goal cannot be
+ *     reached, this is set to the current room.
+ * @return non-zero if a next room was found and 0 otherwise
+ */
+int
+maze_path_next(const MazePath *path, Maze *maze, int x, int y,
+    int *next_x, int *next_y);
+
+#endif
@@ -0,0 +1,409 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "maze-swarm.h"
+#include "sphere.h"
+
+/* The acceleration along the direction of travel */
+#define SPEED 0.01f
+
+/* The strength with which objects keep to the centre of corridors */
+#define CENTERING 0.05f
+
+/* The velocity is multiplied with this value every step */
+#define RESISTANCE 0.8f
+
+/* The precision of the sphere approximation */
+#define SPHERE_PRECISION 8
+
+/* The number of objects updated together; the arrays are padded to a
+   multiple of this */
+#define VECTOR_SIZE (ARENA_ALIGNMENT / sizeof(float))
+
+/* The largest margin, leaving some room to move in every room */
+#define MARGIN_MAX 0.45f
+
+/* The bits of closed walls in a room */
+#define WALL_LEFT 0x01
+#define WALL_RIGHT 0x02
+#define WALL_UP 0x04
+#define WALL_DOWN 0x08
+
+static const struct {
+    float dx, dy;
+    MazeWall wall;
+    uint8_t bit;
+} directions[] = {
+    { -1.0f, 0.0f, MAZE_WALL_LEFT, WALL_LEFT },
+    { 1.0f, 0.0f, MAZE_WALL_RIGHT, WALL_RIGHT },
+    { 0.0f, -1.0f, MAZE_WALL_UP, WALL_UP },
+    { 0.0f, 1.0f, MAZE_WALL_DOWN, WALL_DOWN }};
+
+/**
+ * Returns a pseudo-random number.
+ *
+ * @param seed
+ *     The state of the generator, which is updated.
+ * @return a number
+ */
+static uint32_t
+maze_swarm_random(uint32_t *seed)
+{
+    uint32_t value = *seed;
+
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    *seed = value;
+
+    return value;
+}
+
+/**
+ * Chooses a new direction of travel for an object.
+ *
+ * @param swarm
+ *     The swarm.
+ * @param i
+ *     The index of the object.
+ * @param walls
+ *     The closed walls of the room of the object.
+ */
+static void
+maze_swarm_steer(MazeSwarm *swarm, unsigned int i, unsigned int walls)
+{
+    int candidates[4];
+    int count = 0, reverse = -1, d;
+
+    for (d = 0; d < 4; d++) {
+        if (walls & directions[d].bit) {
+            continue;
+        }
+        if (directions[d].dx == -swarm->dx[i]
+                && directions[d].dy == -swarm->dy[i]) {
+            reverse = d;
+            continue;
+        }
+        candidates[count++] = d;
+    }
+
+    /* Only turn back in dead ends */
+    if (count == 0) {
+        if (reverse < 0) {
+            swarm->dx[i] = swarm->dy[i] = 0.0f;
+            return;
+        }
+        candidates[count++] = reverse;
+    }
+
+    d = candidates[maze_swarm_random(&swarm->seed) % count];
+    swarm->dx[i] = directions[d].dx;
+    swarm->dy[i] = directions[d].dy;
+}
+
+MazeSwarm*
+maze_swarm_create(Maze *maze, unsigned int count, double margin)
+{
+    MazeSwarm *result;
+    size_t stride, size;
+    char *buffer;
+
+    result = malloc(sizeof(MazeSwarm));
+    if (!result) {
+        return NULL;
+    }
+    memset(result, 0, sizeof(MazeSwarm));
+
+    /* Keep every array in the same buffer, aligned for vector loads */
+    stride = arena_stride(count, sizeof(float));
+    size = 6 * stride + 2 * arena_stride(count, sizeof(int))
+        + arena_stride(maze->width * maze->height, sizeof(uint8_t));
+    if (posix_memalign(&result->buffer, ARENA_ALIGNMENT, size)) {
+        free(result);
+        return NULL;
+    }
+    memset(result->buffer, 0, size);
+    buffer = result->buffer;
+    result->x = (float*)buffer;
+    result->y = (float*)(buffer += stride);
+    result->vx = (float*)(buffer += stride);
+    result->vy = (float*)(buffer += stride);
+    result->dx = (float*)(buffer += stride);
+    result->dy = (float*)(buffer += stride);
+    result->room = (int*)(buffer += stride);
+    result->scratch = (int*)(buffer += arena_stride(count, sizeof(int)));
+    result->walls = (uint8_t*)(buffer + arena_stride(count, sizeof(int)));
+
+    result->count = count;
+    result->margin = margin + MAZE_SWARM_RADIUS < MARGIN_MAX
+        ? margin + MAZE_SWARM_RADIUS : MARGIN_MAX;
+    result->seed = (uint32_t)rand() | 1;
+
+    maze_swarm_reset(result, maze, NULL);
+
+    return result;
+}
+
+void
+maze_swarm_free(MazeSwarm *swarm)
+{
+    if (!swarm) {
+        return;
+    }
+
+    if (swarm->list) {
+        glDeleteLists(swarm->list, 1);
+    }
+    free(swarm->buffer);
+    free(swarm);
+}
+
+void
+maze_swarm_walls(Maze *maze, uint8_t *walls)
+{
+    unsigned int x, y;
+    int d;
+
+    /* The outer walls are always closed, so that objects do not leave
+       through the entrance or the exit */
+    for (y = 0; y < maze->height; y++) {
+        for (x = 0; x < maze->width; x++) {
+            uint8_t room = 0;
+
+            for (d = 0; d < 4; d++) {
+                int nx = (int)x + (int)directions[d].dx;
+                int ny = (int)y + (int)directions[d].dy;
+
+                if (nx < 0 || ny < 0 || nx >= maze->width
+                        || ny >= maze->height
+                        || !maze_is_open(maze, x, y, directions[d].wall)) {
+                    room |= directions[d].bit;
+                }
+            }
+            walls[y * maze->width + x] = room;
+        }
+    }
+}
+
+void
+maze_swarm_reset(MazeSwarm *swarm, Maze *maze, const uint8_t *walls)
+{
+    unsigned int i;
+
+    swarm->maze = maze;
+
+    /* Cache the walls */
+    if (walls) {
+        memcpy(swarm->walls, walls, maze->width * maze->height);
+    }
+    else {
+        maze_swarm_walls(maze, swarm->walls);
+    }
+
+    /* Scatter the objects in the centres of random rooms */
+    for (i = 0; i < swarm->count; i++) {
+        swarm->x[i] = maze_swarm_random(&swarm->seed) % maze->width + 0.5f;
+        swarm->y[i] = maze_swarm_random(&swarm->seed) % maze->height + 0.5f;
+        swarm->vx[i] = swarm->vy[i] = 0.0f;
+        swarm->dx[i] = swarm->dy[i] = 0.0f;
+        swarm->room[i] = -1;
+    }
+}
+
+/**
+ * Updates the velocities of objects.
+ *
+ * Objects accelerate along their direction of travel, and towards the centre
+ * of the corridor across it.
+ *
+ * @param count
+ *     The number of objects. This is a multiple of VECTOR_SIZE, so that the
+ *     loop needs no scalar remainder and is vectorised at -O2.
+ * @param x, y
+ *     The positions. They must not be negative.
+ * @param vx, vy
+ *     The velocities to update.
+ * @param dx, dy
+ *     The directions of travel.
+ */
+static void
+maze_swarm_accelerate(unsigned int count,
+    const float *restrict x, const float *restrict y,
+    float *restrict vx, float *restrict vy,
+    const float *restrict dx, const float *restrict dy)
+{
+    unsigned int i;
+
+    /* Let the compiler know that there is no remainder; positions are never
+       negative, so truncation finds the room */
+    count &= ~(VECTOR_SIZE - 1);
+    for (i = 0; i < count; i++) {
+        float ax = SPEED * dx[i] + CENTERING * (1.0f - fabsf(dx[i]))
+            * ((float)(int)x[i] + 0.5f - x[i]);
+        float ay = SPEED * dy[i] + CENTERING * (1.0f - fabsf(dy[i]))
+            * ((float)(int)y[i] + 0.5f - y[i]);
+
+        vx[i] = RESISTANCE * (vx[i] + ax);
+        vy[i] = RESISTANCE * (vy[i] + ay);
+    }
+}
+
+/**
+ * Moves objects, but keeps them clear of closed walls and of the corners of
+ * their room, where the walls of the neighbouring rooms meet.
+ *
+ * The tests select values instead of branching, so that the loop is
+ * vectorised at -O2.
+ *
+ * @param count
+ *     The number of objects. This is a multiple of VECTOR_SIZE.
+ * @param margin
+ *     The smallest distance between the centre of an object and a wall.
+ * @param x, y
+ *     The positions to update. They must not be negative.
+ * @param vx, vy
+ *     The velocities; they are cleared along an axis on which an object is
+ *     stopped.
+ * @param walls
+ *     The closed walls of the room of every object.
+ */
+static void
+maze_swarm_move(unsigned int count, float margin,
+    float *restrict x, float *restrict y,
+    float *restrict vx, float *restrict vy,
+    const int *restrict walls)
+{
+    unsigned int i;
+
+    count &= ~(VECTOR_SIZE - 1);
+    for (i = 0; i < count; i++) {
+        float rx = (float)(int)x[i];
+        float ry = (float)(int)y[i];
+        float nx = x[i] + vx[i];
+        float ny = y[i] + vy[i];
+        float x0 = rx + margin, x1 = rx + 1.0f - margin;
+        float y0 = ry + margin, y1 = ry + 1.0f - margin;
+
+        /* 1.0 where the new position is past a bound and 0.0 otherwise;
+           the conditions are kept as floats, since mixing them with the
+           integer wall bits prevents vectorisation */
+        float below_x = nx < x0 ? 1.0f : 0.0f;
+        float above_x = nx > x1 ? 1.0f : 0.0f;
+        float below_y = ny < y0 ? 1.0f : 0.0f;
+        float above_y = ny > y1 ? 1.0f : 0.0f;
+
+        /* Positive where an object is stopped by a closed wall, or by the
+           corner of the room when it also leaves along the other axis */
+        float left = below_x
+            * ((float)(walls[i] & WALL_LEFT) + below_y + above_y);
+        float right = above_x
+            * ((float)(walls[i] & WALL_RIGHT) + below_y + above_y);
+        float up = below_y
+            * ((float)(walls[i] & WALL_UP) + below_x + above_x);
+        float down = above_y
+            * ((float)(walls[i] & WALL_DOWN) + below_x + above_x);
+
+        x[i] = left > 0.0f ? x0 : right > 0.0f ? x1 : nx;
+        y[i] = up > 0.0f ? y0 : down > 0.0f ? y1 : ny;
+        vx[i] = left + right > 0.0f ? 0.0f : vx[i];
+        vy[i] = up + down > 0.0f ? 0.0f : vy[i];
+    }
+}
+
+/**
+ * Finds the room of every object.
+ *
+ * @param count
+ *     The number of objects. This is a multiple of VECTOR_SIZE, so that the
+ *     loop is vectorised at -O2.
+ * @param width
+ *     The width of the maze.
+ * @param x, y
+ *     The positions. They must not be negative.
+ * @param rooms
+ *     Receives the index of the room of every object.
+ */
+static void
+maze_swarm_locate(unsigned int count, int width,
+    const float *restrict x, const float *restrict y, int *restrict rooms)
+{
+    unsigned int i;
+
+    count &= ~(VECTOR_SIZE - 1);
+    for (i = 0; i < count; i++) {
+        rooms[i] = (int)y[i] * width + (int)x[i];
+    }
+}
+
+void
+maze_swarm_update(MazeSwarm *swarm)
+{
+    int width = swarm->maze->width;
+    int *scratch = swarm->scratch;
+    unsigned int count = swarm->count;
+    unsigned int padded = (count + VECTOR_SIZE - 1) & ~(VECTOR_SIZE - 1);
+    unsigned int i;
+
+    /* The arrays are padded to the alignment; the padding is updated along
+       with the objects, but never steered or drawn */
+    maze_swarm_accelerate(padded, swarm->x, swarm->y, swarm->vx, swarm->vy,
+        swarm->dx, swarm->dy);
+
+    /* Look up the walls around every object; this gather is the only part
+       of the collision test that is not vectorised */
+    maze_swarm_locate(padded, width, swarm->x, swarm->y, scratch);
+    for (i = 0; i < padded; i++) {
+        scratch[i] = swarm->walls[scratch[i]];
+    }
+    maze_swarm_move(padded, swarm->margin, swarm->x, swarm->y, swarm->vx,
+        swarm->vy, scratch);
+
+    /* Choose a new direction when entering a room */
+    maze_swarm_locate(padded, width, swarm->x, swarm->y, scratch);
+    for (i = 0; i < count; i++) {
+        if (scratch[i] != swarm->room[i]) {
+            swarm->room[i] = scratch[i];
+            maze_swarm_steer(swarm, i, swarm->walls[scratch[i]]);
+        }
+    }
+}
+
+unsigned int
+maze_swarm_render(MazeSwarm *swarm, double x, double y, double radius,
+    double z)
+{
+    float height = swarm->maze->height;
+    float x0 = x - radius, x1 = x + radius;
+    float y0 = y - radius, y1 = y + radius;
+    float px = 0.0f, py = 0.0f;
+    unsigned int i, result = 0;
+
+    if (!swarm->list) {
+        swarm->list = sphere_list_create(SPHERE_PRECISION, MAZE_SWARM_RADIUS);
+        if (!swarm->list) {
+            return 0;
+        }
+    }
+
+    /* Translate from one object to the next instead of pushing the matrix
+       for every object */
+    glPushMatrix();
+    glTranslatef(0.0, 0.0, z);
+    for (i = 0; i < swarm->count; i++) {
+        if (swarm->x[i] < x0 || swarm->x[i] > x1
+                || swarm->y[i] < y0 || swarm->y[i] > y1) {
+            continue;
+        }
+
+        glTranslatef(swarm->x[i] - px, (height - swarm->y[i]) - py, 0.0);
+        px = swarm->x[i];
+        py = height - swarm->y[i];
+        glCallList(swarm->list);
+        result++;
+    }
+    glPopMatrix();
+
+    return result;
+}
@@ -0,0 +1,152 @@
+#ifndef MAZE_SWARM_H
+#define MAZE_SWARM_H
+
+#include <stdint.h>
+
+#include <GL/gl.h>
+
+#include <maze/maze.h>
+
+/**
+ * The radius of an object in a swarm.
+ */
+#define MAZE_SWARM_RADIUS 0.1
+
+/**
+ * A swarm of objects wandering a maze on their own.
+ *
+ * The objects are stored as a structure of arrays so that the movement of
+ * all objects is updated in tight loops that the compiler may vectorise.
+ * Walls are looked up in a bitmask per room built when the maze is set, so
+ * collision detection does not call into libmaze.
+ *
+ * Every object travels in a direction chosen at random among the open doors
+ * whenever it enters a new room, avoiding turning back unless it is in a
+ * dead end.
+ */
+typedef struct {
+    /** The maze */
+    Maze *maze;
+
+    /** The number of objects */
+    unsigned int count;
+
+    /** The positions */
+    float *x, *y;
+
+    /** The velocities */
+    float *vx, *vy;
+
+    /** The directions of travel; each is -1.0, 0.0 or 1.0 */
+    float *dx, *dy;
+
+    /** The room in which each object last chose a direction, or -1 */
+    int *room;
+
+    /** The closed walls of the room of every object, and then the room
+        it has moved to, while the swarm is updated */
+    int *scratch;
+
+    /** The closed walls of every room, row by row */
+    uint8_t *walls;
+
+    /** The smallest distance between the centre of an object and a wall */
+    float margin;
+
+    /** The state of the random number generator */
+    uint32_t seed;
+
+    /** The display list drawing a single object, or 0 if it has not yet been
+        compiled */
+    GLuint list;
+
+    /** The buffer holding all arrays */
+    void *buffer;
+} MazeSwarm;
+
+/**
+ * Creates a swarm with its objects scattered across a maze.
+ *
+ * If this function completes successfully, maze_swarm_free must be called.
+ *
+ * @param maze
+ *     The maze. It must not be modified while the swarm is used.
+ * @param count
+ *     The number of objects.
+ * @param margin
+ *     The smallest distance between the centre of an object and a wall.
+ * @return a new swarm, or NULL upon failure
+ * @see maze_swarm_free
+ */
+MazeSwarm*
+maze_swarm_create(Maze *maze, unsigned int count, double margin);
+
+/**
+ * Releases a previously created swarm.
+ *
+ * @param swarm
+ *     The swarm to free.
+ */
+void
+maze_swarm_free(MazeSwarm *swarm);
+
+/**
+ * Calculates the closed walls of every room of a maze, as cached by a swarm.
+ *
+ * This does not use a swarm, so it may be called on any thread before the
+ * maze is passed to maze_swarm_reset.
+ *
+ * @param maze
+ *     The maze.
+ * @param walls
+ *     Receives the closed walls, one byte per room, row by row.
+ */
+void
+maze_swarm_walls(Maze *maze, uint8_t *walls);
+
+/**
+ * Moves a swarm to a new maze and scatters its objects across it.
+ *
+ * The new maze must have the same dimensions as the previous one.
+ *
+ * @param swarm
+ *     The swarm.
+ * @param maze
+ *     The new maze.
+ * @param walls
+ *     The closed walls of the new maze as calculated by maze_swarm_walls,
+ *     or NULL to calculate them here.
+ */
+void
+maze_swarm_reset(MazeSwarm *swarm, Maze *maze, const uint8_t *walls);
+
+/**
+ * Moves all objects one step.
+ *
+ * @param swarm
+ *     The swarm.
+ */
+void
+maze_swarm_update(MazeSwarm *swarm);
+
+/**
+ * Renders the objects close to a position as spheres.
+ *
+ * The objects are drawn at the same scale as libmaze renders the maze, with
+ * the y axis flipped.
+ *
+ * @param swarm
+ *     The swarm.
+ * @param x, y
+ *     The centre of the area to render.
+ * @param radius
+ *     The number of rooms around (x, y) to render.
+ * @param z
+ *     The height of the centre of the objects.
+ * @return the number of objects rendered
+ */
+unsigned int
+maze_swarm_render(MazeSwarm *swarm, double x, double y, double radius,
+    double z);
+
+#endif
@@ -0,0 +1,397 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+/* The number of histogram buckets; bucket i counts durations up to 2^i
+   microseconds, and the last bucket counts all longer durations */
+#define BUCKET_COUNT 20
+
+/* The maximum size of the text written to a client */
+#define REPORT_SIZE 32768
+
+/**
+ * The metrics recorded by a single thread.
+ *
+ * Every value is written only by its owning thread, and read by the serving
+ * thread without locking.
+ */
+typedef struct metrics_block {
+    /** The counters */
+    uint64_t counters[METRICS_COUNTER_COUNT];
+
+    /** The durations, as histogram buckets, sums in nanoseconds and counts */
+    uint64_t buckets[METRICS_STAGE_COUNT][BUCKET_COUNT + 1];
+    uint64_t sums[METRICS_STAGE_COUNT];
+    uint64_t counts[METRICS_STAGE_COUNT];
+
+    /** The next block */
+    struct metrics_block *next;
+} MetricsBlock;
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_names[METRICS_COUNTER_COUNT] = {
+    { "frames_rendered_total", "Frames rendered" },
+    { "frames_skipped_total", "Frames skipped by flood control" },
+    { "frames_idle_total", "Frames skipped because nothing changed" },
+    { "frames_reprojected_total",
+        "Frames whose depth was reprojected instead of rendered" },
+    { "timer_events_queued_total", "Display events queued by the timer" },
+    { "timer_events_coalesced_total",
+        "Timer ticks coalesced into a queued display event" },
+    { "uploaded_bytes_total", "Bytes uploaded to OpenGL" },
+    { "read_bytes_total", "Bytes read back from OpenGL" },
+    { "depth_primitives_total", "Primitives generated by the depth pass" },
+    { "depth_fragments_total",
+        "Fragments passing the depth test in the depth pass" }};
+
+static const char *stage_names[METRICS_STAGE_COUNT] = {
+    "pattern",
+    "draw",
+    "readback",
+    "reproject",
+    "stereogram",
+    "upload",
+    "swap",
+    "frame",
+    "input"};
+
+static const char *gauge_names[METRICS_GAUGE_COUNT] = {
+    "render_stereo",
+    "apply_texture",
+    "update_pattern",
+    "prevent_flooding"};
+
+/* All blocks ever created; blocks are never removed while serving */
+static MetricsBlock *blocks = NULL;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The block of the current thread */
+static __thread MetricsBlock *local = NULL;
+
+static int64_t gauges[METRICS_GAUGE_COUNT];
+
+static struct {
+    int fd;
+    char *path;
+    pthread_t thread;
+} server = { -1, NULL };
+
+/**
+ * Increments a value owned by the current thread.
+ *
+ * Only the owning thread writes the value, so a plain load and store
+ * suffices; they are atomic only so that concurrent readers never see a torn
+ * value.
+ */
+#define LOCAL_ADD(target, value) \
+    __atomic_store_n(&(target), \
+        __atomic_load_n(&(target), __ATOMIC_RELAXED) + (value), \
+        __ATOMIC_RELAXED)
+
+/**
+ * Returns the block of the current thread, creating it if necessary.
+ *
+ * @return the block, or NULL if it could not be allocated
+ */
+static MetricsBlock*
+metrics_local(void)
+{
+    MetricsBlock *block;
+
+    if (local) {
+        return local;
+    }
+
+    block = calloc(1, sizeof(MetricsBlock));
+    if (!block) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    __atomic_store_n(&blocks, block, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&blocks_lock);
+
+    local = block;
+
+    return block;
+}
+
+uint64_t
+metrics_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void
+metrics_add(MetricsCounter counter, uint64_t value)
+{
+    MetricsBlock *block = metrics_local();
+
+    if (block) {
+        LOCAL_ADD(block->counters[counter], value);
+    }
+}
+
+uint64_t
+metrics_observe(MetricsStage stage, uint64_t start)
+{
+    MetricsBlock *block = metrics_local();
+    uint64_t now = metrics_now();
+    uint64_t duration = now - start;
+    uint64_t microseconds = duration / 1000;
+    int bucket = 0;
+
+    if (!block) {
+        return now;
+    }
+
+    while (bucket < BUCKET_COUNT && microseconds >> bucket > 0) {
+        bucket++;
+    }
+
+    LOCAL_ADD(block->buckets[stage][bucket], 1);
+    LOCAL_ADD(block->sums[stage], duration);
+    LOCAL_ADD(block->counts[stage], 1);
+
+    return now;
+}
+
+void
+metrics_set(MetricsGauge gauge, int64_t value)
+{
+    __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sums a value across all blocks.
+ *
+ * @param offset
+ *     The offset of the value in a block.
+ * @return the sum
+ */
+static uint64_t
+metrics_sum(size_t offset)
+{
+    MetricsBlock *block;
+    uint64_t result = 0;
+
+    for (block = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); block;
+            block = block->next) {
+        result += __atomic_load_n((uint64_t*)((char*)block + offset),
+            __ATOMIC_RELAXED);
+    }
+
+    return result;
+}
+
+/**
+ * Writes all metrics in the Prometheus text format.
+ *
+ * @param buffer
+ *     The buffer to write to.
+ * @param size
+ *     The size of the buffer.
+ * @return the number of characters written
+ */
+static size_t
+metrics_format(char *buffer, size_t size)
+{
+    size_t length = 0;
+    int i, j;
+
+#define APPEND(...) \
+    do { \
+        if (length < size) { \
+            int count = snprintf(buffer + length, size - length, \
+                __VA_ARGS__); \
+            length += count > 0 ? (size_t)count : 0; \
+        } \
+    } while (0)
+
+    for (i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        APPEND("# HELP inamazing3d_%s %s.\n"
+            "# TYPE inamazing3d_%s counter\n"
+            "inamazing3d_%s %llu\n",
+            counter_names[i].name, counter_names[i].help,
+            counter_names[i].name,
+            counter_names[i].name, (unsigned long long)metrics_sum(
+                offsetof(MetricsBlock, counters[i])));
+    }
+
+    APPEND("# HELP inamazing3d_stage_duration_seconds Time spent in each "
+            "stage of a frame, and from input to display.\n"
+        "# TYPE inamazing3d_stage_duration_seconds histogram\n");
+    for (i = 0; i < METRICS_STAGE_COUNT; i++) {
+        uint64_t cumulative = 0;
+
+        for (j = 0; j <= BUCKET_COUNT; j++) {
+            cumulative += metrics_sum(offsetof(MetricsBlock, buckets[i][j]));
+            if (j < BUCKET_COUNT) {
+                APPEND("inamazing3d_stage_duration_seconds_bucket"
+                    "{stage=\"%s\",le=\"%g\"} %llu\n",
+                    stage_names[i], (double)(1 << j) / 1000000.0,
+                    (unsigned long long)cumulative);
+            }
+            else {
+                APPEND("inamazing3d_stage_duration_seconds_bucket"
+                    "{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                    stage_names[i], (unsigned long long)cumulative);
+            }
+        }
+        APPEND("inamazing3d_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n"
+            "inamazing3d_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+            stage_names[i],
+            metrics_sum(offsetof(MetricsBlock, sums[i])) / 1000000000.0,
+            stage_names[i], (unsigned long long)metrics_sum(
+                offsetof(MetricsBlock, counts[i])));
+    }
+
+    APPEND("# HELP inamazing3d_mode Whether a rendering mode is enabled.\n"
+        "# TYPE inamazing3d_mode gauge\n");
+    for (i = 0; i < METRICS_GAUGE_COUNT; i++) {
+        APPEND("inamazing3d_mode{mode=\"%s\"} %lld\n", gauge_names[i],
+            (long long)__atomic_load_n(&gauges[i], __ATOMIC_RELAXED));
+    }
+
+#undef APPEND
+
+    return length < size ? length : size - 1;
+}
+
+/**
+ * Accepts clients and writes the metrics to them until the socket is closed.
+ *
+ * @param data
+ *     Not used.
+ * @return NULL
+ */
+static void*
+metrics_thread(void *data)
+{
+    char *buffer = malloc(REPORT_SIZE);
+
+    (void)data;
+
+    if (!buffer) {
+        return NULL;
+    }
+
+    for (;;) {
+        int client = accept(server.fd, NULL, NULL);
+        size_t length, written;
+
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        length = metrics_format(buffer, REPORT_SIZE);
+        for (written = 0; written < length;) {
+            ssize_t count = send(client, buffer + written, length - written,
+                MSG_NOSIGNAL);
+
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            written += count;
+        }
+        close(client);
+    }
+
+    free(buffer);
+
+    return NULL;
+}
+
+int
+metrics_serve(const char *path)
+{
+    struct sockaddr_un address;
+    struct stat status;
+    int is_bound;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    /* Only replace a socket left behind by an earlier run */
+    if (!lstat(path, &status)) {
+        if (!S_ISSOCK(status.st_mode)) {
+            errno = EEXIST;
+            return 0;
+        }
+        unlink(path);
+    }
+
+    server.path = strdup(path);
+    if (!server.path) {
+        return 0;
+    }
+
+    server.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.fd < 0) {
+        free(server.path);
+        return 0;
+    }
+
+    is_bound = !bind(server.fd, (struct sockaddr*)&address, sizeof(address));
+    if (!is_bound || listen(server.fd, 4)
+            || pthread_create(&server.thread, NULL, metrics_thread, NULL)) {
+        int error = errno;
+
+        close(server.fd);
+        if (is_bound) {
+            unlink(path);
+        }
+        free(server.path);
+        server.fd = -1;
+        errno = error;
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+metrics_stop(void)
+{
+    if (server.fd < 0) {
+        return;
+    }
+
+    /* Wake the thread blocked in accept */
+    shutdown(server.fd, SHUT_RDWR);
+    pthread_join(server.thread, NULL);
+    close(server.fd);
+
+    unlink(server.path);
+    free(server.path);
+    server.fd = -1;
+}
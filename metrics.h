@@ -0,0 +1,168 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/**
+ * The counters collected.
+ */
+typedef enum {
+    /** The number of frames rendered */
+    METRICS_FRAMES_RENDERED,
+
+    /** The number of frames skipped because of flood control */
+    METRICS_FRAMES_SKIPPED,
+
+    /** The number of frames skipped because nothing had changed */
+    METRICS_FRAMES_IDLE,
+
+    /** The number of frames whose depth was reprojected from an earlier
+        frame instead of being rendered */
+    METRICS_FRAMES_REPROJECTED,
+
+    /** The number of display events queued by the timer */
+    METRICS_TIMER_EVENTS_QUEUED,
+
+    /** The number of timer ticks coalesced into an already queued display
+        event */
+    METRICS_TIMER_EVENTS_COALESCED,
+
+    /** The number of bytes uploaded to OpenGL */
+    METRICS_BYTES_UPLOADED,
+
+    /** The number of bytes read back from OpenGL */
+    METRICS_BYTES_READ,
+
+    /** The number of primitives generated by the depth pass */
+    METRICS_DEPTH_PRIMITIVES,
+
+    /** The number of fragments passing the depth test in the depth pass */
+    METRICS_DEPTH_FRAGMENTS,
+
+    METRICS_COUNTER_COUNT
+} MetricsCounter;
+
+/**
+ * The durations measured.
+ */
+typedef enum {
+    /** Applying the pattern effect */
+    METRICS_STAGE_PATTERN,
+
+    /** Drawing the maze and the target */
+    METRICS_STAGE_DRAW,
+
+    /** Reading back the depth buffer */
+    METRICS_STAGE_READBACK,
+
+    /** Reprojecting the depth buffer of an earlier frame */
+    METRICS_STAGE_REPROJECT,
+
+    /** Generating the stereogram */
+    METRICS_STAGE_STEREOGRAM,
+
+    /** Uploading textures */
+    METRICS_STAGE_UPLOAD,
+
+    /** Swapping buffers */
+    METRICS_STAGE_SWAP,
+
+    /** An entire frame, from the display event to the swap */
+    METRICS_STAGE_FRAME,
+
+    /** From the first input event handled after a frame to the swap of the
+        first frame displaying its effect */
+    METRICS_STAGE_INPUT,
+
+    METRICS_STAGE_COUNT
+} MetricsStage;
+
+/**
+ * The values reported as they are.
+ */
+typedef enum {
+    /** Whether stereogram mode is active */
+    METRICS_MODE_RENDER_STEREO,
+
+    /** Whether the pattern is used as texture in plain mode */
+    METRICS_MODE_APPLY_TEXTURE,
+
+    /** Whether the pattern is animated */
+    METRICS_MODE_UPDATE_PATTERN,
+
+    /** Whether flood control is enabled */
+    METRICS_MODE_PREVENT_FLOODING,
+
+    METRICS_GAUGE_COUNT
+} MetricsGauge;
+
+/**
+ * Returns the current time.
+ *
+ * @return a monotonic time stamp in nanoseconds
+ */
+uint64_t
+metrics_now(void);
+
+/**
+ * Adds to a counter.
+ *
+ * Counters are kept per thread, so this function is cheap and may be called
+ * from any thread.
+ *
+ * @param counter
+ *     The counter.
+ * @param value
+ *     The value to add.
+ */
+void
+metrics_add(MetricsCounter counter, uint64_t value);
+
+/**
+ * Records a duration.
+ *
+ * @param stage
+ *     The stage that was measured.
+ * @param start
+ *     The time stamp, as returned by metrics_now, when the stage started. The
+ *     stage is considered to end now.
+ * @return the current time, so that consecutive stages may be chained
+ */
+uint64_t
+metrics_observe(MetricsStage stage, uint64_t start);
+
+/**
+ * Sets a gauge.
+ *
+ * @param gauge
+ *     The gauge.
+ * @param value
+ *     The value.
+ */
+void
+metrics_set(MetricsGauge gauge, int64_t value);
+
+/**
+ * Starts serving metrics on a Unix domain socket.
+ *
+ * A thread is started that writes all metrics in the Prometheus text format
+ * to every client connecting to the socket, and then closes the connection.
+ *
+ * If this function completes successfully, metrics_stop must be called.
+ *
+ * @param path
+ *     The path of the socket. An existing socket is removed, but any other
+ *     existing file makes this function fail with errno set to EEXIST.
+ * @return non-zero upon success and 0 otherwise, in which case errno is set
+ * @see metrics_stop
+ */
+int
+metrics_serve(const char *path);
+
+/**
+ * Stops serving metrics and removes the socket.
+ */
+void
+metrics_stop(void);
+
+#endif
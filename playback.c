@@ -0,0 +1,160 @@
+#include <stdlib.h>
+
+#include "gl-state.h"
+#include "metrics.h"
+#include "playback.h"
+#include "stereogram-gl.h"
+#include "trace.h"
+
+/**
+ * Uploads the rows stored for a frame to the texture of a player.
+ *
+ * @param playback
+ *     The player.
+ * @param frame
+ *     The frame.
+ * @return non-zero upon success and 0 if the frame is corrupt
+ */
+static int
+playback_upload(Playback *playback, unsigned int frame)
+{
+    const RecordingRows *rows;
+    unsigned int count, i;
+    GLenum format, type;
+
+    rows = recording_frame(playback->recording, frame, &count);
+    if (!rows) {
+        return 0;
+    }
+
+    /* Rows are packed, and uploaded from client memory; uncompressed rows
+       straight from the mapped file */
+    stereogram_gl_format(playback->format, &format, &type);
+    gl_state_bind_texture(playback->texture);
+    gl_state_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    gl_state_pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    gl_state_pixel_store(GL_UNPACK_ROW_LENGTH, 0);
+    for (i = 0; i < count; i++) {
+        gl_state_tex_sub_image(0, rows[i].first, playback->width,
+            rows[i].count, format, type, rows[i].pixels);
+    }
+
+    return 1;
+}
+
+Playback*
+playback_create(const char *path)
+{
+    Playback *result;
+
+    result = calloc(1, sizeof(*result));
+    if (!result) {
+        return NULL;
+    }
+
+    result->recording = recording_open(path);
+    if (!result->recording) {
+        free(result);
+        return NULL;
+    }
+    result->frames = recording_info(result->recording, &result->width,
+        &result->height, &result->format);
+
+    return result;
+}
+
+void
+playback_initialize_gl(Playback *playback)
+{
+    GLenum format, type;
+
+    glGenTextures(1, &playback->texture);
+    gl_state_bind_texture(playback->texture);
+    gl_state_tex_filter(GL_LINEAR, GL_LINEAR);
+
+    /* Allocate the storage; every frame only updates part of it */
+    stereogram_gl_format(playback->format, &format, &type);
+    gl_state_tex_image(stereogram_gl_internal_format(playback->format),
+        playback->width, playback->height, format, type, NULL);
+
+    /* Indexed frames are expanded through the pixel maps on upload */
+    if (playback->format == STEREOGRAM_FORMAT_INDEXED) {
+        stereogram_gl_palette();
+    }
+
+    playback->frame = 0;
+    playback->start = 0;
+}
+
+void
+playback_free(Playback *playback)
+{
+    if (!playback) {
+        return;
+    }
+
+    glDeleteTextures(1, &playback->texture);
+    recording_free(playback->recording);
+    free(playback);
+
+    /* The deleted texture may have been bound */
+    gl_state_reset();
+}
+
+int
+playback_seek(Playback *playback, unsigned int frame)
+{
+    unsigned int i;
+
+    frame %= playback->frames;
+    for (i = recording_key_frame(playback->recording, frame); i < frame;
+            i++) {
+        if (!playback_upload(playback, i)) {
+            return 0;
+        }
+    }
+    playback->frame = frame;
+    playback->start = 0;
+
+    return 1;
+}
+
+int
+playback_render(Playback *playback)
+{
+    uint64_t start, elapsed;
+    int result = 1;
+
+    trace_begin("playback_render");
+
+    /* Start over after the last frame; the first frame is a key frame */
+    start = metrics_now();
+    if (playback->frame >= playback->frames) {
+        playback->frame = 0;
+        playback->start = 0;
+    }
+
+    /* Align the time of the next frame with now after creation or seeking */
+    if (!playback->start) {
+        playback->start = start - 1000 * recording_frame_time(
+            playback->recording, playback->frame);
+    }
+    elapsed = (start - playback->start) / 1000;
+
+    while (result && playback->frame < playback->frames
+            && recording_frame_time(playback->recording, playback->frame)
+                <= elapsed) {
+        result = playback_upload(playback, playback->frame++);
+    }
+    metrics_observe(METRICS_STAGE_UPLOAD, start);
+
+    /* Draw the frame over whatever was displayed before */
+    glClear(GL_DEPTH_BUFFER_BIT);
+    gl_state_enable(GL_TEXTURE_2D, 1);
+    gl_state_tex_env_mode(GL_MODULATE);
+    stereogram_gl_draw();
+
+    trace_end();
+
+    return result;
+}
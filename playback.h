@@ -0,0 +1,100 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <GL/gl.h>
+
+#include "recording.h"
+
+/**
+ * A player showing the frames of a recording in a loop.
+ *
+ * The frames are uploaded to a texture that keeps the previous frame, so
+ * only the rows that have changed are uploaded for every frame. Every frame
+ * is displayed at the time it was recorded, relative to the start of the
+ * loop, so pauses in the recording are kept.
+ */
+typedef struct {
+    /** The recording */
+    Recording *recording;
+
+    /** The dimensions and pixel format of the frames, and their number */
+    unsigned int width, height;
+    StereogramFormat format;
+    unsigned int frames;
+
+    /** The next frame to display */
+    unsigned int frame;
+
+    /** The time stamp, as returned by metrics_now, corresponding to the
+        start of the recording; this is 0 until the next frame is displayed
+        after creation or seeking */
+    uint64_t start;
+
+    /** The texture holding the current frame */
+    GLuint texture;
+} Playback;
+
+/**
+ * Opens a recording for playback.
+ *
+ * @param path
+ *     The recording file.
+ * @return a new player, or NULL if the file is not a valid recording
+ * @see playback_free
+ */
+Playback*
+playback_create(const char *path);
+
+/**
+ * Creates the texture of a player.
+ *
+ * This must be called on the thread owning the OpenGL context.
+ *
+ * @param playback
+ *     The player.
+ */
+void
+playback_initialize_gl(Playback *playback);
+
+/**
+ * Releases a player.
+ *
+ * @param playback
+ *     The player.
+ */
+void
+playback_free(Playback *playback);
+
+/**
+ * Makes a frame the next one to display.
+ *
+ * The frames from the previous key frame are uploaded, so that only the rows
+ * of the frame itself are left for playback_render. Seeking to a key frame
+ * uploads nothing. Playback continues at the pace of the recording from the
+ * frame.
+ *
+ * @param playback
+ *     The player.
+ * @param frame
+ *     The frame; this wraps around the number of frames.
+ * @return non-zero upon success and 0 if the recording is corrupt
+ */
+int
+playback_seek(Playback *playback, unsigned int frame);
+
+/**
+ * Uploads the frames that are due and draws the last one over the whole
+ * viewport.
+ *
+ * Every frame up to the current time is uploaded, since frames only store
+ * the rows that have changed; if no frame is due, the previous one is drawn
+ * again. After the last frame, playback starts over.
+ *
+ * @param playback
+ *     The player.
+ * @return non-zero upon success and 0 if the recording is corrupt
+ */
+int
+playback_render(Playback *playback);
+
+#endif
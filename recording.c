@@ -0,0 +1,798 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "recording.h"
+
+/* The identification and version of the file format */
+#define RECORDING_MAGIC "IA3DREC"
+#define RECORDING_VERSION 2
+
+/* The alignment of runs and of the index in the file, so that they may be
+   read straight from the mapping */
+#define RECORDING_ALIGNMENT 8
+
+/* Unchanged rows between two changed ones are stored with them if there are
+   at most this many, since every run costs an upload */
+#define RUN_GAP 4
+
+/* The largest dimension of a frame accepted when opening a file */
+#define DIMENSION_MAX 16384
+
+/* The parameters of the compression; matches are at least LZ_MATCH_MIN bytes
+   long and at most LZ_OFFSET_MAX bytes back, and candidates are found through
+   a hash table of 1 << LZ_HASH_BITS entries */
+#define LZ_MATCH_MIN 4
+#define LZ_OFFSET_MAX 65535
+#define LZ_HASH_BITS 12
+
+/**
+ * The way in which the pixels of a run are stored.
+ */
+enum recording_encoding {
+    /** The pixels are stored as is */
+    ENCODING_RAW,
+
+    /** The pixels are compressed with lz_compress */
+    ENCODING_LZ
+};
+
+/**
+ * The header at the start of a file.
+ */
+struct recording_header {
+    /** RECORDING_MAGIC, including the terminating zero */
+    char magic[8];
+
+    /** RECORDING_VERSION */
+    uint32_t version;
+
+    /** The dimensions and pixel format of the frames */
+    uint32_t width, height, format;
+
+    /** The number of frames between key frames */
+    uint32_t key_interval;
+
+    /** The number of frames */
+    uint32_t frames;
+
+    /** The offset of the index; this is 0 until the file is complete */
+    uint64_t index_offset;
+};
+
+/**
+ * The header of a run of rows.
+ */
+struct recording_run {
+    /** The first row, and the number of rows */
+    uint32_t first, count;
+
+    /** The recording_encoding of the pixels */
+    uint32_t encoding;
+
+    /** The number of bytes of pixels following the header, not including
+        the padding to RECORDING_ALIGNMENT */
+    uint32_t size;
+};
+
+/**
+ * The entry of a frame in the index.
+ */
+struct recording_entry {
+    /** The offset of the first run of the frame */
+    uint64_t offset;
+
+    /** The total size of the runs, and their number */
+    uint32_t size, runs;
+
+    /** The time at which the frame was displayed, in microseconds from the
+        first frame */
+    uint64_t time;
+};
+
+struct recording_writer {
+    /** The file being written, and the current offset in it */
+    FILE *file;
+    uint64_t offset;
+
+    /** Whether all writes have succeeded */
+    int is_valid;
+
+    /** The dimensions and pixel format of the frames, and the size of a
+        row in bytes */
+    unsigned int width, height;
+    StereogramFormat format;
+    unsigned int row_size;
+
+    /** The time stamp of the first frame */
+    uint64_t start;
+
+    /** The previous frame, with packed rows */
+    uint8_t *previous;
+
+    /** The buffer receiving compressed runs */
+    uint8_t *compressed;
+
+    /** The hash table used by lz_compress */
+    uint32_t *table;
+
+    /** The index, and the number of entries allocated */
+    struct recording_entry *index;
+    unsigned int frames, capacity;
+};
+
+struct recording {
+    /** The mapped file */
+    const uint8_t *data;
+    size_t size;
+
+    /** The header and the index, within the mapping */
+    const struct recording_header *header;
+    const struct recording_entry *index;
+
+    /** The size of a row in bytes */
+    unsigned int row_size;
+
+    /** The buffer to which compressed rows are expanded */
+    uint8_t *pixels;
+
+    /** The runs of the last frame retrieved; there are at most as many as
+        rows */
+    RecordingRows *rows;
+};
+
+/**
+ * Reads four bytes at any alignment.
+ *
+ * @param data
+ *     The bytes.
+ * @return the bytes as an integer
+ */
+static uint32_t
+lz_read32(const uint8_t *data)
+{
+    uint32_t result;
+
+    memcpy(&result, data, sizeof(result));
+
+    return result;
+}
+
+/**
+ * Writes a length that did not fit in the nibble of a token.
+ *
+ * @param target
+ *     The output.
+ * @param length
+ *     The part of the length exceeding 14.
+ * @return the output following the length
+ */
+static uint8_t*
+lz_write_length(uint8_t *target, size_t length)
+{
+    while (length >= 255) {
+        *target++ = 255;
+        length -= 255;
+    }
+    *target++ = length;
+
+    return target;
+}
+
+/**
+ * Writes a sequence of literals optionally followed by a match.
+ *
+ * A sequence starts with a token byte whose upper nibble is the number of
+ * literals and whose lower nibble is the length of the match minus
+ * LZ_MATCH_MIN; a nibble of 15 is followed by bytes adding to it, up to and
+ * including the first byte that is not 255. The literals follow, and then,
+ * unless the sequence is the last one, the offset of the match as two bytes,
+ * least significant first, and the rest of its length.
+ *
+ * @param target
+ *     The output.
+ * @param end
+ *     The end of the output buffer.
+ * @param literals, literal_count
+ *     The literals.
+ * @param offset, length
+ *     The distance back to the match, and its length; length is 0 for the
+ *     last sequence.
+ * @return the output following the sequence, or NULL if it does not fit
+ */
+static uint8_t*
+lz_write_sequence(uint8_t *target, const uint8_t *end,
+    const uint8_t *literals, size_t literal_count, size_t offset,
+    size_t length)
+{
+    size_t match = length > 0 ? length - LZ_MATCH_MIN : 0;
+    uint8_t *token = target;
+
+    /* Make sure that the longest encoding of the sequence fits */
+    if ((size_t)(end - target) < 1 + literal_count / 255 + 1 + literal_count
+            + 2 + match / 255 + 1) {
+        return NULL;
+    }
+
+    target++;
+    if (literal_count >= 15) {
+        *token = 15 << 4;
+        target = lz_write_length(target, literal_count - 15);
+    }
+    else {
+        *token = literal_count << 4;
+    }
+    memcpy(target, literals, literal_count);
+    target += literal_count;
+
+    if (length > 0) {
+        *target++ = offset & 0xFF;
+        *target++ = offset >> 8;
+        if (match >= 15) {
+            *token |= 15;
+            target = lz_write_length(target, match - 15);
+        }
+        else {
+            *token |= match;
+        }
+    }
+
+    return target;
+}
+
+/**
+ * Compresses bytes.
+ *
+ * @param source, size
+ *     The bytes to compress.
+ * @param target, capacity
+ *     The buffer receiving the compressed bytes.
+ * @param table
+ *     A hash table of 1 << LZ_HASH_BITS entries.
+ * @return the size of the compressed bytes, or 0 if they do not fit
+ */
+static size_t
+lz_compress(const uint8_t *source, size_t size, uint8_t *target,
+    size_t capacity, uint32_t *table)
+{
+    const uint8_t *end = target + capacity;
+    uint8_t *output = target;
+    size_t anchor = 0, i = 0;
+
+    /* The table holds the position following the last occurrence of every
+       hashed sequence, or 0 */
+    memset(table, 0, sizeof(*table) << LZ_HASH_BITS);
+
+    while (i + LZ_MATCH_MIN <= size) {
+        uint32_t sequence = lz_read32(source + i);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        size_t length;
+
+        table[hash] = i + 1;
+        if (!candidate || i + 1 - candidate > LZ_OFFSET_MAX
+                || lz_read32(source + candidate - 1) != sequence) {
+            i++;
+            continue;
+        }
+
+        candidate--;
+        length = LZ_MATCH_MIN;
+        while (i + length < size
+                && source[candidate + length] == source[i + length]) {
+            length++;
+        }
+
+        output = lz_write_sequence(output, end, source + anchor, i - anchor,
+            i - candidate, length);
+        if (!output) {
+            return 0;
+        }
+        i += length;
+        anchor = i;
+    }
+
+    output = lz_write_sequence(output, end, source + anchor, size - anchor,
+        0, 0);
+
+    return output ? (size_t)(output - target) : 0;
+}
+
+/**
+ * Reads a length that did not fit in the nibble of a token.
+ *
+ * @param source
+ *     The input; this is advanced past the length.
+ * @param end
+ *     The end of the input.
+ * @param length
+ *     The length read from the nibble, to which the rest is added.
+ * @return non-zero upon success and 0 if the input ends
+ */
+static int
+lz_read_length(const uint8_t **source, const uint8_t *end, size_t *length)
+{
+    uint8_t value;
+
+    do {
+        if (*source >= end) {
+            return 0;
+        }
+        value = *(*source)++;
+        *length += value;
+    } while (value == 255);
+
+    return 1;
+}
+
+/**
+ * Expands bytes compressed with lz_compress.
+ *
+ * @param source, size
+ *     The compressed bytes.
+ * @param target, expected
+ *     The buffer receiving the expanded bytes, and their expected number.
+ * @return non-zero if exactly the expected number of bytes was expanded and
+ *     0 if the input is corrupt
+ */
+static int
+lz_decompress(const uint8_t *source, size_t size, uint8_t *target,
+    size_t expected)
+{
+    const uint8_t *end = source + size;
+    size_t output = 0;
+
+    while (source < end) {
+        uint8_t token = *source++;
+        size_t length = token >> 4;
+        size_t offset;
+
+        /* Copy the literals */
+        if (length == 15 && !lz_read_length(&source, end, &length)) {
+            return 0;
+        }
+        if (length > (size_t)(end - source) || length > expected - output) {
+            return 0;
+        }
+        memcpy(target + output, source, length);
+        source += length;
+        output += length;
+
+        /* The last sequence has no match */
+        if (source == end) {
+            break;
+        }
+
+        /* Copy the match; it may overlap the bytes being written, in which
+           case it is copied one period at a time */
+        if (end - source < 2) {
+            return 0;
+        }
+        offset = source[0] | source[1] << 8;
+        source += 2;
+        length = (token & 15) + LZ_MATCH_MIN;
+        if ((token & 15) == 15 && !lz_read_length(&source, end, &length)) {
+            return 0;
+        }
+        if (offset == 0 || offset > output || length > expected - output) {
+            return 0;
+        }
+        while (length > 0) {
+            size_t count = length < offset ? length : offset;
+
+            memcpy(target + output, target + output - offset, count);
+            output += count;
+            length -= count;
+        }
+    }
+
+    return output == expected;
+}
+
+/**
+ * Writes bytes to a recording, padded to RECORDING_ALIGNMENT.
+ *
+ * @param writer
+ *     The writer.
+ * @param data, size
+ *     The bytes.
+ */
+static void
+recording_writer_write(RecordingWriter *writer, const void *data,
+    size_t size)
+{
+    static const uint8_t padding[RECORDING_ALIGNMENT];
+    size_t padding_size = -size & (RECORDING_ALIGNMENT - 1);
+
+    if (fwrite(data, 1, size, writer->file) != size
+            || fwrite(padding, 1, padding_size, writer->file)
+                != padding_size) {
+        writer->is_valid = 0;
+    }
+    writer->offset += size + padding_size;
+}
+
+/**
+ * Writes a run of rows of the previous frame.
+ *
+ * The rows are compressed if that makes them smaller.
+ *
+ * @param writer
+ *     The writer.
+ * @param first, count
+ *     The rows.
+ * @return the number of bytes written
+ */
+static size_t
+recording_writer_run(RecordingWriter *writer, unsigned int first,
+    unsigned int count)
+{
+    const uint8_t *pixels = writer->previous + first * writer->row_size;
+    struct recording_run run;
+    uint64_t start = writer->offset;
+    size_t size;
+
+    run.first = first;
+    run.count = count;
+    run.size = count * writer->row_size;
+    size = lz_compress(pixels, run.size, writer->compressed, run.size - 1,
+        writer->table);
+    if (size > 0) {
+        run.encoding = ENCODING_LZ;
+        run.size = size;
+        pixels = writer->compressed;
+    }
+    else {
+        run.encoding = ENCODING_RAW;
+    }
+
+    recording_writer_write(writer, &run, sizeof(run));
+    recording_writer_write(writer, pixels, run.size);
+
+    return writer->offset - start;
+}
+
+/**
+ * Writes the header of a recording at the start of the file.
+ *
+ * @param writer
+ *     The writer.
+ * @param index_offset
+ *     The offset of the index, or 0 if the recording is not complete.
+ */
+static void
+recording_writer_header(RecordingWriter *writer, uint64_t index_offset)
+{
+    struct recording_header header;
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, RECORDING_MAGIC);
+    header.version = RECORDING_VERSION;
+    header.width = writer->width;
+    header.height = writer->height;
+    header.format = writer->format;
+    header.key_interval = RECORDING_KEY_INTERVAL;
+    header.frames = writer->frames;
+    header.index_offset = index_offset;
+
+    if (fseek(writer->file, 0, SEEK_SET)) {
+        writer->is_valid = 0;
+        return;
+    }
+    writer->offset = 0;
+    recording_writer_write(writer, &header, sizeof(header));
+}
+
+RecordingWriter*
+recording_writer_create(const char *path, unsigned int width,
+    unsigned int height, StereogramFormat format)
+{
+    RecordingWriter *result;
+    size_t frame_size;
+
+    result = calloc(1, sizeof(*result));
+    if (!result) {
+        return NULL;
+    }
+
+    result->width = width;
+    result->height = height;
+    result->format = format;
+    result->row_size = width * stereogram_pixel_size(format);
+    result->is_valid = 1;
+
+    frame_size = (size_t)height * result->row_size;
+    result->previous = malloc(frame_size);
+    result->compressed = malloc(frame_size);
+    result->table = malloc(sizeof(*result->table) << LZ_HASH_BITS);
+    result->file = fopen(path, "wb");
+    if (!result->previous || !result->compressed || !result->table
+            || !result->file) {
+        if (result->file) {
+            fclose(result->file);
+        }
+        free(result->previous);
+        free(result->compressed);
+        free(result->table);
+        free(result);
+        return NULL;
+    }
+
+    /* The header is written again with the index offset once the recording
+       is complete */
+    recording_writer_header(result, 0);
+
+    return result;
+}
+
+int
+recording_writer_add(RecordingWriter *writer, const void *pixels,
+    unsigned int pixels_stride, uint64_t time)
+{
+    unsigned int stride = pixels_stride * stereogram_pixel_size(
+        writer->format);
+    int is_key = writer->frames % RECORDING_KEY_INTERVAL == 0;
+    struct recording_entry entry;
+    unsigned int row, first, last;
+
+    /* Make room in the index */
+    if (writer->frames == writer->capacity) {
+        unsigned int capacity = writer->capacity ? 2 * writer->capacity : 256;
+        struct recording_entry *index = realloc(writer->index,
+            capacity * sizeof(*index));
+
+        if (!index) {
+            return 0;
+        }
+        writer->index = index;
+        writer->capacity = capacity;
+    }
+
+    if (writer->frames == 0) {
+        writer->start = time;
+    }
+    entry.offset = writer->offset;
+    entry.size = 0;
+    entry.runs = 0;
+    entry.time = (time - writer->start) / 1000;
+
+    for (row = 0; row < writer->height; row = last + 1) {
+        /* Find the next changed row, and the last changed row before the
+           next gap of unchanged rows longer than RUN_GAP */
+        first = row;
+        if (is_key) {
+            last = writer->height - 1;
+        }
+        else {
+            while (first < writer->height && memcmp(
+                    writer->previous + first * writer->row_size,
+                    (const uint8_t*)pixels + first * stride,
+                    writer->row_size) == 0) {
+                first++;
+            }
+            if (first == writer->height) {
+                break;
+            }
+            last = first;
+            for (row = first + 1; row < writer->height
+                    && row - last <= RUN_GAP; row++) {
+                if (memcmp(writer->previous + row * writer->row_size,
+                        (const uint8_t*)pixels + row * stride,
+                        writer->row_size) != 0) {
+                    last = row;
+                }
+            }
+        }
+
+        /* Keep the rows as the previous frame, and write them from there */
+        for (row = first; row <= last; row++) {
+            memcpy(writer->previous + row * writer->row_size,
+                (const uint8_t*)pixels + row * stride, writer->row_size);
+        }
+        entry.size += recording_writer_run(writer, first, last - first + 1);
+        entry.runs++;
+    }
+
+    writer->index[writer->frames++] = entry;
+
+    return writer->is_valid;
+}
+
+int
+recording_writer_close(RecordingWriter *writer)
+{
+    uint64_t index_offset = writer->offset;
+    int result;
+
+    recording_writer_write(writer, writer->index,
+        writer->frames * sizeof(*writer->index));
+    recording_writer_header(writer, index_offset);
+    result = writer->is_valid;
+    if (fclose(writer->file)) {
+        result = 0;
+    }
+
+    free(writer->previous);
+    free(writer->compressed);
+    free(writer->table);
+    free(writer->index);
+    free(writer);
+
+    return result;
+}
+
+Recording*
+recording_open(const char *path)
+{
+    Recording *result;
+    const struct recording_header *header;
+    struct stat info;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &info) || (size_t)info.st_size < sizeof(*header)) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Only accept complete files for this version whose index lies within
+       the file */
+    header = data;
+    if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0
+            || header->version != RECORDING_VERSION
+            || header->width == 0 || header->width > DIMENSION_MAX
+            || header->height == 0 || header->height > DIMENSION_MAX
+            || header->format > STEREOGRAM_FORMAT_INDEXED
+            || header->key_interval == 0 || header->frames == 0
+            || header->index_offset < sizeof(*header)
+            || header->index_offset % RECORDING_ALIGNMENT != 0
+            || header->index_offset > (uint64_t)info.st_size
+            || ((uint64_t)info.st_size - header->index_offset)
+                / sizeof(struct recording_entry) < header->frames) {
+        munmap(data, info.st_size);
+        return NULL;
+    }
+
+    result = calloc(1, sizeof(*result));
+    if (!result) {
+        munmap(data, info.st_size);
+        return NULL;
+    }
+    result->data = data;
+    result->size = info.st_size;
+    result->header = header;
+    result->index = (const struct recording_entry*)(result->data
+        + header->index_offset);
+    result->row_size = header->width * stereogram_pixel_size(header->format);
+    result->pixels = malloc((size_t)header->height * result->row_size);
+    result->rows = malloc(header->height * sizeof(*result->rows));
+    if (!result->pixels || !result->rows) {
+        recording_free(result);
+        return NULL;
+    }
+
+    /* Frames are mostly read in order */
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    return result;
+}
+
+void
+recording_free(Recording *recording)
+{
+    if (!recording) {
+        return;
+    }
+
+    munmap((void*)recording->data, recording->size);
+    free(recording->pixels);
+    free(recording->rows);
+    free(recording);
+}
+
+unsigned int
+recording_info(const Recording *recording, unsigned int *width,
+    unsigned int *height, StereogramFormat *format)
+{
+    *width = recording->header->width;
+    *height = recording->header->height;
+    *format = recording->header->format;
+
+    return recording->header->frames;
+}
+
+unsigned int
+recording_key_frame(const Recording *recording, unsigned int frame)
+{
+    return frame - frame % recording->header->key_interval;
+}
+
+uint64_t
+recording_frame_time(const Recording *recording, unsigned int frame)
+{
+    return recording->index[frame].time;
+}
+
+const RecordingRows*
+recording_frame(Recording *recording, unsigned int frame,
+    unsigned int *count)
+{
+    const struct recording_entry *entry;
+    const uint8_t *data, *end;
+    unsigned int i;
+
+    if (frame >= recording->header->frames) {
+        return NULL;
+    }
+    entry = &recording->index[frame];
+    if (entry->offset < sizeof(*recording->header)
+            || entry->offset % RECORDING_ALIGNMENT != 0
+            || entry->offset > recording->header->index_offset
+            || entry->size > recording->header->index_offset - entry->offset
+            || entry->runs > recording->header->height) {
+        return NULL;
+    }
+
+    data = recording->data + entry->offset;
+    end = data + entry->size;
+    for (i = 0; i < entry->runs; i++) {
+        const struct recording_run *run = (const struct recording_run*)data;
+        RecordingRows *rows = &recording->rows[i];
+        size_t size;
+
+        if ((size_t)(end - data) < sizeof(*run)) {
+            return NULL;
+        }
+        data += sizeof(*run);
+        if (run->count == 0 || run->first >= recording->header->height
+                || run->count > recording->header->height - run->first
+                || run->size > (size_t)(end - data)) {
+            return NULL;
+        }
+
+        rows->first = run->first;
+        rows->count = run->count;
+        size = (size_t)run->count * recording->row_size;
+        switch (run->encoding) {
+        case ENCODING_RAW:
+            if (run->size != size) {
+                return NULL;
+            }
+            rows->pixels = data;
+            break;
+
+        case ENCODING_LZ:
+            rows->pixels = recording->pixels
+                + (size_t)run->first * recording->row_size;
+            if (!lz_decompress(data, run->size, (uint8_t*)rows->pixels,
+                    size)) {
+                return NULL;
+            }
+            break;
+
+        default:
+            return NULL;
+        }
+
+        /* Skip the padding */
+        size = run->size + (-run->size & (RECORDING_ALIGNMENT - 1));
+        data += size < (size_t)(end - data) ? size : (size_t)(end - data);
+    }
+
+    *count = entry->runs;
+
+    return recording->rows;
+}
@@ -0,0 +1,178 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stereogram.h"
+
+/**
+ * The number of frames between key frames.
+ *
+ * A key frame stores every row of the image, so that playback may start
+ * there; every other frame only stores the rows that differ from the
+ * previous frame.
+ */
+#define RECORDING_KEY_INTERVAL 250
+
+/**
+ * A file of stereogram frames being written.
+ *
+ * The file starts with a header, followed by the frames and an index of the
+ * frames. A frame is a sequence of runs of consecutive rows; every run has a
+ * small header giving its first row, its number of rows and how its pixels
+ * are stored, followed by the pixels themselves, either as is or compressed
+ * with a byte oriented LZ77 scheme in the manner of LZ4. The index gives the
+ * offset, size and time of every frame, so that any frame may be found
+ * without reading the ones before it, and played back at the pace at which
+ * it was recorded. All values are stored in the byte order of the
+ * host.
+ */
+typedef struct recording_writer RecordingWriter;
+
+/**
+ * A file of stereogram frames opened for playback.
+ *
+ * The file is mapped into memory, and rows that are not compressed are
+ * returned straight from the mapping.
+ */
+typedef struct recording Recording;
+
+/**
+ * A run of consecutive rows of a frame.
+ */
+typedef struct {
+    /** The first row, and the number of rows */
+    unsigned int first, count;
+
+    /** The pixels of the rows, which are packed */
+    const void *pixels;
+} RecordingRows;
+
+/**
+ * Creates a recording file.
+ *
+ * @param path
+ *     The file to write. It is replaced if it exists.
+ * @param width, height
+ *     The dimensions of the frames.
+ * @param format
+ *     The pixel format of the frames.
+ * @return a new writer, or NULL upon failure
+ * @see recording_writer_close
+ */
+RecordingWriter*
+recording_writer_create(const char *path, unsigned int width,
+    unsigned int height, StereogramFormat format);
+
+/**
+ * Appends a frame to a recording.
+ *
+ * Only the rows that differ from the previous frame are written, unless the
+ * frame is a key frame.
+ *
+ * @param writer
+ *     The writer.
+ * @param pixels
+ *     The pixels of the frame.
+ * @param pixels_stride
+ *     The distance between two rows of the frame, in pixels.
+ * @param time
+ *     The time at which the frame is displayed, as returned by metrics_now.
+ * @return non-zero upon success and 0 if the file could not be written
+ */
+int
+recording_writer_add(RecordingWriter *writer, const void *pixels,
+    unsigned int pixels_stride, uint64_t time);
+
+/**
+ * Completes a recording by writing its index, and releases the writer.
+ *
+ * @param writer
+ *     The writer.
+ * @return non-zero upon success and 0 if the file could not be written
+ */
+int
+recording_writer_close(RecordingWriter *writer);
+
+/**
+ * Opens a recording for playback.
+ *
+ * @param path
+ *     The file to open.
+ * @return the recording, or NULL if the file cannot be read or is not a
+ *     complete recording
+ * @see recording_free
+ */
+Recording*
+recording_open(const char *path);
+
+/**
+ * Releases a recording opened with recording_open.
+ *
+ * @param recording
+ *     The recording.
+ */
+void
+recording_free(Recording *recording);
+
+/**
+ * Retrieves the dimensions and the pixel format of the frames of a
+ * recording.
+ *
+ * @param recording
+ *     The recording.
+ * @param width, height
+ *     Receive the dimensions of the frames.
+ * @param format
+ *     Receives the pixel format.
+ * @return the number of frames
+ */
+unsigned int
+recording_info(const Recording *recording, unsigned int *width,
+    unsigned int *height, StereogramFormat *format);
+
+/**
+ * Returns the key frame from which a frame may be reconstructed.
+ *
+ * @param recording
+ *     The recording.
+ * @param frame
+ *     The frame.
+ * @return the last key frame not after the frame
+ */
+unsigned int
+recording_key_frame(const Recording *recording, unsigned int frame);
+
+/**
+ * Returns the time at which a frame was displayed.
+ *
+ * @param recording
+ *     The recording.
+ * @param frame
+ *     The frame.
+ * @return the time in microseconds from the first frame
+ */
+uint64_t
+recording_frame_time(const Recording *recording, unsigned int frame);
+
+/**
+ * Retrieves the rows stored for a frame.
+ *
+ * Applying the rows to the previous frame gives the frame; for a key frame,
+ * all rows are returned. Compressed rows are expanded to a buffer owned by
+ * the recording, so the rows are valid until this function is called again.
+ *
+ * @param recording
+ *     The recording.
+ * @param frame
+ *     The frame.
+ * @param count
+ *     Receives the number of runs.
+ * @return the runs of changed rows, or NULL if the frame is corrupt
+ */
+const RecordingRows*
+recording_frame(Recording *recording, unsigned int frame,
+    unsigned int *count);
+
+#endif
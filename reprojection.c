@@ -0,0 +1,961 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "reprojection.h"
+
+/* The number of rows processed by a thread at a time */
+#define BAND_HEIGHT 16
+
+/* The keys of the pixels of a new frame: the nearest depth value landing on
+   a pixel is stored as its complement, so that larger keys are nearer, and
+   the two smallest keys mark pixels that nothing landed on and pixels
+   showing the background */
+#define KEY_HOLE 0
+#define KEY_BACKGROUND 1
+
+/* The largest difference between the depth values on either side of a
+   single pixel crack for it to be filled with their average */
+#define CRACK_TOLERANCE 1024
+
+/* The reference pixels within this factor of the radius of the object from
+   its centre are considered part of it */
+#define OBJECT_MARGIN 1.15
+
+/* The number of values transformed together; the rows of the reference frame
+   and of the scratch buffers are padded to a multiple of this */
+#define VECTOR_SIZE (ARENA_ALIGNMENT / sizeof(float))
+
+/**
+ * The stages of the work on a new frame, each of which is run over all rows
+ * before the next one starts.
+ */
+enum reprojection_stage {
+    /** Transform the rows of the reference frame and keep the nearest value
+        landing on every pixel */
+    REPROJECTION_STAGE_SPLAT,
+
+    /** Fill cracks, draw the object and count the holes */
+    REPROJECTION_STAGE_FILL,
+
+    /** Trace the holes and convert the keys to depth values */
+    REPROJECTION_STAGE_RESOLVE
+};
+
+/**
+ * A worker thread of a reprojection.
+ */
+struct reprojection_worker {
+    /** The reprojection */
+    struct reprojection *reprojection;
+
+    /** The thread */
+    pthread_t thread;
+
+    /** The buffer holding the transformed coordinates of a row */
+    float *scratch;
+};
+
+struct reprojection {
+    /** The dimensions of the depth buffers */
+    unsigned int width, height;
+
+    /** The distance between the rows of transformed coordinates in a
+        scratch buffer, in values */
+    unsigned int scratch_stride;
+
+    /** Whether there is a reference frame */
+    int is_valid;
+
+    /** The depth values of the reference frame, the distance between their
+        rows in values, and its view; the padding of the rows is zero */
+    uint16_t *reference;
+    unsigned int reference_stride;
+    ReprojectionView reference_view;
+
+    /** The transformation from the clip coordinates of the reference frame
+        to world coordinates */
+    double reference_inverse[16];
+
+    /** The keys of the new frame, and its depth values */
+    uint16_t *keys;
+    uint16_t *depth;
+
+    /** The scratch buffer of the calling thread */
+    float *scratch;
+
+    /** The workers, and their number */
+    struct reprojection_worker *workers;
+    unsigned int count;
+
+    /** Guards the fields below */
+    pthread_mutex_t mutex;
+
+    /** Signalled when a stage is started, and when the workers have all
+        completed it */
+    pthread_cond_t started, completed;
+
+    /** Incremented for every stage, and the number of workers still working
+        on the current one */
+    unsigned int generation;
+    unsigned int pending;
+
+    /** Whether the workers should exit */
+    int is_stopping;
+
+    /** The current stage, and the first row of the next band */
+    enum reprojection_stage stage;
+    unsigned int next;
+
+    /** The number of holes counted in the fill stage */
+    unsigned int holes;
+
+    /** The heightfield and the view of the new frame */
+    const MazeHeight *heightfield;
+    const ReprojectionView *view;
+
+    /** The transformation from the normalised device coordinates of the
+        reference frame to the clip coordinates of the new one */
+    float transform[16];
+
+    /** The normalised device depth of the floor in the reference frame as
+        an affine function of x and y, and whether the floor is visible */
+    float floor[3];
+    int has_floor;
+
+    /** The transformation from the clip coordinates of the new frame to
+        world coordinates */
+    double inverse[16];
+
+    /** The depth value of the background in either frame */
+    uint16_t reference_background, background;
+
+    /** The pixels that may be covered by the object in either frame, as
+        first column, first row, last column and last row plus one */
+    int reference_box[4], object_box[4];
+};
+
+/**
+ * Multiplies two matrices.
+ *
+ * @param a, b
+ *     The matrices, column by column.
+ * @param result
+ *     Receives a times b.
+ */
+static void
+reprojection_multiply(const double a[16], const double b[16],
+    double result[16])
+{
+    int row, column, i;
+
+    for (column = 0; column < 4; column++) {
+        for (row = 0; row < 4; row++) {
+            double sum = 0.0;
+
+            for (i = 0; i < 4; i++) {
+                sum += a[i * 4 + row] * b[column * 4 + i];
+            }
+            result[column * 4 + row] = sum;
+        }
+    }
+}
+
+/**
+ * Inverts a matrix by Gauss-Jordan elimination.
+ *
+ * @param matrix
+ *     The matrix, column by column.
+ * @param result
+ *     Receives the inverse.
+ * @return non-zero upon success and 0 if the matrix is singular
+ */
+static int
+reprojection_invert(const double matrix[16], double result[16])
+{
+    double rows[4][8];
+    int row, column, i;
+
+    for (row = 0; row < 4; row++) {
+        for (column = 0; column < 4; column++) {
+            rows[row][column] = matrix[column * 4 + row];
+            rows[row][column + 4] = row == column ? 1.0 : 0.0;
+        }
+    }
+
+    for (column = 0; column < 4; column++) {
+        int pivot = column;
+        double scale;
+
+        /* Use the largest remaining value of the column as pivot */
+        for (row = column + 1; row < 4; row++) {
+            if (fabs(rows[row][column]) > fabs(rows[pivot][column])) {
+                pivot = row;
+            }
+        }
+        if (fabs(rows[pivot][column]) < 1e-12) {
+            return 0;
+        }
+        if (pivot != column) {
+            for (i = 0; i < 8; i++) {
+                double swap = rows[pivot][i];
+
+                rows[pivot][i] = rows[column][i];
+                rows[column][i] = swap;
+            }
+        }
+
+        scale = 1.0 / rows[column][column];
+        for (i = 0; i < 8; i++) {
+            rows[column][i] *= scale;
+        }
+        for (row = 0; row < 4; row++) {
+            double factor = rows[row][column];
+
+            if (row == column || factor == 0.0) {
+                continue;
+            }
+            for (i = 0; i < 8; i++) {
+                rows[row][i] -= factor * rows[column][i];
+            }
+        }
+    }
+
+    for (row = 0; row < 4; row++) {
+        for (column = 0; column < 4; column++) {
+            result[column * 4 + row] = rows[row][column + 4];
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Converts a window depth to a depth value.
+ *
+ * @param depth
+ *     The window depth.
+ * @return the depth value, clamped to the range of 16 bits
+ */
+static uint16_t
+reprojection_quantise(double depth)
+{
+    if (depth <= 0.0) {
+        return 0;
+    }
+    else if (depth >= 1.0) {
+        return 0xFFFF;
+    }
+    else {
+        return (uint16_t)(depth * 65535.0 + 0.5);
+    }
+}
+
+/**
+ * Calculates the depth value of a world point seen from a view.
+ *
+ * @param view
+ *     The view.
+ * @param point
+ *     The point.
+ * @return the depth value
+ */
+static uint16_t
+reprojection_depth(const ReprojectionView *view, const double point[3])
+{
+    const double *m = view->matrix;
+    double z = m[2] * point[0] + m[6] * point[1] + m[10] * point[2] + m[14];
+    double w = m[3] * point[0] + m[7] * point[1] + m[11] * point[2] + m[15];
+
+    return reprojection_quantise(0.5 * z / w + 0.5);
+}
+
+/**
+ * Finds the pixels that may be covered by the object of a view.
+ *
+ * @param view
+ *     The view.
+ * @param width, height
+ *     The dimensions of the depth buffers.
+ * @param box
+ *     Receives the first column, first row, last column and last row plus
+ *     one of the pixels.
+ */
+static void
+reprojection_box(const ReprojectionView *view, unsigned int width,
+    unsigned int height, int box[4])
+{
+    const double *m = view->matrix;
+    double radius = view->object_radius * OBJECT_MARGIN;
+    double left = 1.0, bottom = 1.0, right = -1.0, top = -1.0;
+    int i;
+
+    /* Project the corners of a cube around the object */
+    for (i = 0; i < 8; i++) {
+        double x = view->object[0] + (i & 1 ? radius : -radius);
+        double y = view->object[1] + (i & 2 ? radius : -radius);
+        double z = view->object[2] + (i & 4 ? radius : -radius);
+        double cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+        double cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+        double cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+
+        /* A corner behind the eye may project anywhere */
+        if (cw <= 0.0) {
+            box[0] = box[1] = 0;
+            box[2] = width;
+            box[3] = height;
+            return;
+        }
+        cx /= cw;
+        cy /= cw;
+        if (cx < left) {
+            left = cx;
+        }
+        if (cx > right) {
+            right = cx;
+        }
+        if (cy < bottom) {
+            bottom = cy;
+        }
+        if (cy > top) {
+            top = cy;
+        }
+    }
+
+    box[0] = (int)floor((left + 1.0) * 0.5 * width);
+    box[1] = (int)floor((bottom + 1.0) * 0.5 * height);
+    box[2] = (int)ceil((right + 1.0) * 0.5 * width);
+    box[3] = (int)ceil((top + 1.0) * 0.5 * height);
+    box[0] = box[0] < 0 ? 0 : box[0];
+    box[1] = box[1] < 0 ? 0 : box[1];
+    box[2] = box[2] > (int)width ? (int)width : box[2];
+    box[3] = box[3] > (int)height ? (int)height : box[3];
+}
+
+/**
+ * Calculates the ray through a pixel of the new frame.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param x, y
+ *     The pixel.
+ * @param direction
+ *     Receives the direction of the ray from the eye; it reaches the far
+ *     plane at parameter 1.
+ */
+static void
+reprojection_ray(struct reprojection *reprojection, unsigned int x,
+    unsigned int y, double direction[3])
+{
+    const double *m = reprojection->inverse;
+    const double *eye = reprojection->view->eye;
+    double nx = (2.0 * x + 1.0) / reprojection->width - 1.0;
+    double ny = (2.0 * y + 1.0) / reprojection->height - 1.0;
+    double p[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        p[i] = m[i] * nx + m[4 + i] * ny + m[8 + i] + m[12 + i];
+    }
+    for (i = 0; i < 3; i++) {
+        direction[i] = p[i] / p[3] - eye[i];
+    }
+}
+
+/**
+ * Transforms a row of the reference frame to the new one.
+ *
+ * The tests select values instead of branching, so that the loop is
+ * vectorised at -O2.
+ *
+ * @param depth
+ *     The depth values of the row.
+ * @param count
+ *     The number of pixels. This is a multiple of VECTOR_SIZE, so that the
+ *     loop needs no scalar remainder; the values past the end of the row are
+ *     transformed too.
+ * @param constants
+ *     The transformation of the reference frame: the floor depth for the
+ *     row, the scale and offset of the x coordinates, the background value,
+ *     the dimensions of the new frame halved, and the sixteen elements of
+ *     the transformation with those of the y coordinate folded into the
+ *     constant column.
+ * @param px, py, pz
+ *     Receive the window coordinates in the new frame; pz is negative if the
+ *     point is behind the eye.
+ */
+static void
+reprojection_row(const uint16_t *restrict depth, unsigned int count,
+    const float *restrict constants, float *restrict px, float *restrict py,
+    float *restrict pz)
+{
+    float floor_x = constants[0], floor_row = constants[1];
+    float scale = constants[2], offset = constants[3];
+    float background = constants[4];
+    float half_width = constants[5], half_height = constants[6];
+    const float *t = constants + 7;
+    unsigned int x;
+
+    count &= ~(VECTOR_SIZE - 1);
+    for (x = 0; x < count; x++) {
+        float nx = scale * (int)x + offset;
+        float value = depth[x];
+
+        /* 1.0 where the pixel shows the background, which is placed on the
+           floor, and where the point is in front of the eye, and 0.0
+           otherwise; the results are blended with these, since selecting
+           between computed values prevents vectorisation */
+        float is_floor = value >= background ? 1.0f : 0.0f;
+        float nz = is_floor * (floor_x * nx + floor_row)
+            + (1.0f - is_floor) * (value * (2.0f / 65535.0f) - 1.0f);
+        float cw = t[3] * nx + t[11] * nz + t[15];
+        float is_front = cw > 0.0f ? 1.0f : 0.0f;
+        float inverse = 1.0f / cw;
+
+        px[x] = (t[0] * nx + t[8] * nz + t[12]) * inverse * half_width
+            + half_width;
+        py[x] = (t[1] * nx + t[9] * nz + t[13]) * inverse * half_height
+            + half_height;
+        pz[x] = is_front
+            * ((t[2] * nx + t[10] * nz + t[14]) * inverse * 0.5f + 0.5f)
+            * 65535.0f - (1.0f - is_front);
+    }
+}
+
+/**
+ * Keeps the larger of a key and the one stored for a pixel.
+ *
+ * @param key
+ *     The key of the pixel.
+ * @param value
+ *     The new key.
+ */
+static void
+reprojection_keep(uint16_t *key, uint16_t value)
+{
+    uint16_t current = __atomic_load_n(key, __ATOMIC_RELAXED);
+
+    while (value > current && !__atomic_compare_exchange_n(key, &current,
+            value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+
+/**
+ * Transforms rows of the reference frame and keeps the nearest value landing
+ * on every pixel of the new frame.
+ *
+ * The pixels of the reference frame showing the background are placed on the
+ * floor, and those showing the object are skipped, since it has moved.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param first, last
+ *     The first row, and the last row plus one.
+ * @param scratch
+ *     The scratch buffer of the thread.
+ */
+static void
+reprojection_splat(struct reprojection *reprojection, unsigned int first,
+    unsigned int last, float *scratch)
+{
+    unsigned int width = reprojection->width;
+    unsigned int height = reprojection->height;
+    const ReprojectionView *view = &reprojection->reference_view;
+    const double *inverse = reprojection->reference_inverse;
+    const int *box = reprojection->reference_box;
+    const float *t = reprojection->transform;
+    float *px = scratch;
+    float *py = scratch + reprojection->scratch_stride;
+    float *pz = scratch + 2 * reprojection->scratch_stride;
+    uint16_t reference_background = reprojection->reference_background;
+    uint16_t background = reprojection->background;
+    unsigned int padded = (width + VECTOR_SIZE - 1) & ~(VECTOR_SIZE - 1);
+    double radius = view->object_radius * OBJECT_MARGIN;
+    float constants[7 + 16];
+    unsigned int x, y;
+    int i;
+
+    constants[0] = reprojection->floor[0];
+    constants[2] = 2.0f / width;
+    constants[3] = 1.0f / width - 1.0f;
+    constants[4] = reference_background;
+    constants[5] = 0.5f * width;
+    constants[6] = 0.5f * height;
+    for (i = 0; i < 16; i++) {
+        constants[7 + i] = t[i];
+    }
+
+    for (y = first; y < last; y++) {
+        const uint16_t *depth = reprojection->reference
+            + y * reprojection->reference_stride;
+        float ny = (2.0f * y + 1.0f) / height - 1.0f;
+
+        /* Fold the y coordinate into the constant column */
+        constants[1] = reprojection->floor[1] * ny + reprojection->floor[2];
+        for (i = 0; i < 4; i++) {
+            constants[7 + 12 + i] = t[4 + i] * ny + t[12 + i];
+        }
+
+        /* The padding of the row is transformed along with it, but never
+           splatted */
+        reprojection_row(depth, padded, constants, px, py, pz);
+
+        /* Skip the object of the reference frame */
+        if ((int)y >= box[1] && (int)y < box[3]) {
+            for (x = box[0]; x < (unsigned int)box[2]; x++) {
+                double nx = (2.0 * x + 1.0) / width - 1.0;
+                double nz = depth[x] * (2.0 / 65535.0) - 1.0;
+                double distance = 0.0;
+
+                if (depth[x] >= reference_background) {
+                    continue;
+                }
+                for (i = 0; i < 3; i++) {
+                    double d = (inverse[i] * nx + inverse[4 + i] * ny
+                            + inverse[8 + i] * nz + inverse[12 + i])
+                        / (inverse[3] * nx + inverse[7] * ny
+                            + inverse[11] * nz + inverse[15])
+                        - view->object[i];
+
+                    distance += d * d;
+                }
+                if (distance <= radius * radius) {
+                    pz[x] = -1.0f;
+                }
+            }
+        }
+
+        for (x = 0; x < width; x++) {
+            int is_background = depth[x] >= reference_background;
+            uint16_t key;
+
+            if (pz[x] < 0.0f || (is_background && !reprojection->has_floor)
+                    || !(px[x] >= 0.0f && px[x] < width)
+                    || !(py[x] >= 0.0f && py[x] < height)) {
+                continue;
+            }
+
+            key = is_background || pz[x] >= background
+                ? KEY_BACKGROUND
+                : 0xFFFF - (uint16_t)pz[x];
+            reprojection_keep(&reprojection->keys[(unsigned int)py[x] * width
+                + (unsigned int)px[x]], key);
+        }
+    }
+}
+
+/**
+ * Fills the cracks between transformed values, draws the object and counts
+ * the remaining holes in rows of the new frame.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param first, last
+ *     The first row, and the last row plus one.
+ */
+static void
+reprojection_fill(struct reprojection *reprojection, unsigned int first,
+    unsigned int last)
+{
+    unsigned int width = reprojection->width;
+    const ReprojectionView *view = reprojection->view;
+    const int *box = reprojection->object_box;
+    double radius = view->object_radius;
+    unsigned int holes = 0;
+    unsigned int x, y;
+    int i;
+
+    for (y = first; y < last; y++) {
+        uint16_t *keys = reprojection->keys + y * width;
+
+        /* A transformed row stretched by the new view leaves cracks one
+           pixel wide */
+        for (x = 1; x + 1 < width; x++) {
+            uint16_t left = keys[x - 1], right = keys[x + 1];
+
+            if (keys[x] != KEY_HOLE || left == KEY_HOLE
+                    || right == KEY_HOLE) {
+                continue;
+            }
+            if (left == KEY_BACKGROUND || right == KEY_BACKGROUND) {
+                if (left == right) {
+                    keys[x] = KEY_BACKGROUND;
+                }
+            }
+            else if (abs(left - right) <= CRACK_TOLERANCE) {
+                keys[x] = (left + right) / 2;
+            }
+        }
+
+        /* Intersect the rays with the sphere of the object */
+        if ((int)y >= box[1] && (int)y < box[3]) {
+            for (x = box[0]; x < (unsigned int)box[2]; x++) {
+                double direction[3], offset[3], point[3];
+                double a = 0.0, b = 0.0, c = -radius * radius;
+                double discriminant, distance;
+                uint16_t key;
+
+                reprojection_ray(reprojection, x, y, direction);
+                for (i = 0; i < 3; i++) {
+                    offset[i] = view->eye[i] - view->object[i];
+                    a += direction[i] * direction[i];
+                    b += direction[i] * offset[i];
+                    c += offset[i] * offset[i];
+                }
+                discriminant = b * b - a * c;
+                if (discriminant < 0.0) {
+                    continue;
+                }
+                distance = (-b - sqrt(discriminant)) / a;
+                if (distance <= 0.0) {
+                    continue;
+                }
+
+                for (i = 0; i < 3; i++) {
+                    point[i] = view->eye[i] + distance * direction[i];
+                }
+                key = 0xFFFF - reprojection_depth(view, point);
+                if (key > keys[x] && key > KEY_BACKGROUND) {
+                    keys[x] = key;
+                }
+            }
+        }
+
+        for (x = 0; x < width; x++) {
+            holes += keys[x] == KEY_HOLE;
+        }
+    }
+
+    __atomic_fetch_add(&reprojection->holes, holes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Traces the holes and converts the keys to depth values in rows of the new
+ * frame.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param first, last
+ *     The first row, and the last row plus one.
+ */
+static void
+reprojection_resolve(struct reprojection *reprojection, unsigned int first,
+    unsigned int last)
+{
+    unsigned int width = reprojection->width;
+    const ReprojectionView *view = reprojection->view;
+    uint16_t background = reprojection->background;
+    unsigned int x, y;
+
+    for (y = first; y < last; y++) {
+        const uint16_t *keys = reprojection->keys + y * width;
+        uint16_t *depth = reprojection->depth + y * width;
+
+        for (x = 0; x < width; x++) {
+            uint16_t value = background;
+
+            if (keys[x] == KEY_HOLE) {
+                double direction[3], distance;
+
+                reprojection_ray(reprojection, x, y, direction);
+                if (reprojection->heightfield && maze_height_trace(
+                        reprojection->heightfield, view->eye, direction,
+                        &distance)) {
+                    double point[3];
+                    int i;
+
+                    for (i = 0; i < 3; i++) {
+                        point[i] = view->eye[i] + distance * direction[i];
+                    }
+                    value = reprojection_depth(view, point);
+                }
+            }
+            else if (keys[x] != KEY_BACKGROUND) {
+                value = 0xFFFF - keys[x];
+            }
+
+            depth[x] = value < background ? value : background;
+        }
+    }
+}
+
+/**
+ * Processes bands of the current stage of a reprojection until none are
+ * left.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param scratch
+ *     The scratch buffer of the calling thread.
+ */
+static void
+reprojection_bands(struct reprojection *reprojection, float *scratch)
+{
+    unsigned int height = reprojection->height;
+    unsigned int first, last;
+
+    while ((first = __atomic_fetch_add(&reprojection->next, BAND_HEIGHT,
+            __ATOMIC_RELAXED)) < height) {
+        last = height - first > BAND_HEIGHT ? first + BAND_HEIGHT : height;
+        switch (reprojection->stage) {
+        case REPROJECTION_STAGE_SPLAT:
+            reprojection_splat(reprojection, first, last, scratch);
+            break;
+
+        case REPROJECTION_STAGE_FILL:
+            reprojection_fill(reprojection, first, last);
+            break;
+
+        case REPROJECTION_STAGE_RESOLVE:
+            reprojection_resolve(reprojection, first, last);
+            break;
+        }
+    }
+}
+
+/**
+ * Runs a worker thread.
+ *
+ * @param data
+ *     The worker.
+ * @return NULL
+ */
+static void*
+reprojection_worker(void *data)
+{
+    struct reprojection_worker *worker = data;
+    struct reprojection *reprojection = worker->reprojection;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&reprojection->mutex);
+    for (;;) {
+        while (reprojection->generation == generation
+                && !reprojection->is_stopping) {
+            pthread_cond_wait(&reprojection->started, &reprojection->mutex);
+        }
+        if (reprojection->is_stopping) {
+            break;
+        }
+        generation = reprojection->generation;
+        pthread_mutex_unlock(&reprojection->mutex);
+
+        reprojection_bands(reprojection, worker->scratch);
+
+        pthread_mutex_lock(&reprojection->mutex);
+        if (--reprojection->pending == 0) {
+            pthread_cond_signal(&reprojection->completed);
+        }
+    }
+    pthread_mutex_unlock(&reprojection->mutex);
+
+    return NULL;
+}
+
+/**
+ * Runs a stage over all rows, on the worker threads if there are any.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param stage
+ *     The stage.
+ */
+static void
+reprojection_run(struct reprojection *reprojection,
+    enum reprojection_stage stage)
+{
+    pthread_mutex_lock(&reprojection->mutex);
+    reprojection->stage = stage;
+    reprojection->next = 0;
+    reprojection->pending = reprojection->count;
+    reprojection->generation++;
+    pthread_cond_broadcast(&reprojection->started);
+    pthread_mutex_unlock(&reprojection->mutex);
+
+    /* Take part in the stage, and wait for the workers to complete their
+       bands */
+    reprojection_bands(reprojection, reprojection->scratch);
+
+    pthread_mutex_lock(&reprojection->mutex);
+    while (reprojection->pending > 0) {
+        pthread_cond_wait(&reprojection->completed, &reprojection->mutex);
+    }
+    pthread_mutex_unlock(&reprojection->mutex);
+}
+
+Reprojection*
+reprojection_create(unsigned int width, unsigned int height,
+    unsigned int threads)
+{
+    struct reprojection *result;
+    size_t scratch_size;
+    unsigned int i;
+
+    if (threads == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = processors > 0 ? processors : 1;
+    }
+
+    result = malloc(sizeof(struct reprojection));
+    if (!result) {
+        return NULL;
+    }
+    memset(result, 0, sizeof(struct reprojection));
+    result->width = width;
+    result->height = height;
+    result->scratch_stride = arena_stride(width, sizeof(float))
+        / sizeof(float);
+    scratch_size = 3 * result->scratch_stride * sizeof(float);
+    pthread_mutex_init(&result->mutex, NULL);
+    pthread_cond_init(&result->started, NULL);
+    pthread_cond_init(&result->completed, NULL);
+
+    result->reference_stride = arena_stride(width, sizeof(uint16_t))
+        / sizeof(uint16_t);
+    result->reference = calloc((size_t)result->reference_stride * height,
+        sizeof(uint16_t));
+    result->keys = malloc(width * height * sizeof(uint16_t));
+    result->depth = malloc(width * height * sizeof(uint16_t));
+    result->workers = calloc(threads, sizeof(struct reprojection_worker));
+    if (!result->reference || !result->keys || !result->depth
+            || !result->workers || posix_memalign((void**)&result->scratch,
+                ARENA_ALIGNMENT, scratch_size)) {
+        reprojection_free(result);
+        return NULL;
+    }
+
+    for (i = 0; i + 1 < threads; i++) {
+        struct reprojection_worker *worker = &result->workers[i];
+
+        worker->reprojection = result;
+        if (posix_memalign((void**)&worker->scratch, ARENA_ALIGNMENT,
+                scratch_size)) {
+            break;
+        }
+        if (pthread_create(&worker->thread, NULL, reprojection_worker,
+                worker)) {
+            free(worker->scratch);
+            break;
+        }
+        result->count++;
+    }
+
+    if (result->count + 1 < threads) {
+        reprojection_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+void
+reprojection_free(Reprojection *reprojection)
+{
+    unsigned int i;
+
+    if (!reprojection) {
+        return;
+    }
+
+    pthread_mutex_lock(&reprojection->mutex);
+    reprojection->is_stopping = 1;
+    pthread_cond_broadcast(&reprojection->started);
+    pthread_mutex_unlock(&reprojection->mutex);
+
+    for (i = 0; i < reprojection->count; i++) {
+        pthread_join(reprojection->workers[i].thread, NULL);
+        free(reprojection->workers[i].scratch);
+    }
+
+    pthread_cond_destroy(&reprojection->completed);
+    pthread_cond_destroy(&reprojection->started);
+    pthread_mutex_destroy(&reprojection->mutex);
+    free(reprojection->workers);
+    free(reprojection->scratch);
+    free(reprojection->depth);
+    free(reprojection->keys);
+    free(reprojection->reference);
+    free(reprojection);
+}
+
+void
+reprojection_reference(Reprojection *reprojection, const uint16_t *depth,
+    unsigned int depth_stride, const ReprojectionView *view)
+{
+    unsigned int y;
+
+    for (y = 0; y < reprojection->height; y++) {
+        memcpy(reprojection->reference + y * reprojection->reference_stride,
+            depth + y * depth_stride,
+            reprojection->width * sizeof(uint16_t));
+    }
+    reprojection->reference_view = *view;
+    reprojection->is_valid = reprojection_invert(view->matrix,
+        reprojection->reference_inverse);
+}
+
+void
+reprojection_invalidate(Reprojection *reprojection)
+{
+    reprojection->is_valid = 0;
+}
+
+const uint16_t*
+reprojection_apply(Reprojection *reprojection, const MazeHeight *height,
+    const ReprojectionView *view, double max_error, double *error)
+{
+    const double *inverse = reprojection->reference_inverse;
+    double transform[16];
+    int i;
+
+    if (!reprojection->is_valid
+            || !reprojection_invert(view->matrix, reprojection->inverse)) {
+        return NULL;
+    }
+
+    /* Map the normalised device coordinates of the reference frame through
+       world coordinates to the clip coordinates of the new one */
+    reprojection_multiply(view->matrix, inverse, transform);
+    for (i = 0; i < 16; i++) {
+        reprojection->transform[i] = (float)transform[i];
+    }
+
+    /* The floor is where the world z coordinate, and hence the third row of
+       the inverse, vanishes */
+    reprojection->has_floor = fabs(inverse[10]) > 1e-12;
+    if (reprojection->has_floor) {
+        reprojection->floor[0] = (float)(-inverse[2] / inverse[10]);
+        reprojection->floor[1] = (float)(-inverse[6] / inverse[10]);
+        reprojection->floor[2] = (float)(-inverse[14] / inverse[10]);
+    }
+
+    reprojection->reference_background = reprojection_quantise(
+        reprojection->reference_view.background);
+    reprojection->background = reprojection_quantise(view->background);
+    reprojection_box(&reprojection->reference_view, reprojection->width,
+        reprojection->height, reprojection->reference_box);
+    reprojection_box(view, reprojection->width, reprojection->height,
+        reprojection->object_box);
+    reprojection->heightfield = height;
+    reprojection->view = view;
+    reprojection->holes = 0;
+
+    memset(reprojection->keys, 0,
+        reprojection->width * reprojection->height * sizeof(uint16_t));
+    reprojection_run(reprojection, REPROJECTION_STAGE_SPLAT);
+    reprojection_run(reprojection, REPROJECTION_STAGE_FILL);
+
+    *error = (double)reprojection->holes
+        / (reprojection->width * reprojection->height);
+    if (*error > max_error) {
+        return NULL;
+    }
+
+    reprojection_run(reprojection, REPROJECTION_STAGE_RESOLVE);
+
+    return reprojection->depth;
+}
@@ -0,0 +1,119 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include <stdint.h>
+
+#include "maze-height.h"
+
+/**
+ * The view from which a depth buffer is rendered.
+ */
+typedef struct {
+    /** The transformation from world coordinates to clip coordinates,
+        column by column as in OpenGL */
+    double matrix[16];
+
+    /** The position of the eye */
+    double eye[3];
+
+    /** The window depth of the background, to which the depth buffer is
+        cleared before the scene is drawn; nothing behind it is visible */
+    double background;
+
+    /** The centre and radius of the sphere drawn at the target; unlike the
+        rest of the scene, it moves between frames */
+    double object[3];
+    double object_radius;
+} ReprojectionView;
+
+/**
+ * Estimates depth buffers for new views from the last rendered one.
+ *
+ * Every depth value of the reference frame is transformed to the new view,
+ * and the nearest one landing on each pixel is kept. The sphere at the
+ * target is removed from the reference frame and drawn analytically at its
+ * new position. Pixels that no value lands on were hidden in the reference
+ * frame; their depth is found by tracing the heightfield of the maze.
+ *
+ * The work is split into bands of rows processed by a pool of worker
+ * threads, and the transformation of every row is written as a loop over
+ * arrays that the compiler may vectorise.
+ */
+typedef struct reprojection Reprojection;
+
+/**
+ * Creates a reprojection for depth buffers of a given size.
+ *
+ * @param width, height
+ *     The dimensions of the depth buffers.
+ * @param threads
+ *     The number of threads to use, including the calling thread; if this
+ *     is 0, one thread per processor is used.
+ * @return a new reprojection, or NULL upon failure
+ * @see reprojection_free
+ */
+Reprojection*
+reprojection_create(unsigned int width, unsigned int height,
+    unsigned int threads);
+
+/**
+ * Releases a reprojection and stops its worker threads.
+ *
+ * @param reprojection
+ *     The reprojection, or NULL.
+ */
+void
+reprojection_free(Reprojection *reprojection);
+
+/**
+ * Stores a rendered depth buffer as the reference for later frames.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param depth
+ *     The depth values, 16 bits wide.
+ * @param depth_stride
+ *     The distance between two rows of depth values, in values.
+ * @param view
+ *     The view from which the depth buffer was rendered.
+ */
+void
+reprojection_reference(Reprojection *reprojection, const uint16_t *depth,
+    unsigned int depth_stride, const ReprojectionView *view);
+
+/**
+ * Discards the reference frame, for instance because the scene has changed.
+ *
+ * @param reprojection
+ *     The reprojection.
+ */
+void
+reprojection_invalidate(Reprojection *reprojection);
+
+/**
+ * Estimates the depth buffer of a new view from the reference frame.
+ *
+ * The estimated error is the fraction of pixels whose depth could not be
+ * taken from the reference frame. If it exceeds the limit, the estimate is
+ * abandoned before the heightfield is traced, and the scene should be
+ * rendered instead.
+ *
+ * @param reprojection
+ *     The reprojection.
+ * @param height
+ *     The heightfield of the maze, or NULL to show the background through
+ *     any hole.
+ * @param view
+ *     The new view.
+ * @param max_error
+ *     The largest acceptable estimated error.
+ * @param error
+ *     Receives the estimated error, if there is a reference frame.
+ * @return the depth values, with packed rows, valid until the next call, or
+ *     NULL if there is no reference frame or the error is too large
+ */
+const uint16_t*
+reprojection_apply(Reprojection *reprojection, const MazeHeight *height,
+    const ReprojectionView *view, double max_error, double *error);
+
+#endif
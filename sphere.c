@@ -0,0 +1,44 @@
+#include <math.h>
+
+#include "sphere.h"
+
+GLuint
+sphere_list_create(unsigned int precision, GLfloat radius)
+{
+    GLuint result;
+    unsigned int i, j;
+
+    result = glGenLists(1);
+    if (!result) {
+        return 0;
+    }
+
+    glNewList(result, GL_COMPILE);
+    for (i = 0; i < precision / 2; i++) {
+        GLfloat theta1, theta2;
+        theta1 = i * 2.0 * M_PI / precision - M_PI / 2.0;
+        theta2 = (i + 1) * 2.0 * M_PI / precision - M_PI / 2.0;
+
+        glBegin(GL_TRIANGLE_STRIP);
+        for (j = 0; j <= precision; j++) {
+            GLfloat theta3 = j * 2.0 * M_PI / precision;
+            GLfloat x, y, z;
+
+            x = cos(theta1) * cos(theta3);
+            y = sin(theta1);
+            z = cos(theta1) * sin(theta3);
+            glNormal3f(x, y, z);
+            glVertex3f(radius * x, radius * y, radius * z);
+
+            x = cos(theta2) * cos(theta3);
+            y = sin(theta2);
+            z = cos(theta2) * sin(theta3);
+            glNormal3f(x, y, z);
+            glVertex3f(radius * x, radius * y, radius * z);
+        }
+        glEnd();
+    }
+    glEndList();
+
+    return result;
+}
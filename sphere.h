@@ -0,0 +1,25 @@
+#ifndef SPHERE_H
+#define SPHERE_H
+
+#include <GL/gl.h>
+
+/**
+ * Compiles a display list drawing a sphere centred on the origin.
+ *
+ * The sphere is drawn as triangle strips between circles of latitude, with
+ * unit normals. An OpenGL context must be current.
+ *
+ * If this function completes successfully, the list must be deleted with
+ * glDeleteLists.
+ *
+ * @param precision
+ *     The number of segments along the equator; half as many are used
+ *     between the poles.
+ * @param radius
+ *     The radius of the sphere.
+ * @return the display list, or 0 upon failure
+ */
+GLuint
+sphere_list_create(unsigned int precision, GLfloat radius);
+
+#endif
@@ -0,0 +1,76 @@
+#include "stereogram-gl.h"
+
+void
+stereogram_gl_format(StereogramFormat format, GLenum *gl_format,
+    GLenum *gl_type)
+{
+    switch (format) {
+    case STEREOGRAM_FORMAT_RGB565:
+        *gl_format = GL_RGB;
+        *gl_type = GL_UNSIGNED_SHORT_5_6_5;
+        break;
+
+    case STEREOGRAM_FORMAT_INDEXED:
+        *gl_format = GL_COLOR_INDEX;
+        *gl_type = GL_UNSIGNED_BYTE;
+        break;
+
+    default:
+        *gl_format = GL_RGBA;
+        *gl_type = GL_UNSIGNED_BYTE;
+        break;
+    }
+}
+
+GLint
+stereogram_gl_internal_format(StereogramFormat format)
+{
+    switch (format) {
+    case STEREOGRAM_FORMAT_RGB565:
+        return GL_RGB5;
+
+    case STEREOGRAM_FORMAT_INDEXED:
+        /* The palette has 3 bits of red and green and 2 of blue */
+        return GL_R3_G3_B2;
+
+    default:
+        return GL_RGBA8;
+    }
+}
+
+void
+stereogram_gl_palette(void)
+{
+    GLfloat red[STEREOGRAM_PALETTE_SIZE];
+    GLfloat green[STEREOGRAM_PALETTE_SIZE];
+    GLfloat blue[STEREOGRAM_PALETTE_SIZE];
+    GLfloat alpha[STEREOGRAM_PALETTE_SIZE];
+    int i;
+
+    stereogram_palette(red, green, blue);
+    for (i = 0; i < STEREOGRAM_PALETTE_SIZE; i++) {
+        alpha[i] = 1.0;
+    }
+    glPixelMapfv(GL_PIXEL_MAP_I_TO_R, STEREOGRAM_PALETTE_SIZE, red);
+    glPixelMapfv(GL_PIXEL_MAP_I_TO_G, STEREOGRAM_PALETTE_SIZE, green);
+    glPixelMapfv(GL_PIXEL_MAP_I_TO_B, STEREOGRAM_PALETTE_SIZE, blue);
+    glPixelMapfv(GL_PIXEL_MAP_I_TO_A, STEREOGRAM_PALETTE_SIZE, alpha);
+}
+
+void
+stereogram_gl_draw(void)
+{
+    glLoadIdentity();
+
+    /* Draw a rectangle with the stereogram as texture */
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 0.0);
+    glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 0.0);
+    glVertex2f(1.0, -1.0);
+    glTexCoord2f(1.0, 1.0);
+    glVertex2f(1.0, 1.0);
+    glTexCoord2f(0.0, 1.0);
+    glVertex2f(-1.0, 1.0);
+    glEnd();
+}
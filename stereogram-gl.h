@@ -0,0 +1,46 @@
+#ifndef STEREOGRAM_GL_H
+#define STEREOGRAM_GL_H
+
+#include <GL/gl.h>
+
+#include "stereogram.h"
+
+/**
+ * Retrieves the OpenGL format and type of a stereogram pixel format.
+ *
+ * @param format
+ *     The stereogram pixel format.
+ * @param gl_format, gl_type
+ *     The OpenGL format and type.
+ */
+void
+stereogram_gl_format(StereogramFormat format, GLenum *gl_format,
+    GLenum *gl_type);
+
+/**
+ * Retrieves the OpenGL internal format matching a stereogram pixel format,
+ * so that textures do not take more memory than the pixels uploaded to them.
+ *
+ * @param format
+ *     The stereogram pixel format.
+ * @return the internal format
+ */
+GLint
+stereogram_gl_internal_format(StereogramFormat format);
+
+/**
+ * Loads the palette of STEREOGRAM_FORMAT_INDEXED into the OpenGL pixel maps,
+ * so that indexed images are expanded to RGBA on upload.
+ */
+void
+stereogram_gl_palette(void);
+
+/**
+ * Draws the currently bound texture over the whole viewport.
+ *
+ * The modelview matrix is reset.
+ */
+void
+stereogram_gl_draw(void);
+
+#endif
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stereo.h>
+
+#include "stereogram.h"
+
+/* The dimensions of the images generated; the strides leave a gap after
+   every row */
+#define WIDTH 317
+#define HEIGHT 53
+#define DEPTH_STRIDE (WIDTH + 5)
+#define PIXELS_STRIDE (WIDTH + 3)
+
+/* The strength used for all kernels */
+#define STRENGTH 10.0
+
+/* The pattern dimensions tried; those that are powers of two select the
+   specialised implementations */
+static const unsigned int pattern_sizes[][2] = {
+    {64, 32}, {128, 128}, {61, 37}, {100, 64}};
+
+/* The pixel formats tried, and their names */
+static const StereogramFormat formats[] = {
+    STEREOGRAM_FORMAT_RGBA,
+    STEREOGRAM_FORMAT_RGB565,
+    STEREOGRAM_FORMAT_INDEXED};
+static const char *format_names[] = {
+    [STEREOGRAM_FORMAT_RGBA] = "rgba",
+    [STEREOGRAM_FORMAT_RGB565] = "rgb565",
+    [STEREOGRAM_FORMAT_INDEXED] = "indexed"};
+
+/* The 8 bit depth values for which the separations are compared with
+   libstereo */
+static const unsigned int separation_depths[] = {0, 64, 128, 192, 224, 255};
+
+/* The ways in which the kernels under test generate images */
+static const StereogramTuning tunings[] = {
+    {1, 0, 0}, {1, 0, 1}, {3, 0, 0}, {3, 8, 0}, {3, 8, 1}};
+
+/**
+ * Advances a pseudo random sequence.
+ *
+ * @param seed
+ *     The state of the sequence. This is updated.
+ * @return the next value
+ */
+static uint32_t
+test_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+
+    return *seed >> 8;
+}
+
+/**
+ * Fills a depth buffer with fixed values.
+ *
+ * The top rows are smooth gradients and steps covering every separation,
+ * and the bottom rows are noise, so that every pattern row and column is
+ * used.
+ *
+ * @param depth
+ *     The depth buffer, with rows DEPTH_STRIDE values apart.
+ */
+static void
+test_depth(uint16_t *depth)
+{
+    uint32_t seed = 1;
+    unsigned int x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            uint16_t value;
+
+            if (y < HEIGHT / 3) {
+                value = (x * 65536 / WIDTH + y * 256) & 0xFFFF;
+            }
+            else if (y < 2 * HEIGHT / 3) {
+                value = (x / 40) % 2 ? 0xFFFF : 0x4000 * (y % 4);
+            }
+            else {
+                value = test_random(&seed);
+            }
+            depth[y * DEPTH_STRIDE + x] = value;
+        }
+    }
+}
+
+/**
+ * Fills a pattern with pseudo random pixels.
+ *
+ * @param pattern
+ *     The pattern.
+ * @param seed
+ *     The seed of the pixels.
+ */
+static void
+test_pattern(StereoPattern *pattern, uint32_t seed)
+{
+    uint8_t *pixels = (uint8_t*)pattern->pixels;
+    unsigned int i;
+
+    for (i = 0; i < 4 * pattern->width * pattern->height; i++) {
+        pixels[i] = test_random(&seed);
+    }
+}
+
+/**
+ * Compares two images.
+ *
+ * @param expected, actual
+ *     The images, with rows PIXELS_STRIDE pixels apart.
+ * @param pixel_size
+ *     The size of a pixel.
+ * @return non-zero if the images are identical and 0 otherwise
+ */
+static int
+test_compare(const uint8_t *expected, const uint8_t *actual,
+    unsigned int pixel_size)
+{
+    unsigned int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        size_t offset = (size_t)y * PIXELS_STRIDE * pixel_size;
+
+        if (memcmp(expected + offset, actual + offset, WIDTH * pixel_size)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Checks every implementation of a kernel for one pixel format and pattern
+ * size against the generic implementation.
+ *
+ * Images are generated with and without recording sources, and the images
+ * recoloured through the sources after the pattern has changed are
+ * compared as well.
+ *
+ * @param format
+ *     The pixel format.
+ * @param pattern_width, pattern_height
+ *     The dimensions of the pattern.
+ * @param depth
+ *     The depth values.
+ * @return the number of failed checks
+ */
+static int
+test_kernels(StereogramFormat format, unsigned int pattern_width,
+    unsigned int pattern_height, const uint16_t *depth)
+{
+    StereoPattern *pattern;
+    Stereogram *reference;
+    StereogramTuning generic = {1, 0, 1};
+    size_t size = (size_t)PIXELS_STRIDE * HEIGHT
+        * stereogram_pixel_size(format);
+    uint8_t *expected, *expected_recoloured, *actual;
+    int failures = 0;
+    unsigned int i;
+    int has_sources;
+
+    pattern = stereo_pattern_create(pattern_width, pattern_height);
+    expected = calloc(1, size);
+    expected_recoloured = calloc(1, size);
+    actual = calloc(1, size);
+    if (!pattern || !expected || !expected_recoloured || !actual) {
+        printf("FAIL %s %ux%u: out of memory\n", format_names[format],
+            pattern_width, pattern_height);
+        return 1;
+    }
+
+    /* Generate the expected images with the generic implementation, from
+       the original and from an updated pattern */
+    test_pattern(pattern, 1);
+    reference = stereogram_create(WIDTH, HEIGHT, pattern, STRENGTH, format);
+    if (!reference || !stereogram_tune(reference, &generic)) {
+        printf("FAIL %s %ux%u: unable to create kernel\n",
+            format_names[format], pattern_width, pattern_height);
+        return 1;
+    }
+    stereogram_apply(reference, depth, DEPTH_STRIDE, expected,
+        PIXELS_STRIDE);
+    test_pattern(pattern, 2);
+    stereogram_pattern_update(reference);
+    stereogram_apply(reference, depth, DEPTH_STRIDE, expected_recoloured,
+        PIXELS_STRIDE);
+    stereogram_free(reference);
+
+    for (has_sources = 0; has_sources < 2; has_sources++) {
+        for (i = 0; i < sizeof(tunings) / sizeof(*tunings); i++) {
+            const StereogramTuning *tuning = &tunings[i];
+            Stereogram *kernel;
+            int is_valid;
+
+            test_pattern(pattern, 1);
+            kernel = stereogram_create(WIDTH, HEIGHT, pattern, STRENGTH,
+                format);
+            is_valid = kernel
+                && (!has_sources || stereogram_sources_enable(kernel))
+                && stereogram_tune(kernel, tuning);
+            if (is_valid) {
+                memset(actual, 0, size);
+                stereogram_apply(kernel, depth, DEPTH_STRIDE, actual,
+                    PIXELS_STRIDE);
+                is_valid = test_compare(expected, actual,
+                    kernel->pixel_size);
+            }
+
+            /* Gather the image for the updated pattern through the
+               sources */
+            if (is_valid && has_sources) {
+                test_pattern(pattern, 2);
+                stereogram_pattern_update(kernel);
+                memset(actual, 0, size);
+                is_valid = stereogram_recolour(kernel, actual, PIXELS_STRIDE)
+                    && test_compare(expected_recoloured, actual,
+                        kernel->pixel_size);
+            }
+
+            printf("%s %s %ux%u%s threads %u band %u%s\n",
+                is_valid ? "ok  " : "FAIL",
+                format_names[format], pattern_width, pattern_height,
+                has_sources ? " sources" : "",
+                tuning->threads, tuning->band_height,
+                !kernel ? ""
+                    : kernel->kernel == kernel->generic ? " generic"
+                    : " specialised");
+            failures += !is_valid;
+            if (kernel) {
+                stereogram_free(kernel);
+            }
+        }
+    }
+
+    free(actual);
+    free(expected_recoloured);
+    free(expected);
+    stereo_pattern_free(pattern);
+
+    return failures;
+}
+
+/**
+ * Measures the separation in a row of an image generated from a constant
+ * depth.
+ *
+ * Such a row repeats with a period of the separation, so this is the
+ * smallest shift for which the middle of the row matches itself.
+ *
+ * @param row
+ *     The row, with 4 byte pixels.
+ * @param width
+ *     The width of the row.
+ * @return the separation, or 0 if the row does not repeat
+ */
+static unsigned int
+test_separation_measure(const uint8_t *row, unsigned int width)
+{
+    unsigned int start = width / 2, end = width / 2 + 32;
+    unsigned int separation;
+
+    for (separation = 1; separation <= start && end <= width; separation++) {
+        if (!memcmp(row + 4 * start, row + 4 * (start - separation),
+                4 * (end - start))) {
+            return separation;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Compares the separations generated by libstereo from an 8 bit z-buffer
+ * with those generated by a kernel from the same depth at 16 bit.
+ *
+ * The two must be within a pixel of each other for every depth.
+ *
+ * @param is_linear
+ *     Whether the kernel reads grayscale depth map values, as when
+ *     converting depth maps in batch; libstereo then gets their inverse.
+ * @return the number of failed checks
+ */
+static int
+test_separations(int is_linear)
+{
+    StereogramTuning generic = {1, 0, 1};
+    StereoPattern *pattern;
+    ZBuffer *zbuffer;
+    StereoImage *image;
+    Stereogram *kernel;
+    uint16_t *depth;
+    uint32_t *pixels;
+    int failures = 0;
+    unsigned int i, x, y;
+
+    pattern = stereo_pattern_create(64, 32);
+    zbuffer = stereo_zbuffer_create(WIDTH, HEIGHT, 1);
+    depth = malloc((size_t)DEPTH_STRIDE * HEIGHT * sizeof(uint16_t));
+    pixels = malloc((size_t)PIXELS_STRIDE * HEIGHT * sizeof(uint32_t));
+    if (!pattern || !zbuffer || !depth || !pixels) {
+        printf("FAIL separations: out of memory\n");
+        return 1;
+    }
+    test_pattern(pattern, 3);
+    image = stereo_image_create_from_zbuffer(zbuffer, pattern, STRENGTH, 1);
+    kernel = stereogram_create(WIDTH, HEIGHT, pattern, STRENGTH,
+        STEREOGRAM_FORMAT_RGBA);
+    if (!image || !kernel || !stereogram_tune(kernel, &generic)) {
+        printf("FAIL separations: unable to create images\n");
+        return 1;
+    }
+    if (is_linear) {
+        stereogram_depth_linear(kernel);
+    }
+
+    for (i = 0; i < sizeof(separation_depths) / sizeof(*separation_depths);
+            i++) {
+        unsigned int expected, actual;
+        int is_valid;
+
+        /* Expanding the 8 bit value by 257 gives the same depth at 16 bit;
+           in a depth map, white is nearest */
+        for (y = 0; y < HEIGHT; y++) {
+            for (x = 0; x < WIDTH; x++) {
+                zbuffer->data[y * zbuffer->rowoffset + x] =
+                    separation_depths[i];
+                depth[y * DEPTH_STRIDE + x] = is_linear
+                    ? (255 - separation_depths[i]) * 257
+                    : separation_depths[i] * 257;
+            }
+        }
+
+        stereo_image_apply(image, zbuffer, 0);
+        expected = test_separation_measure(
+            (const uint8_t*)image->image->pixels
+                + (size_t)4 * (HEIGHT / 2) * image->image->width,
+            image->image->width);
+        stereogram_apply(kernel, depth, DEPTH_STRIDE, pixels, PIXELS_STRIDE);
+        actual = test_separation_measure(
+            (const uint8_t*)(pixels + (HEIGHT / 2) * PIXELS_STRIDE), WIDTH);
+
+        is_valid = expected && actual
+            && expected <= actual + 1 && actual <= expected + 1;
+        printf("%s separations%s depth %u: libstereo %u, kernel %u\n",
+            is_valid ? "ok  " : "FAIL", is_linear ? " linear" : "",
+            separation_depths[i], expected, actual);
+        failures += !is_valid;
+    }
+
+    stereogram_free(kernel);
+    stereo_image_free(image);
+    free(pixels);
+    free(depth);
+    stereo_zbuffer_free(zbuffer);
+    stereo_pattern_free(pattern);
+
+    return failures;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint16_t *depth;
+    int failures = 0;
+    unsigned int i, j;
+
+    depth = malloc((size_t)DEPTH_STRIDE * HEIGHT * sizeof(uint16_t));
+    if (!depth) {
+        return 1;
+    }
+    test_depth(depth);
+
+    for (i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+        for (j = 0; j < sizeof(pattern_sizes) / sizeof(*pattern_sizes); j++) {
+            failures += test_kernels(formats[i], pattern_sizes[j][0],
+                pattern_sizes[j][1], depth);
+        }
+    }
+
+    free(depth);
+
+    failures += test_separations(0);
+    failures += test_separations(1);
+
+    printf("%d failed\n", failures);
+
+    return failures > 0;
+}
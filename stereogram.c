@@ -0,0 +1,853 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stereogram.h"
+
+/* The number of bits to shift a 16 bit depth value to get the table index */
+#define DEPTH_SHIFT (16 - STEREOGRAM_DEPTH_BITS)
+
+/* Wraps a coordinate to the pattern; the mask variant requires the size to
+   be a power of two */
+#define WRAP_MODULO(value, size) ((value) % (size))
+#define WRAP_MASK(value, size) ((value) & ((size) - 1))
+
+/**
+ * Generates rows of a stereogram for a specific pixel type.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param depth, depth_stride
+ *     The depth values of the image and the number of values per row.
+ * @param pixels, pixels_stride
+ *     The output pixels of the image and the number of pixels per row.
+ * @param first, last
+ *     The first row to generate, and the row after the last one.
+ * @param row_buffer
+ *     A buffer holding a row of pixels.
+ * @param type
+ *     The pixel type.
+ * @param wrap
+ *     The macro wrapping coordinates to the pattern; WRAP_MODULO or
+ *     WRAP_MASK.
+ */
+#define STEREOGRAM_ROWS(stereogram, depth, depth_stride, pixels, \
+        pixels_stride, first, last, row_buffer, type, wrap) \
+    do { \
+        const type *pattern = (stereogram)->pattern_pixels; \
+        unsigned int pattern_width = (stereogram)->pattern->width; \
+        unsigned int pattern_height = (stereogram)->pattern->height; \
+        type *row = (row_buffer); \
+        type *out = (type*)(pixels) + (size_t)(first) * (pixels_stride); \
+        const uint16_t *in = (depth) + (size_t)(first) * (depth_stride); \
+        unsigned int x, y; \
+        \
+        for (y = (first); y < (last); y++) { \
+            const type *pattern_row = pattern \
+                + wrap(y, pattern_height) * pattern_width; \
+            \
+            for (x = 0; x < (stereogram)->width; x++) { \
+                int separation = (stereogram)->separations[ \
+                    in[x] >> DEPTH_SHIFT]; \
+                \
+                row[x] = x < separation \
+                    ? pattern_row[wrap(x, pattern_width)] \
+                    : row[x - separation]; \
+            } \
+            memcpy(out, row, (stereogram)->width * sizeof(type)); \
+            \
+            in += (depth_stride); \
+            out += (pixels_stride); \
+        } \
+    } while (0)
+
+/**
+ * Generates the rows of a stereogram for a specific pixel type, and records
+ * the pattern pixel that every pixel is copied from.
+ *
+ * The sources of a row are found first, and the row is then gathered from
+ * the pattern while they are still in the cache.
+ *
+ * @param stereogram, depth, depth_stride, pixels, pixels_stride, first, last
+ *     See STEREOGRAM_ROWS.
+ * @param type, wrap
+ *     See STEREOGRAM_ROWS.
+ */
+#define STEREOGRAM_ROWS_SOURCES(stereogram, depth, depth_stride, pixels, \
+        pixels_stride, first, last, type, wrap) \
+    do { \
+        const type *pattern = (stereogram)->pattern_pixels; \
+        unsigned int pattern_width = (stereogram)->pattern->width; \
+        unsigned int pattern_height = (stereogram)->pattern->height; \
+        uint32_t *sources = (stereogram)->sources \
+            + (size_t)(first) * (stereogram)->width; \
+        type *out = (type*)(pixels) + (size_t)(first) * (pixels_stride); \
+        const uint16_t *in = (depth) + (size_t)(first) * (depth_stride); \
+        unsigned int x, y; \
+        \
+        for (y = (first); y < (last); y++) { \
+            uint32_t pattern_row = wrap(y, pattern_height) * pattern_width; \
+            \
+            for (x = 0; x < (stereogram)->width; x++) { \
+                int separation = (stereogram)->separations[ \
+                    in[x] >> DEPTH_SHIFT]; \
+                \
+                sources[x] = x < separation \
+                    ? pattern_row + wrap(x, pattern_width) \
+                    : sources[x - separation]; \
+            } \
+            for (x = 0; x < (stereogram)->width; x++) { \
+                out[x] = pattern[sources[x]]; \
+            } \
+            \
+            in += (depth_stride); \
+            out += (pixels_stride); \
+            sources += (stereogram)->width; \
+        } \
+    } while (0)
+
+/**
+ * Defines a kernel function specialised for a pixel type and a way of
+ * wrapping coordinates to the pattern.
+ *
+ * @param name
+ *     The name of the function.
+ * @param type, wrap
+ *     See STEREOGRAM_ROWS.
+ */
+#define STEREOGRAM_KERNEL(name, type, wrap) \
+    static void \
+    name(Stereogram *stereogram, \
+        const uint16_t *depth, unsigned int depth_stride, \
+        void *pixels, unsigned int pixels_stride, \
+        unsigned int first, unsigned int last, void *buffer) \
+    { \
+        STEREOGRAM_ROWS(stereogram, depth, depth_stride, pixels, \
+            pixels_stride, first, last, buffer, type, wrap); \
+    }
+
+/**
+ * Defines a kernel function recording the source of every pixel; see
+ * STEREOGRAM_KERNEL.
+ */
+#define STEREOGRAM_KERNEL_SOURCES(name, type, wrap) \
+    static void \
+    name(Stereogram *stereogram, \
+        const uint16_t *depth, unsigned int depth_stride, \
+        void *pixels, unsigned int pixels_stride, \
+        unsigned int first, unsigned int last, void *buffer) \
+    { \
+        STEREOGRAM_ROWS_SOURCES(stereogram, depth, depth_stride, pixels, \
+            pixels_stride, first, last, type, wrap); \
+    }
+
+/**
+ * Defines a function regenerating rows of an image from the recorded sources
+ * of its pixels for a pixel type; see stereogram_recolour.
+ *
+ * @param name
+ *     The name of the function.
+ * @param type
+ *     The pixel type.
+ */
+#define STEREOGRAM_GATHER(name, type) \
+    static void \
+    name(Stereogram *stereogram, void *pixels, unsigned int pixels_stride, \
+        unsigned int first, unsigned int last) \
+    { \
+        const type *restrict pattern = stereogram->pattern_pixels; \
+        const uint32_t *restrict sources = stereogram->sources \
+            + (size_t)first * stereogram->width; \
+        type *restrict out = (type*)pixels + (size_t)first * pixels_stride; \
+        unsigned int x, y; \
+        \
+        for (y = first; y < last; y++) { \
+            for (x = 0; x < stereogram->width; x++) { \
+                out[x] = pattern[sources[x]]; \
+            } \
+            sources += stereogram->width; \
+            out += pixels_stride; \
+        } \
+    }
+
+STEREOGRAM_KERNEL(stereogram_rgba, uint32_t, WRAP_MODULO)
+STEREOGRAM_KERNEL(stereogram_rgba_pow2, uint32_t, WRAP_MASK)
+STEREOGRAM_KERNEL(stereogram_rgb565, uint16_t, WRAP_MODULO)
+STEREOGRAM_KERNEL(stereogram_rgb565_pow2, uint16_t, WRAP_MASK)
+STEREOGRAM_KERNEL(stereogram_indexed, uint8_t, WRAP_MODULO)
+STEREOGRAM_KERNEL(stereogram_indexed_pow2, uint8_t, WRAP_MASK)
+
+STEREOGRAM_KERNEL_SOURCES(stereogram_rgba_sources, uint32_t, WRAP_MODULO)
+STEREOGRAM_KERNEL_SOURCES(stereogram_rgba_pow2_sources, uint32_t, WRAP_MASK)
+STEREOGRAM_KERNEL_SOURCES(stereogram_rgb565_sources, uint16_t, WRAP_MODULO)
+STEREOGRAM_KERNEL_SOURCES(stereogram_rgb565_pow2_sources, uint16_t,
+    WRAP_MASK)
+STEREOGRAM_KERNEL_SOURCES(stereogram_indexed_sources, uint8_t, WRAP_MODULO)
+STEREOGRAM_KERNEL_SOURCES(stereogram_indexed_pow2_sources, uint8_t,
+    WRAP_MASK)
+
+STEREOGRAM_GATHER(stereogram_rgba_gather, uint32_t)
+STEREOGRAM_GATHER(stereogram_rgb565_gather, uint16_t)
+STEREOGRAM_GATHER(stereogram_indexed_gather, uint8_t)
+
+/* The kernels for every pixel format, generic and for pattern dimensions
+   that are powers of two, and the same kernels recording the source of
+   every pixel */
+static const StereogramFunction kernels[][2] = {
+    [STEREOGRAM_FORMAT_RGBA] = {
+        stereogram_rgba, stereogram_rgba_pow2 },
+    [STEREOGRAM_FORMAT_RGB565] = {
+        stereogram_rgb565, stereogram_rgb565_pow2 },
+    [STEREOGRAM_FORMAT_INDEXED] = {
+        stereogram_indexed, stereogram_indexed_pow2 }};
+static const StereogramFunction kernels_sources[][2] = {
+    [STEREOGRAM_FORMAT_RGBA] = {
+        stereogram_rgba_sources, stereogram_rgba_pow2_sources },
+    [STEREOGRAM_FORMAT_RGB565] = {
+        stereogram_rgb565_sources, stereogram_rgb565_pow2_sources },
+    [STEREOGRAM_FORMAT_INDEXED] = {
+        stereogram_indexed_sources, stereogram_indexed_pow2_sources }};
+
+/* The functions regenerating an image from its sources for every pixel
+   format */
+static void (*const gathers[])(Stereogram *stereogram, void *pixels,
+        unsigned int pixels_stride, unsigned int first, unsigned int last) = {
+    [STEREOGRAM_FORMAT_RGBA] = stereogram_rgba_gather,
+    [STEREOGRAM_FORMAT_RGB565] = stereogram_rgb565_gather,
+    [STEREOGRAM_FORMAT_INDEXED] = stereogram_indexed_gather};
+
+/**
+ * Returns whether a value is a power of two.
+ *
+ * @param value
+ *     The value.
+ * @return non-zero if the value is a power of two and 0 otherwise
+ */
+static int
+is_power_of_two(unsigned int value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/**
+ * Picks the implementation of a kernel.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param is_generic
+ *     Whether to use the generic implementation regardless.
+ */
+static void
+stereogram_pick(Stereogram *stereogram, int is_generic)
+{
+    const StereogramFunction *table = stereogram->sources
+        ? kernels_sources[stereogram->format]
+        : kernels[stereogram->format];
+
+    stereogram->generic = table[0];
+    stereogram->kernel = table[!is_generic
+        && is_power_of_two(stereogram->pattern->width)
+        && is_power_of_two(stereogram->pattern->height)];
+}
+
+/**
+ * A worker thread of a pool.
+ */
+struct stereogram_worker {
+    /** The pool */
+    struct stereogram_pool *pool;
+
+    /** The thread */
+    pthread_t thread;
+
+    /** The buffer holding the row being generated by this thread */
+    void *row;
+};
+
+/**
+ * The worker threads generating bands of rows of an image in parallel with
+ * the calling thread.
+ */
+struct stereogram_pool {
+    /** The kernel */
+    Stereogram *stereogram;
+
+    /** The workers, and their number */
+    struct stereogram_worker *workers;
+    unsigned int count;
+
+    /** Guards the fields below */
+    pthread_mutex_t mutex;
+
+    /** Signalled when a job is started, and when the workers have all
+        completed it */
+    pthread_cond_t started, completed;
+
+    /** Incremented for every job, and the number of workers still working
+        on the current one */
+    unsigned int generation;
+    unsigned int pending;
+
+    /** Whether the workers should exit */
+    int is_stopping;
+
+    /** The current job; see stereogram_run */
+    const uint16_t *depth;
+    unsigned int depth_stride;
+    void *pixels;
+    unsigned int pixels_stride;
+    int is_recolour;
+
+    /** The first row of the next band to generate */
+    unsigned int next;
+};
+
+/**
+ * Generates bands of the current job of a pool until none are left.
+ *
+ * @param pool
+ *     The pool.
+ * @param row
+ *     The row buffer of the calling thread.
+ */
+static void
+stereogram_bands(struct stereogram_pool *pool, void *row)
+{
+    Stereogram *stereogram = pool->stereogram;
+    unsigned int height = stereogram->height;
+    unsigned int band_height = stereogram->tuning.band_height;
+    unsigned int first, last;
+
+    if (band_height == 0) {
+        band_height = (height + pool->count) / (pool->count + 1);
+    }
+
+    while ((first = __atomic_fetch_add(&pool->next, band_height,
+            __ATOMIC_RELAXED)) < height) {
+        last = height - first > band_height ? first + band_height : height;
+        if (pool->is_recolour) {
+            gathers[stereogram->format](stereogram, pool->pixels,
+                pool->pixels_stride, first, last);
+        }
+        else {
+            stereogram->kernel(stereogram, pool->depth, pool->depth_stride,
+                pool->pixels, pool->pixels_stride, first, last, row);
+        }
+    }
+}
+
+/**
+ * Runs a worker thread.
+ *
+ * @param data
+ *     The worker.
+ * @return NULL
+ */
+static void*
+stereogram_worker(void *data)
+{
+    struct stereogram_worker *worker = data;
+    struct stereogram_pool *pool = worker->pool;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->generation == generation && !pool->is_stopping) {
+            pthread_cond_wait(&pool->started, &pool->mutex);
+        }
+        if (pool->is_stopping) {
+            break;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        stereogram_bands(pool, worker->row);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->completed);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/**
+ * Stops the worker threads of a pool and releases it.
+ *
+ * @param pool
+ *     The pool, or NULL.
+ */
+static void
+stereogram_pool_free(struct stereogram_pool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->is_stopping = 1;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        free(pool->workers[i].row);
+    }
+
+    pthread_cond_destroy(&pool->completed);
+    pthread_cond_destroy(&pool->started);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Starts worker threads for a kernel.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param count
+ *     The number of worker threads, not including the calling thread.
+ * @return a new pool, or NULL upon failure
+ */
+static struct stereogram_pool*
+stereogram_pool_create(Stereogram *stereogram, unsigned int count)
+{
+    struct stereogram_pool *result;
+    unsigned int i;
+
+    result = malloc(sizeof(struct stereogram_pool));
+    if (!result) {
+        return NULL;
+    }
+    memset(result, 0, sizeof(struct stereogram_pool));
+    result->stereogram = stereogram;
+    result->workers = calloc(count, sizeof(struct stereogram_worker));
+    if (!result->workers) {
+        free(result);
+        return NULL;
+    }
+    pthread_mutex_init(&result->mutex, NULL);
+    pthread_cond_init(&result->started, NULL);
+    pthread_cond_init(&result->completed, NULL);
+
+    for (i = 0; i < count; i++) {
+        struct stereogram_worker *worker = &result->workers[i];
+
+        worker->pool = result;
+        if (posix_memalign(&worker->row, ARENA_ALIGNMENT,
+                arena_stride(stereogram->width, stereogram->pixel_size))) {
+            break;
+        }
+        if (pthread_create(&worker->thread, NULL, stereogram_worker,
+                worker)) {
+            free(worker->row);
+            break;
+        }
+        result->count++;
+    }
+
+    if (result->count < count) {
+        stereogram_pool_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+/**
+ * Generates or regenerates an image, on the worker threads if the kernel has
+ * any.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param depth, depth_stride
+ *     The depth values; see stereogram_apply. These are ignored if
+ *     is_recolour is set.
+ * @param pixels, pixels_stride
+ *     The output pixels; see stereogram_apply.
+ * @param is_recolour
+ *     Whether to gather the image through the recorded sources instead of
+ *     generating it from the depth values.
+ */
+static void
+stereogram_run(Stereogram *stereogram,
+    const uint16_t *depth, unsigned int depth_stride,
+    void *pixels, unsigned int pixels_stride, int is_recolour)
+{
+    struct stereogram_pool *pool = stereogram->pool;
+
+    if (!pool) {
+        if (is_recolour) {
+            gathers[stereogram->format](stereogram, pixels, pixels_stride,
+                0, stereogram->height);
+        }
+        else {
+            stereogram->kernel(stereogram, depth, depth_stride, pixels,
+                pixels_stride, 0, stereogram->height, stereogram->row);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->depth = depth;
+    pool->depth_stride = depth_stride;
+    pool->pixels = pixels;
+    pool->pixels_stride = pixels_stride;
+    pool->is_recolour = is_recolour;
+    pool->next = 0;
+    pool->pending = pool->count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* Take part in the job, and wait for the workers to complete their
+       bands */
+    stereogram_bands(pool, stereogram->row);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->completed, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Measures the separation libstereo uses for every 8 bit depth value.
+ *
+ * libstereo generates a row for every depth from a pattern whose columns are
+ * all different, and the separation is the shortest period of the end of
+ * the row. A separation of twice the pattern width generates the same image
+ * as the pattern width, and is measured as such.
+ *
+ * @param pattern_width, pattern_height
+ *     The dimensions of the pattern.
+ * @param strength
+ *     The strength of the effect.
+ * @param separations
+ *     The separation for every 8 bit depth value, with 0 at the near plane.
+ * @return whether the separations were measured
+ */
+static int
+stereogram_calibrate(unsigned int pattern_width, unsigned int pattern_height,
+    double strength, int16_t *separations)
+{
+    /* The row is long enough to check two periods of the longest separation
+       after the pattern has been copied */
+    unsigned int width = 8 * pattern_width;
+    StereoPattern *pattern;
+    ZBuffer *zbuffer;
+    StereoImage *image;
+    uint32_t *pixels;
+    unsigned int x, y, z;
+
+    pattern = stereo_pattern_create(pattern_width, pattern_height);
+    zbuffer = stereo_zbuffer_create(width, 1, 1);
+    image = pattern && zbuffer
+        ? stereo_image_create_from_zbuffer(zbuffer, pattern, strength, 1)
+        : NULL;
+    if (!image) {
+        if (zbuffer) {
+            stereo_zbuffer_free(zbuffer);
+        }
+        if (pattern) {
+            stereo_pattern_free(pattern);
+        }
+        return 0;
+    }
+
+    /* Every column of the pattern is opaque and tagged with its index */
+    pixels = (uint32_t*)pattern->pixels;
+    for (y = 0; y < pattern_height; y++) {
+        for (x = 0; x < pattern_width; x++) {
+            pixels[y * pattern_width + x] = 0xFF000000u | x;
+        }
+    }
+
+    for (z = 0; z < 256; z++) {
+        const uint32_t *row = (const uint32_t*)image->image->pixels;
+        unsigned int separation;
+
+        for (x = 0; x < width; x++) {
+            zbuffer->data[x] = z;
+        }
+        stereo_image_apply(image, zbuffer, 0);
+
+        for (separation = 1; separation <= 2 * pattern_width; separation++) {
+            for (x = width - 4 * pattern_width; x < width; x++) {
+                if (row[x] != row[x - separation]) {
+                    break;
+                }
+            }
+            if (x == width) {
+                break;
+            }
+        }
+
+        /* Fall back to the far plane if the row does not repeat */
+        separations[z] = separation <= 2 * pattern_width
+            ? separation : pattern_width;
+    }
+
+    stereo_image_free(image);
+    stereo_zbuffer_free(zbuffer);
+    stereo_pattern_free(pattern);
+
+    return 1;
+}
+
+unsigned int
+stereogram_pixel_size(StereogramFormat format)
+{
+    switch (format) {
+    case STEREOGRAM_FORMAT_RGB565:
+        return sizeof(uint16_t);
+
+    case STEREOGRAM_FORMAT_INDEXED:
+        return sizeof(uint8_t);
+
+    default:
+        return sizeof(uint32_t);
+    }
+}
+
+void
+stereogram_palette(float *red, float *green, float *blue)
+{
+    int i;
+
+    for (i = 0; i < STEREOGRAM_PALETTE_SIZE; i++) {
+        red[i] = ((i >> 5) & 0x07) / 7.0;
+        green[i] = ((i >> 2) & 0x07) / 7.0;
+        blue[i] = (i & 0x03) / 3.0;
+    }
+}
+
+Stereogram*
+stereogram_create(unsigned int width, unsigned int height,
+    StereoPattern *pattern, double strength, StereogramFormat format)
+{
+    Stereogram *result;
+    int16_t separations[256];
+    int i;
+
+    if (!pattern || pattern->width == 0 || pattern->height == 0) {
+        return NULL;
+    }
+
+    if (!stereogram_calibrate(pattern->width, pattern->height, strength,
+            separations)) {
+        return NULL;
+    }
+
+    result = malloc(sizeof(Stereogram));
+    if (!result) {
+        return NULL;
+    }
+
+    result->width = width;
+    result->height = height;
+    result->format = format;
+    result->pixel_size = stereogram_pixel_size(format);
+    result->pattern = pattern;
+    if (posix_memalign(&result->row, ARENA_ALIGNMENT,
+            arena_stride(width, result->pixel_size))) {
+        free(result);
+        return NULL;
+    }
+    result->pattern_pixels = NULL;
+    if (format != STEREOGRAM_FORMAT_RGBA && posix_memalign(
+            &result->pattern_pixels, ARENA_ALIGNMENT,
+            arena_stride(pattern->width * pattern->height,
+                result->pixel_size))) {
+        free(result->row);
+        free(result);
+        return NULL;
+    }
+
+    /* Use the separation of the 8 bit depth value OpenGL would have read
+       back for the window depth */
+    for (i = 0; i < 1 << STEREOGRAM_DEPTH_BITS; i++) {
+        result->separations[i] = separations[
+            ((i << DEPTH_SHIFT) * 255 + 32767) / 65535];
+    }
+
+    stereogram_pattern_update(result);
+
+    /* Generate images on the calling thread until tuned */
+    result->sources = NULL;
+    result->has_sources = 0;
+    result->tuning.threads = 1;
+    result->tuning.band_height = 0;
+    result->tuning.is_generic = 0;
+    result->pool = NULL;
+    stereogram_pick(result, 0);
+
+    return result;
+}
+
+int
+stereogram_sources_enable(Stereogram *stereogram)
+{
+    if (stereogram->sources) {
+        return 1;
+    }
+
+    if (posix_memalign((void**)&stereogram->sources, ARENA_ALIGNMENT,
+            arena_stride(stereogram->width * stereogram->height,
+                sizeof(uint32_t)))) {
+        stereogram->sources = NULL;
+        return 0;
+    }
+
+    /* Switch to the kernels recording the sources */
+    stereogram_pick(stereogram, stereogram->tuning.is_generic);
+
+    return 1;
+}
+
+void
+stereogram_sources_disable(Stereogram *stereogram)
+{
+    if (!stereogram->sources) {
+        return;
+    }
+
+    free(stereogram->sources);
+    stereogram->sources = NULL;
+    stereogram->has_sources = 0;
+
+    /* Switch back to the kernels generating images directly */
+    stereogram_pick(stereogram, stereogram->tuning.is_generic);
+}
+
+int
+stereogram_tune(Stereogram *stereogram, const StereogramTuning *tuning)
+{
+    stereogram_pool_free(stereogram->pool);
+    stereogram->pool = NULL;
+
+    stereogram->tuning = *tuning;
+    if (stereogram->tuning.threads < 1) {
+        stereogram->tuning.threads = 1;
+    }
+    stereogram_pick(stereogram, tuning->is_generic);
+
+    if (stereogram->tuning.threads > 1) {
+        stereogram->pool = stereogram_pool_create(stereogram,
+            stereogram->tuning.threads - 1);
+        if (!stereogram->pool) {
+            stereogram->tuning.threads = 1;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void
+stereogram_free(Stereogram *stereogram)
+{
+    if (!stereogram) {
+        return;
+    }
+
+    stereogram_pool_free(stereogram->pool);
+    free(stereogram->sources);
+    if (stereogram->format != STEREOGRAM_FORMAT_RGBA) {
+        free(stereogram->pattern_pixels);
+    }
+    free(stereogram->row);
+    free(stereogram);
+}
+
+void
+stereogram_depth_linear(Stereogram *stereogram)
+{
+    int16_t separations[256];
+    int i;
+
+    /* The 8 bit window depth values are exact at 16 bit when expanded by
+       257 */
+    for (i = 0; i < 256; i++) {
+        separations[i] = stereogram->separations[(i * 257) >> DEPTH_SHIFT];
+    }
+
+    /* White is nearest in a depth map, and 0 in a z-buffer */
+    for (i = 0; i < 1 << STEREOGRAM_DEPTH_BITS; i++) {
+        stereogram->separations[i] = separations[
+            255 - ((i << DEPTH_SHIFT) * 255 + 32767) / 65535];
+    }
+}
+
+void
+stereogram_pattern_set(Stereogram *stereogram, StereoPattern *pattern)
+{
+    stereogram->pattern = pattern;
+    stereogram->has_sources = 0;
+    stereogram_pattern_update(stereogram);
+}
+
+void
+stereogram_pattern_update(Stereogram *stereogram)
+{
+    const uint8_t *source = (const uint8_t*)stereogram->pattern->pixels;
+    unsigned int i, count;
+
+    count = stereogram->pattern->width * stereogram->pattern->height;
+
+    switch (stereogram->format) {
+    case STEREOGRAM_FORMAT_RGB565:
+        for (i = 0; i < count; i++, source += 4) {
+            ((uint16_t*)stereogram->pattern_pixels)[i] =
+                  ((source[0] >> 3) << 11)
+                | ((source[1] >> 2) << 5)
+                | (source[2] >> 3);
+        }
+        break;
+
+    case STEREOGRAM_FORMAT_INDEXED:
+        for (i = 0; i < count; i++, source += 4) {
+            ((uint8_t*)stereogram->pattern_pixels)[i] =
+                  ((source[0] >> 5) << 5)
+                | ((source[1] >> 5) << 2)
+                | (source[2] >> 6);
+        }
+        break;
+
+    default:
+        /* The pattern is already in this format; it is only looked up again
+           since its buffer may have moved */
+        stereogram->pattern_pixels = stereogram->pattern->pixels;
+        break;
+    }
+}
+
+void
+stereogram_apply(Stereogram *stereogram,
+    const uint16_t *depth, unsigned int depth_stride,
+    void *pixels, unsigned int pixels_stride)
+{
+    stereogram_run(stereogram, depth, depth_stride, pixels, pixels_stride,
+        0);
+    stereogram->has_sources = stereogram->sources != NULL;
+}
+
+int
+stereogram_recolour(Stereogram *stereogram, void *pixels,
+    unsigned int pixels_stride)
+{
+    if (!stereogram->has_sources) {
+        return 0;
+    }
+
+    stereogram_run(stereogram, NULL, 0, pixels, pixels_stride, 1);
+
+    return 1;
+}
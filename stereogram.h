@@ -0,0 +1,321 @@
+#ifndef STEREOGRAM_H
+#define STEREOGRAM_H
+
+#include <stdint.h>
+
+#include <stereo.h>
+
+/**
+ * The number of bits of a depth value used to look up its separation; the
+ * table covers every 16 bit depth value.
+ */
+#define STEREOGRAM_DEPTH_BITS 16
+
+/**
+ * The number of colours in the palette used by STEREOGRAM_FORMAT_INDEXED.
+ */
+#define STEREOGRAM_PALETTE_SIZE 256
+
+/**
+ * The pixel formats of the pattern and image of a stereogram kernel.
+ */
+typedef enum {
+    /** 32 bit pixels with 8 bits each of red, green, blue and alpha, in that
+        order in memory */
+    STEREOGRAM_FORMAT_RGBA,
+
+    /** 16 bit pixels with 5 bits of red, 6 of green and 5 of blue, from the
+        most significant bit */
+    STEREOGRAM_FORMAT_RGB565,
+
+    /** 8 bit indices into the palette returned by stereogram_palette */
+    STEREOGRAM_FORMAT_INDEXED
+} StereogramFormat;
+
+struct stereogram;
+struct stereogram_pool;
+
+/**
+ * A function generating rows of a stereogram image; see stereogram_apply.
+ *
+ * The depth and pixels arguments point to the first row of the image. Rows
+ * first to last - 1 are generated, using row as a buffer of one row of
+ * pixels.
+ */
+typedef void (*StereogramFunction)(struct stereogram *stereogram,
+    const uint16_t *depth, unsigned int depth_stride,
+    void *pixels, unsigned int pixels_stride,
+    unsigned int first, unsigned int last, void *row);
+
+/**
+ * The way in which a kernel generates images; see stereogram_tune.
+ */
+typedef struct {
+    /** The number of threads generating an image, including the calling
+        thread */
+    unsigned int threads;
+
+    /** The number of rows handed to a thread at a time, or 0 to split the
+        image evenly between the threads */
+    unsigned int band_height;
+
+    /** Whether to use the generic implementation even if a specialised one
+        is available */
+    int is_generic;
+} StereogramTuning;
+
+/**
+ * A stereogram kernel turning window depth values directly into stereogram
+ * pixels.
+ *
+ * Depth values are 16 bit window coordinates as read back from OpenGL. They
+ * are converted to separations through a table computed when the kernel is
+ * created, so each row is generated in a single pass over its depth values.
+ *
+ * The table is measured from the images libstereo generates for every 8 bit
+ * depth value, so a window depth gets the separation libstereo would use for
+ * the same depth read back as an 8 bit z-buffer; stereogram-test checks that
+ * the two agree.
+ *
+ * For the compact pixel formats, the kernel keeps a copy of the pattern in
+ * its own pixel format; this copy is refreshed by stereogram_pattern_update.
+ *
+ * Every pixel format has a generic implementation and one specialised for
+ * patterns whose dimensions are powers of two, which wraps coordinates with
+ * a mask instead of a division. The implementation is picked when the kernel
+ * is created; stereogram-test checks that all of them generate the same
+ * images.
+ *
+ * A kernel may also record which pattern pixel every image pixel was copied
+ * from. As long as the depth values do not change, an image for an updated
+ * pattern is then a gather from the pattern through these sources, without
+ * looking at the depth values again.
+ */
+typedef struct stereogram {
+    /** The dimensions of the image */
+    unsigned int width, height;
+
+    /** The pixel format, and the size of a pixel */
+    StereogramFormat format;
+    unsigned int pixel_size;
+
+    /** The source pattern */
+    StereoPattern *pattern;
+
+    /** The pattern converted to the pixel format of the kernel; for
+        STEREOGRAM_FORMAT_RGBA, these are the pixels of the pattern */
+    void *pattern_pixels;
+
+    /** The separation for every depth value */
+    int16_t separations[1 << STEREOGRAM_DEPTH_BITS];
+
+    /** A buffer holding the row being generated */
+    void *row;
+
+    /** The index in the pattern of the pixel that every pixel of the last
+        image was copied from, if enabled by stereogram_sources_enable, and
+        whether it holds the sources of an image */
+    uint32_t *sources;
+    int has_sources;
+
+    /** The implementation used, and the generic implementation for the
+        pixel format */
+    StereogramFunction kernel;
+    StereogramFunction generic;
+
+    /** The way in which images are generated */
+    StereogramTuning tuning;
+
+    /** The worker threads, if more than one thread is used */
+    struct stereogram_pool *pool;
+} Stereogram;
+
+/**
+ * Returns the size of a pixel.
+ *
+ * @param format
+ *     The pixel format.
+ * @return the number of bytes per pixel
+ */
+unsigned int
+stereogram_pixel_size(StereogramFormat format);
+
+/**
+ * Retrieves the palette used by STEREOGRAM_FORMAT_INDEXED.
+ *
+ * The palette is fixed, with 3 bits of red, 3 bits of green and 2 bits of
+ * blue.
+ *
+ * @param red, green, blue
+ *     Arrays of STEREOGRAM_PALETTE_SIZE values receiving the colour
+ *     components, in the range 0.0 to 1.0.
+ */
+void
+stereogram_palette(float *red, float *green, float *blue);
+
+/**
+ * Creates a stereogram kernel.
+ *
+ * If this function completes successfully, stereogram_free must be called.
+ *
+ * @param width, height
+ *     The dimensions of the image.
+ * @param pattern
+ *     The pattern. Its pixels must be 32 bits wide, and it must not be freed
+ *     while the kernel is used.
+ * @param strength
+ *     The strength of the effect; see the stereogram-strength option.
+ * @param format
+ *     The pixel format of the generated images.
+ * @return a new kernel, or NULL upon failure
+ * @see stereogram_free
+ */
+Stereogram*
+stereogram_create(unsigned int width, unsigned int height,
+    StereoPattern *pattern, double strength, StereogramFormat format);
+
+/**
+ * Releases a previously created stereogram kernel.
+ *
+ * @param stereogram
+ *     The kernel to free.
+ */
+void
+stereogram_free(Stereogram *stereogram);
+
+/**
+ * Makes a kernel treat depth values as grayscale depth map values.
+ *
+ * By default, depth values are window coordinates with 0 at the near plane.
+ * After this call, 0 is the far plane and 65535 the near plane, and a depth
+ * map value gets the separation libstereo uses for a z-buffer holding its
+ * inverse at 8 bit.
+ *
+ * This must be called only once for a kernel, since it converts the table
+ * for window coordinates.
+ *
+ * @param stereogram
+ *     The kernel.
+ */
+void
+stereogram_depth_linear(Stereogram *stereogram);
+
+/**
+ * Makes a kernel record the source in the pattern of every pixel it
+ * generates, so that stereogram_recolour may be used.
+ *
+ * Generating an image is slightly slower when sources are recorded.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @return non-zero upon success and 0 otherwise
+ */
+int
+stereogram_sources_enable(Stereogram *stereogram);
+
+/**
+ * Makes a kernel stop recording sources, and releases them.
+ *
+ * The kernel switches back to the implementations generating images
+ * directly, and stereogram_recolour fails until sources are enabled and an
+ * image has been generated again.
+ *
+ * @param stereogram
+ *     The kernel.
+ */
+void
+stereogram_sources_disable(Stereogram *stereogram);
+
+/**
+ * Changes the way in which a kernel generates images.
+ *
+ * Rows are independent, so an image may be generated by several threads,
+ * each handed bands of rows until none are left. The calling thread takes
+ * part, and stereogram_apply and stereogram_recolour return once the whole
+ * image has been generated.
+ *
+ * This should be called after stereogram_sources_enable, if that is used.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param tuning
+ *     The number of threads, band height and implementation to use.
+ * @return non-zero upon success, and 0 if the worker threads could not be
+ *     started, in which case images are generated on the calling thread
+ */
+int
+stereogram_tune(Stereogram *stereogram, const StereogramTuning *tuning);
+
+/**
+ * Makes a kernel generate images from another pattern.
+ *
+ * This allows a kernel to be created from a pattern of the same dimensions
+ * while the actual pattern is still being generated.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param pattern
+ *     The new pattern. This must have the same dimensions as the pattern
+ *     the kernel was created with.
+ */
+void
+stereogram_pattern_set(Stereogram *stereogram, StereoPattern *pattern);
+
+/**
+ * Converts the pattern to the pixel format of the kernel.
+ *
+ * This must be called whenever the pattern has changed or its pixels have
+ * moved. Patterns are only converted for the compact formats; RGBA kernels
+ * read the pixels of the pattern directly.
+ *
+ * @param stereogram
+ *     The kernel.
+ */
+void
+stereogram_pattern_update(Stereogram *stereogram);
+
+/**
+ * Generates a stereogram image.
+ *
+ * The output is only written to, never read, so it may point to mapped
+ * memory.
+ *
+ * @param stereogram
+ *     The kernel.
+ * @param depth
+ *     The depth values.
+ * @param depth_stride
+ *     The number of depth values between the start of two rows.
+ * @param pixels
+ *     The output pixels, in the pixel format of the kernel.
+ * @param pixels_stride
+ *     The number of pixels between the start of two rows.
+ */
+void
+stereogram_apply(Stereogram *stereogram,
+    const uint16_t *depth, unsigned int depth_stride,
+    void *pixels, unsigned int pixels_stride);
+
+/**
+ * Regenerates the last image generated by stereogram_apply from the current
+ * pattern.
+ *
+ * The image is gathered from the pattern through the sources recorded by
+ * stereogram_apply, so this is only valid if the depth values of the next
+ * image would be the same as those of the last one.
+ *
+ * @param stereogram
+ *     The kernel. Sources must have been enabled with
+ *     stereogram_sources_enable.
+ * @param pixels
+ *     The output pixels, in the pixel format of the kernel.
+ * @param pixels_stride
+ *     The number of pixels between the start of two rows.
+ * @return non-zero if the image was regenerated, and 0 if no sources have
+ *     been recorded
+ */
+int
+stereogram_recolour(Stereogram *stereogram, void *pixels,
+    unsigned int pixels_stride);
+
+#endif
@@ -0,0 +1,251 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+/**
+ * A recorded event.
+ */
+typedef struct {
+    /** The name of the event; NULL for the end of a duration */
+    const char *name;
+
+    /** The time of the event, in nanoseconds */
+    uint64_t time;
+
+    /** The Chrome trace event phase */
+    char phase;
+} TraceEvent;
+
+/**
+ * The events of a single thread.
+ *
+ * Only the owning thread writes events; the number of events ever written is
+ * published after each event, so that trace_dump may read the ring without
+ * locking.
+ */
+typedef struct trace_ring {
+    /** The operating system identifier and the name of the thread */
+    long tid;
+    const char *name;
+
+    /** The number of events ever written */
+    uint64_t head;
+
+    /** The events; event i is stored at i modulo TRACE_RING_SIZE */
+    TraceEvent events[TRACE_RING_SIZE];
+
+    /** The next ring */
+    struct trace_ring *next;
+} TraceRing;
+
+/* Whether events are recorded */
+static int enabled = 0;
+
+/* All rings ever created */
+static TraceRing *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The ring of the current thread */
+static __thread TraceRing *local = NULL;
+
+/**
+ * Returns the ring of the current thread, creating it if necessary.
+ *
+ * @return the ring, or NULL if it could not be allocated
+ */
+static TraceRing*
+trace_local(void)
+{
+    TraceRing *ring;
+
+    if (local) {
+        return local;
+    }
+
+    ring = calloc(1, sizeof(TraceRing));
+    if (!ring) {
+        return NULL;
+    }
+    ring->tid = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_lock);
+
+    local = ring;
+
+    return ring;
+}
+
+/**
+ * Records an event for the current thread.
+ *
+ * @param name
+ *     The name of the event.
+ * @param phase
+ *     The Chrome trace event phase.
+ */
+static void
+trace_record(const char *name, char phase)
+{
+    TraceRing *ring;
+    TraceEvent *event;
+
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    ring = trace_local();
+    if (!ring) {
+        return;
+    }
+
+    event = &ring->events[ring->head % TRACE_RING_SIZE];
+    event->name = name;
+    event->time = metrics_now();
+    event->phase = phase;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_start(void)
+{
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+}
+
+void
+trace_thread_name(const char *name)
+{
+    TraceRing *ring;
+
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    ring = trace_local();
+    if (ring) {
+        __atomic_store_n(&ring->name, name, __ATOMIC_RELEASE);
+    }
+}
+
+void
+trace_begin(const char *name)
+{
+    trace_record(name, 'B');
+}
+
+void
+trace_end(void)
+{
+    trace_record(NULL, 'E');
+}
+
+void
+trace_instant(const char *name)
+{
+    trace_record(name, 'i');
+}
+
+/**
+ * Writes the events of a ring.
+ *
+ * The events are copied before they are written, and any event that may have
+ * been overwritten while copying is dropped.
+ *
+ * @param file
+ *     The file to write to.
+ * @param ring
+ *     The ring.
+ * @param events
+ *     A buffer of TRACE_RING_SIZE events.
+ * @param pid
+ *     The process identifier.
+ * @param separator
+ *     The separator written before the first event, and updated as events
+ *     are written.
+ */
+static void
+trace_dump_ring(FILE *file, const TraceRing *ring, TraceEvent *events,
+    long pid, const char **separator)
+{
+    const char *name = __atomic_load_n(&ring->name, __ATOMIC_ACQUIRE);
+    uint64_t first, last, head, i;
+
+    last = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    first = last > TRACE_RING_SIZE ? last - TRACE_RING_SIZE : 0;
+    for (i = first; i < last; i++) {
+        events[i % TRACE_RING_SIZE] = ring->events[i % TRACE_RING_SIZE];
+    }
+
+    /* Drop the events overwritten while copying, and the one in the slot
+       the thread may be writing to */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head >= first + TRACE_RING_SIZE) {
+        first = head - TRACE_RING_SIZE + 1;
+    }
+
+    if (name) {
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+            "\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+            *separator, pid, ring->tid, name);
+        *separator = ",";
+    }
+
+    for (i = first; i < last; i++) {
+        const TraceEvent *event = &events[i % TRACE_RING_SIZE];
+
+        fprintf(file, "%s\n{\"ph\":\"%c\",\"pid\":%ld,\"tid\":%ld,"
+            "\"ts\":%.3f", *separator, event->phase, pid, ring->tid,
+            event->time / 1000.0);
+        if (event->name) {
+            fprintf(file, ",\"name\":\"%s\"", event->name);
+        }
+        if (event->phase == 'i') {
+            fprintf(file, ",\"s\":\"t\"");
+        }
+        fprintf(file, "}");
+        *separator = ",";
+    }
+}
+
+int
+trace_dump(const char *path)
+{
+    const char *separator = "";
+    TraceEvent *events;
+    TraceRing *ring;
+    FILE *file;
+    int result;
+
+    events = malloc(sizeof(TraceEvent) * TRACE_RING_SIZE);
+    if (!events) {
+        return 0;
+    }
+
+    file = fopen(path, "w");
+    if (!file) {
+        free(events);
+        return 0;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring;
+            ring = ring->next) {
+        trace_dump_ring(file, ring, events, (long)getpid(), &separator);
+    }
+    fprintf(file, "\n]}\n");
+
+    result = !ferror(file);
+    result = fclose(file) == 0 && result;
+    free(events);
+
+    return result;
+}
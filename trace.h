@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * The number of events kept per thread; older events are overwritten.
+ */
+#define TRACE_RING_SIZE 65536
+
+/**
+ * Starts recording events.
+ *
+ * Until this function is called, all other trace functions do nothing.
+ */
+void
+trace_start(void);
+
+/**
+ * Names the current thread in the trace.
+ *
+ * @param name
+ *     The name of the thread. This must be a string literal.
+ */
+void
+trace_thread_name(const char *name);
+
+/**
+ * Marks the beginning of a duration.
+ *
+ * Durations on the same thread must nest, and every call must be matched by
+ * a call to trace_end.
+ *
+ * @param name
+ *     The name of the duration. This must be a string literal.
+ * @see trace_end
+ */
+void
+trace_begin(const char *name);
+
+/**
+ * Marks the end of the innermost duration started by trace_begin.
+ */
+void
+trace_end(void);
+
+/**
+ * Marks a single point in time.
+ *
+ * @param name
+ *     The name of the event. This must be a string literal.
+ */
+void
+trace_instant(const char *name);
+
+/**
+ * Writes all recorded events in the Chrome trace event format.
+ *
+ * The file may be opened in chrome://tracing or in Perfetto. Events may be
+ * recorded while the file is written; they are not included.
+ *
+ * @param path
+ *     The file to write. It is replaced if it exists.
+ * @return non-zero upon success and 0 otherwise
+ */
+int
+trace_dump(const char *path);
+
+#endif